@@ -21,6 +21,9 @@
 #if HAVE_LIBARCHIVE
 #  include <archive.h>
 #  include <archive_entry.h>
+#  include <sys/stat.h>
+#  include <glob.h>
+#  include <unistd.h>
 #endif
 // C++
 #if HAVE_LIBXML
@@ -28,6 +31,7 @@
 #endif
 #include <string>
 #include <map>
+#include <thread>
 
 using std::string;
 using std::map;
@@ -41,18 +45,20 @@ namespace hfst_ol
   {
 
 #if HAVE_LIBARCHIVE
-inline std::string extract_to_mem(archive* ar, archive_entry* entry) {
-    size_t full_length = 0;
+inline size_t entry_size(archive* ar, archive_entry* entry) {
     const struct stat* st = archive_entry_stat(entry);
     size_t buffsize = st->st_size;
     if (buffsize == 0) {
         std::cerr << archive_error_string(ar) << std::endl;
         throw ZHfstZipReadingError("Reading archive resulted in zero length entry");
     }
+    return buffsize;
+}
 
-    std::string buff(buffsize, 0);
+inline void extract_to_buffer(archive* ar, char* buff, size_t buffsize) {
+    size_t full_length = 0;
     for (;;) {
-        ssize_t curr = archive_read_data(ar, &buff[0] + full_length, buffsize - full_length);
+        ssize_t curr = archive_read_data(ar, buff + full_length, buffsize - full_length);
         if (0 == curr) {
             break;
         }
@@ -74,14 +80,28 @@ inline std::string extract_to_mem(archive* ar, archive_entry* entry) {
         std::cerr << archive_error_string(ar) << std::endl;
         throw ZHfstZipReadingError("Reading archive resulted in zero length");
     }
+}
 
+inline std::string extract_to_mem(archive* ar, archive_entry* entry) {
+    size_t buffsize = entry_size(ar, entry);
+    std::string buff(buffsize, 0);
+    extract_to_buffer(ar, &buff[0], buffsize);
     return buff;
 }
 
 inline Transducer* transducer_to_mem(archive* ar, archive_entry* entry) {
-    std::string buff = extract_to_mem(ar, entry);
-    Transducer *trans = new Transducer(&buff[0]);
-    return trans;
+    // Extract straight into a buffer the transducer keeps and borrows its
+    // tables from, so we never hold more than one copy of them
+    size_t buffsize = entry_size(ar, entry);
+    MappedFile* buff = new MappedFile(buffsize);
+    try {
+        extract_to_buffer(ar, buff->get_data(), buffsize);
+    }
+    catch (...) {
+        delete buff;
+        throw;
+    }
+    return new Transducer(buff);
 }
 
 inline char* extract_to_tmp_dir(archive* ar) {
@@ -97,11 +117,199 @@ inline char* extract_to_tmp_dir(archive* ar) {
 
 inline Transducer* transducer_to_tmp_dir(archive* ar) {
     char *filename = extract_to_tmp_dir(ar);
-    FILE* f = fopen(filename, "rb");
-    if (f == nullptr) {
+    MappedFile* mapping = nullptr;
+    try {
+        mapping = new MappedFile(filename);
+    }
+    catch (const FileMappingException&) {
+        free(filename);
         throw ZHfstTemporaryWritingError("reading acceptor back from temp file");
     }
-    return new Transducer(f);
+    free(filename);
+    return new Transducer(mapping);
+}
+
+inline Transducer* transducer_from_archive(archive* ar, archive_entry* entry) {
+    Transducer* trans = nullptr;
+#if ZHFST_EXTRACT_TO_MEM == 1
+    // Try to memory first...
+    try {
+        trans = transducer_to_mem(ar, entry);
+    }
+    catch (...) {
+        // If that failed, try to /tmp
+        //std::cerr << "Failed to memory - falling back to /tmp" << std::endl;
+        trans = transducer_to_tmp_dir(ar);
+    }
+#else
+    // Try to /tmp first...
+    try {
+        trans = transducer_to_tmp_dir(ar);
+    }
+    catch (...) {
+        // If that failed, try to memory
+        //std::cerr << "Failed to /tmp - falling back to memory" << std::endl;
+        trans = transducer_to_mem(ar, entry);
+    }
+#endif
+    return trans;
+}
+
+// 64 bit FNV-1a of @a text, for telling apart cache files of archives
+// with the same name
+inline uint64_t name_hash(const std::string& text) {
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < text.size(); ++i) {
+        hash = (hash ^ static_cast<unsigned char>(text[i])) * 1099511628211u;
+    }
+    return hash;
+}
+
+// @a text with the characters glob() would expand escaped
+inline std::string glob_escape(const std::string& text) {
+    std::string escaped;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (strchr("*?[\\", text[i]) != NULL) {
+            escaped.push_back('\\');
+        }
+        escaped.push_back(text[i]);
+    }
+    return escaped;
+}
+
+// whether @a text has the shape of the stamps read_zhfst() makes, i.e.
+// five numbers joined by dashes and a dot at the end
+inline bool is_cache_stamp(const std::string& text) {
+    size_t numbers = 0;
+    size_t digits = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] >= '0' && text[i] <= '9') {
+            digits++;
+            continue;
+        }
+        if (digits == 0 || (text[i] != '-' && text[i] != '.')) {
+            return false;
+        }
+        numbers++;
+        digits = 0;
+        if (text[i] == '.') {
+            return numbers == 5 && i + 1 == text.size();
+        }
+    }
+    return false;
+}
+
+// Removes the cache files of @a entry made from earlier versions of the
+// archive, i.e. the ones named @a prefix, a stamp other than @a stamp and
+// @a entry. Files of other archives sharing the prefix have something
+// other than a stamp in between and are left alone. Processes still
+// mapping the removed files keep their mappings.
+inline void remove_stale_caches(const std::string& prefix,
+                                const std::string& entry,
+                                const std::string& stamp) {
+    glob_t found;
+    std::string pattern = glob_escape(prefix) + "*." + glob_escape(entry);
+    if (glob(pattern.c_str(), 0, NULL, &found) != 0) {
+        return;
+    }
+    for (size_t i = 0; i < found.gl_pathc; ++i) {
+        std::string path = found.gl_pathv[i];
+        if (path.size() <= prefix.size() + entry.size()) {
+            continue;
+        }
+        std::string other = path.substr(prefix.size(), path.size() -
+                                        prefix.size() - entry.size());
+        if (other != stamp && is_cache_stamp(other)) {
+            unlink(found.gl_pathv[i]);
+        }
+    }
+    globfree(&found);
+}
+
+// The cache file holds the entry converted to the native format, so that
+// its tables can be used straight from the shared mapping. It is named
+// @a prefix, then @a stamp telling the size, device, inode and mtime of the
+// archive, and then the entry, so a cache file is only ever used for the
+// archive it was made from. Returns nullptr without consuming the entry if the cache file
+// is missing and can't be written, so the caller can extract it privately.
+inline Transducer* transducer_to_shared_cache(archive* ar, archive_entry* entry,
+                                              const std::string& prefix,
+                                              const std::string& stamp) {
+    std::string entryname = archive_entry_pathname(entry);
+    std::string cachename = prefix + stamp + entryname;
+    std::string mapname = cachename;
+    struct stat cache_st;
+    if (stat(cachename.c_str(), &cache_st) != 0) {
+        // Write under a temporary name and rename into place, so that other
+        // processes never map a partially written cache
+        std::string tmpname = cachename + ".XXXXXX";
+        int temp_fd = mkstemp(&tmpname[0]);
+        if (temp_fd < 0) {
+            return nullptr;
+        }
+        fchmod(temp_fd, 0644);
+        FILE* temp = fdopen(temp_fd, "wb");
+        MappedFile* classic = nullptr;
+        try {
+            size_t buffsize = entry_size(ar, entry);
+            classic = new MappedFile(buffsize);
+            extract_to_buffer(ar, classic->get_data(), buffsize);
+            if (temp == nullptr) {
+                throw ZHfstTemporaryWritingError("writing shared cache " + tmpname);
+            }
+            write_native_transducer(classic->get_data(),
+                                    classic->get_data() + buffsize, temp);
+        }
+        catch (const OspellException& e) {
+            delete classic;
+            if (temp != nullptr) {
+                fclose(temp);
+            }
+            else {
+                close(temp_fd);
+            }
+            unlink(tmpname.c_str());
+            throw ZHfstTemporaryWritingError("writing shared cache " + tmpname +
+                                             ": " + e.name);
+        }
+        catch (...) {
+            delete classic;
+            if (temp != nullptr) {
+                fclose(temp);
+            }
+            else {
+                close(temp_fd);
+            }
+            unlink(tmpname.c_str());
+            throw;
+        }
+        delete classic;
+        if (fclose(temp) != 0) {
+            unlink(tmpname.c_str());
+            throw ZHfstTemporaryWritingError("writing shared cache " + tmpname);
+        }
+        if (rename(tmpname.c_str(), cachename.c_str()) != 0) {
+            // Couldn't publish it; still map our own copy, unlinked below
+            mapname = tmpname;
+        }
+        else {
+            remove_stale_caches(prefix, entryname, stamp);
+        }
+    }
+    MappedFile* mapping = nullptr;
+    try {
+        mapping = new MappedFile(mapname);
+    }
+    catch (const FileMappingException&) {
+        if (mapname != cachename) {
+            unlink(mapname.c_str());
+        }
+        throw ZHfstTemporaryWritingError("reading shared cache " + mapname);
+    }
+    if (mapname != cachename) {
+        unlink(mapname.c_str());
+    }
+    return new Transducer(mapping);
 }
 
 #endif // HAVE_LIBARCHIVE
@@ -111,30 +319,26 @@ ZHfstOspeller::ZHfstOspeller() :
     maximum_weight_(-1.0),
     beam_(-1.0),
     time_cutoff_(0.0),
+    max_expanded_(0),
+    max_frontier_(0),
+    best_first_(false),
+    prune_visited_(false),
+    search_threads_(1),
+    split_after_(1024),
+    prefix_cache_length_(1),
+    prefix_cache_budget_(0),
     can_spell_(false),
     can_correct_(false),
     can_analyse_(true),
-    current_speller_(0),
-    current_sugger_(0)
+    shared_cache_(false),
+    model_(0),
+    owns_model_(false)
     {
     }
 
 ZHfstOspeller::~ZHfstOspeller()
   {
-    if ((current_speller_ != NULL) && (current_sugger_ != NULL))
-      {
-        if (current_speller_ != current_sugger_)
-          {
-            delete current_speller_;
-            delete current_sugger_;
-          }
-        else
-          {
-            delete current_speller_;
-          }
-        current_sugger_ = 0;
-        current_speller_ = 0;
-      }
+    release_model();
     for (auto& acceptor : acceptors_)
       {
         delete acceptor.second;
@@ -147,11 +351,79 @@ ZHfstOspeller::~ZHfstOspeller()
     can_correct_ = false;
   }
 
+class ZHfstOspeller::SpellerLease
+  {
+    public:
+        explicit SpellerLease(ZHfstOspeller& ospeller) :
+            ospeller_(ospeller),
+            speller_(ospeller.acquire_speller())
+            {
+            }
+        ~SpellerLease()
+          {
+            ospeller_.release_speller(speller_);
+          }
+        Speller* operator->() const
+          {
+            return speller_;
+          }
+    private:
+        ZHfstOspeller& ospeller_;
+        Speller* speller_;
+  };
+
+Speller*
+ZHfstOspeller::acquire_speller()
+  {
+      {
+        std::lock_guard<std::mutex> lock(idle_spellers_mutex_);
+        if (!idle_spellers_.empty())
+          {
+            Speller* speller = idle_spellers_.back();
+            idle_spellers_.pop_back();
+            return speller;
+          }
+      }
+      // as many spellers as calls at the same time, all sharing the model
+      return new Speller(model_);
+  }
+
+void
+ZHfstOspeller::release_speller(Speller* speller)
+  {
+      std::lock_guard<std::mutex> lock(idle_spellers_mutex_);
+      idle_spellers_.push_back(speller);
+  }
+
+void
+ZHfstOspeller::release_model()
+  {
+      // the spellers go first, as they search the model
+      for (auto& speller : idle_spellers_)
+        {
+          delete speller;
+        }
+      idle_spellers_.clear();
+      if (owns_model_)
+        {
+          delete model_;
+        }
+      model_ = 0;
+      owns_model_ = false;
+      clear_results();
+  }
+
 void
 ZHfstOspeller::inject_speller(Speller * s)
   {
-      current_speller_ = s;
-      current_sugger_ = s;
+      release_model();
+      // the model is ours to delete once its other spellers are gone
+      model_ = s->model;
+      owns_model_ = s->owns_model;
+      s->owns_model = false;
+      model_->prefix_cache.configure(prefix_cache_length_,
+                                     prefix_cache_budget_);
+      idle_spellers_.push_back(s);
       can_spell_ = true;
       can_correct_ = true;
   }
@@ -180,14 +452,153 @@ ZHfstOspeller::set_time_cutoff(float time_cutoff)
       time_cutoff_ = time_cutoff;
   }
 
+void
+ZHfstOspeller::set_search_budget(unsigned long max_expanded,
+                                 size_t max_frontier)
+  {
+      max_expanded_ = max_expanded;
+      max_frontier_ = max_frontier;
+  }
+
+void
+ZHfstOspeller::set_best_first(bool best_first)
+  {
+      best_first_ = best_first;
+  }
+
+void
+ZHfstOspeller::set_prune_visited(bool prune_visited)
+  {
+      prune_visited_ = prune_visited;
+  }
+
+void
+ZHfstOspeller::set_search_threads(unsigned int threads,
+                                  unsigned long split_after)
+  {
+      if (threads == 0)
+        {
+          threads = std::thread::hardware_concurrency();
+        }
+      search_threads_ = (threads > 0) ? threads : 1;
+      split_after_ = split_after;
+  }
+
+void
+ZHfstOspeller::set_prefix_cache(size_t length, size_t memory_budget)
+  {
+      prefix_cache_length_ = length;
+      prefix_cache_budget_ = memory_budget;
+      if (model_ != 0)
+        {
+          model_->prefix_cache.configure(length, memory_budget);
+        }
+  }
+
+PrefixCache::Statistics
+ZHfstOspeller::get_prefix_cache_statistics()
+  {
+      if (model_ != 0)
+        {
+          return model_->prefix_cache.get_statistics();
+        }
+      return PrefixCache::Statistics();
+  }
+
+void
+ZHfstOspeller::warm_up_prefix_cache(unsigned int threads)
+  {
+      if (can_correct_ && (model_ != 0))
+        {
+          model_->warm_up_cache(threads);
+        }
+  }
+
+bool
+ZHfstOspeller::save_prefix_cache(const string& filename)
+  {
+      return (model_ != 0) && model_->save_cache(filename);
+  }
+
+bool
+ZHfstOspeller::load_prefix_cache(const string& filename)
+  {
+      return (model_ != 0) && model_->load_cache(filename);
+  }
+
+void
+ZHfstOspeller::set_result_cache(size_t entries)
+  {
+      spell_results_.set_capacity(entries);
+      suggest_results_.set_capacity(entries);
+      analyse_results_.set_capacity(entries);
+      analyse_symbols_results_.set_capacity(entries);
+  }
+
+ResultCacheStatistics
+ZHfstOspeller::get_result_cache_statistics()
+  {
+      ResultCacheStatistics statistics = spell_results_.get_statistics();
+      ResultCacheStatistics suggest = suggest_results_.get_statistics();
+      ResultCacheStatistics analyse = analyse_results_.get_statistics();
+      ResultCacheStatistics symbols =
+          analyse_symbols_results_.get_statistics();
+      statistics.entries += suggest.entries + analyse.entries +
+          symbols.entries;
+      statistics.hits += suggest.hits + analyse.hits + symbols.hits;
+      statistics.misses += suggest.misses + analyse.misses + symbols.misses;
+      return statistics;
+  }
+
+void
+ZHfstOspeller::clear_results()
+  {
+      spell_results_.clear();
+      suggest_results_.clear();
+      analyse_results_.clear();
+      analyse_symbols_results_.clear();
+  }
+
+string
+ZHfstOspeller::suggestion_key(const string& wordform) const
+  {
+      // the limits as they are in memory, and then the word form
+      string key;
+      key.append(reinterpret_cast<const char*>(&suggestions_maximum_),
+                 sizeof(suggestions_maximum_));
+      key.append(reinterpret_cast<const char*>(&maximum_weight_),
+                 sizeof(maximum_weight_));
+      key.append(reinterpret_cast<const char*>(&beam_), sizeof(beam_));
+      key.append(reinterpret_cast<const char*>(&time_cutoff_),
+                 sizeof(time_cutoff_));
+      key.push_back(best_first_ ? 'B' : 'D');
+      key.push_back(prune_visited_ ? 'P' : 'A');
+      key.append(wordform);
+      return key;
+  }
+
+void
+ZHfstOspeller::set_shared_cache(bool shared, const string& cache_dir)
+  {
+      shared_cache_ = shared;
+      shared_cache_dir_ = cache_dir;
+  }
+
 bool
 ZHfstOspeller::spell(const string& wordform)
   {
-    if (can_spell_ && (current_speller_ != 0))
+    if (can_spell_ && (model_ != 0))
       {
+        bool rv;
+        if (spell_results_.find(wordform, rv))
+          {
+            return rv;
+          }
         char* wf = strdup(wordform.c_str());
-        bool rv = current_speller_->check(wf);
+        SpellerLease speller(*this);
+        rv = speller->check(wf);
         free(wf);
+        spell_results_.insert(wordform, rv);
         return rv;
       }
     return false;
@@ -195,36 +606,140 @@ ZHfstOspeller::spell(const string& wordform)
 
 CorrectionQueue
 ZHfstOspeller::suggest(const string& wordform)
+  {
+    bool truncated;
+    return suggest(wordform, truncated);
+  }
+
+CorrectionQueue
+ZHfstOspeller::suggest(const string& wordform, bool& truncated)
   {
     CorrectionQueue rv;
-    if ((can_correct_) && (current_sugger_ != 0))
+    truncated = false;
+    if ((can_correct_) && (model_ != 0))
       {
+        string key = suggestion_key(wordform);
+        if (suggest_results_.find(key, rv))
+          {
+            return rv;
+          }
         char* wf = strdup(wordform.c_str());
-        rv = current_sugger_->correct(wf,
-                                      suggestions_maximum_,
-                                      maximum_weight_,
-                                      beam_,
-                                      time_cutoff_);
+        SpellerLease sugger(*this);
+        sugger->search = best_first_ ? Speller::BestFirst :
+                                       Speller::DepthFirst;
+        sugger->prune_visited = prune_visited_;
+        sugger->max_expanded = max_expanded_;
+        sugger->max_frontier = max_frontier_;
+        sugger->threads = search_threads_;
+        sugger->split_after = split_after_;
+        rv = sugger->correct(wf,
+                             suggestions_maximum_,
+                             maximum_weight_,
+                             beam_,
+                             time_cutoff_);
         free(wf);
+        truncated = sugger->limit_reached;
+        // what a budget left out might be found the next time, and the
+        // complete ones don't depend on the budgets
+        if (!truncated)
+          {
+            suggest_results_.insert(key, rv);
+          }
         return rv;
       }
     return rv;
   }
 
+std::vector<CorrectionQueue>
+ZHfstOspeller::suggest_batch(const std::vector<string>& wordforms)
+  {
+    std::vector<bool> truncated;
+    return suggest_batch(wordforms, truncated);
+  }
+
+std::vector<CorrectionQueue>
+ZHfstOspeller::suggest_batch(const std::vector<string>& wordforms,
+                             std::vector<bool>& truncated)
+  {
+    std::vector<CorrectionQueue> rv(wordforms.size());
+    truncated.assign(wordforms.size(), false);
+    if ((can_correct_) && (model_ != 0))
+      {
+        // only the ones not found in the cache are searched
+        std::vector<string> keys;
+        std::vector<string> searched;
+        std::vector<size_t> positions;
+        for (size_t i = 0; i < wordforms.size(); ++i)
+          {
+            keys.push_back(suggestion_key(wordforms[i]));
+            if (!suggest_results_.find(keys[i], rv[i]))
+              {
+                searched.push_back(wordforms[i]);
+                positions.push_back(i);
+              }
+          }
+        if (searched.empty())
+          {
+            return rv;
+          }
+        SpellerLease sugger(*this);
+        sugger->search = best_first_ ? Speller::BestFirst :
+                                       Speller::DepthFirst;
+        sugger->prune_visited = prune_visited_;
+        sugger->max_expanded = max_expanded_;
+        sugger->max_frontier = max_frontier_;
+        sugger->threads = search_threads_;
+        sugger->split_after = split_after_;
+        std::vector<bool> searched_truncated;
+        std::vector<CorrectionQueue> corrections =
+            sugger->correct_batch(searched,
+                                  suggestions_maximum_,
+                                  maximum_weight_,
+                                  beam_,
+                                  time_cutoff_,
+                                  &searched_truncated);
+        for (size_t j = 0; j < positions.size(); ++j)
+          {
+            size_t i = positions[j];
+            rv[i] = corrections[j];
+            truncated[i] = searched_truncated[j];
+            if (!truncated[i])
+              {
+                suggest_results_.insert(keys[i], rv[i]);
+              }
+          }
+      }
+    return rv;
+  }
+
+CheckSession*
+ZHfstOspeller::start_session()
+  {
+    if (can_spell_ && (model_ != 0))
+      {
+        return new CheckSession(model_);
+      }
+    return 0;
+  }
+
 AnalysisQueue
 ZHfstOspeller::analyse(const string& wordform, bool ask_sugger)
   {
     AnalysisQueue rv;
-    char* wf = strdup(wordform.c_str());
-    if ((can_analyse_) && (!ask_sugger) && (current_speller_ != 0))
+    // the speller and the correction model are the same automata
+    (void)ask_sugger;
+    if ((can_analyse_) && (model_ != 0))
       {
-          rv = current_speller_->analyse(wf);
-      }
-    else if ((can_analyse_) && (ask_sugger) && (current_sugger_ != 0))
-      {
-          rv = current_sugger_->analyse(wf);
+          if (analyse_results_.find(wordform, rv))
+            {
+              return rv;
+            }
+          char* wf = strdup(wordform.c_str());
+          SpellerLease analyser(*this);
+          rv = analyser->analyse(wf);
+          free(wf);
+          analyse_results_.insert(wordform, rv);
       }
-    free(wf);
     return rv;
   }
 
@@ -232,16 +747,20 @@ AnalysisSymbolsQueue
 ZHfstOspeller::analyseSymbols(const string& wordform, bool ask_sugger)
   {
     AnalysisSymbolsQueue rv;
-    char* wf = strdup(wordform.c_str());
-    if ((can_analyse_) && (!ask_sugger) && (current_speller_ != 0))
+    // the speller and the correction model are the same automata
+    (void)ask_sugger;
+    if ((can_analyse_) && (model_ != 0))
       {
-          rv = current_speller_->analyseSymbols(wf);
-      }
-    else if ((can_analyse_) && (ask_sugger) && (current_sugger_ != 0))
-      {
-          rv = current_sugger_->analyseSymbols(wf);
+          if (analyse_symbols_results_.find(wordform, rv))
+            {
+              return rv;
+            }
+          char* wf = strdup(wordform.c_str());
+          SpellerLease analyser(*this);
+          rv = analyser->analyseSymbols(wf);
+          free(wf);
+          analyse_symbols_results_.insert(wordform, rv);
       }
-    free(wf);
     return rv;
   }
 
@@ -285,6 +804,51 @@ ZHfstOspeller::read_zhfst(const string& filename)
       {
         throw ZHfstZipReadingError("Archive not OK");
       }
+    // cache files are named after the archive, the size, device, inode and
+    // mtime of it and the entry, e.g.
+    // se.zhfst.2097152-2049-131090-1500000000-123456789.acceptor.default.hfst,
+    // and in a cache directory also after a hash of the full path of the
+    // archive, which tells apart archives with the same name
+    struct stat archive_st;
+    string cache_prefix;
+    string cache_stamp;
+    bool use_cache = shared_cache_ && (stat(filename.c_str(), &archive_st) == 0);
+    if (use_cache && shared_cache_dir_.empty())
+      {
+        cache_prefix = filename + ".";
+      }
+    else if (use_cache)
+      {
+        char* canonical = realpath(filename.c_str(), NULL);
+        if (canonical != NULL)
+          {
+            string::size_type slash = filename.rfind('/');
+            char hash[17];
+            snprintf(hash, sizeof(hash), "%016llx",
+                     static_cast<unsigned long long>(name_hash(canonical)));
+            cache_prefix = shared_cache_dir_ + "/" +
+                (slash == string::npos ? filename : filename.substr(slash + 1)) +
+                "." + hash + ".";
+            free(canonical);
+          }
+        else
+          {
+            use_cache = false;
+          }
+      }
+    if (use_cache)
+      {
+        // the inode and the mtime to the nanosecond tell apart an archive
+        // replaced within the same second with one of the same size
+        char stamp[128];
+        snprintf(stamp, sizeof(stamp), "%llu-%llu-%llu-%lld-%ld.",
+                 static_cast<unsigned long long>(archive_st.st_size),
+                 static_cast<unsigned long long>(archive_st.st_dev),
+                 static_cast<unsigned long long>(archive_st.st_ino),
+                 static_cast<long long>(archive_st.st_mtim.tv_sec),
+                 static_cast<long>(archive_st.st_mtim.tv_nsec));
+        cache_stamp = stamp;
+      }
     for (int rr = archive_read_next_header(ar, &entry);
          rr != ARCHIVE_EOF;
          rr = archive_read_next_header(ar, &entry))
@@ -296,28 +860,13 @@ ZHfstOspeller::read_zhfst(const string& filename)
         char* filename = strdup(archive_entry_pathname(entry));
         if (strncmp(filename, "acceptor.", strlen("acceptor.")) == 0) {
             Transducer* trans = nullptr;
-
-#if ZHFST_EXTRACT_TO_MEM == 1
-            // Try to memory first...
-            try {
-                trans = transducer_to_mem(ar, entry);
-            }
-            catch (...) {
-                // If that failed, try to /tmp
-                //std::cerr << "Failed to memory - falling back to /tmp" << std::endl;
-                trans = transducer_to_tmp_dir(ar);
+            if (use_cache) {
+                trans = transducer_to_shared_cache(ar, entry, cache_prefix,
+                                                   cache_stamp);
             }
-#else
-            // Try to /tmp first...
-            try {
-                trans = transducer_to_tmp_dir(ar);
-            }
-            catch (...) {
-                // If that failed, try to memory
-                //std::cerr << "Failed to /tmp - falling back to memory" << std::endl;
-                trans = transducer_to_mem(ar, entry);
+            if (trans == nullptr) {
+                trans = transducer_from_archive(ar, entry);
             }
-#endif
             if (trans == nullptr) {
                 throw ZHfstZipReadingError("Failed to extract acceptor");
             }
@@ -343,28 +892,13 @@ ZHfstOspeller::read_zhfst(const string& filename)
           }
         else if (strncmp(filename, "errmodel.", strlen("errmodel.")) == 0) {
             Transducer* trans = nullptr;
-
-#if ZHFST_EXTRACT_TO_MEM == 1
-            // Try to memory first...
-            try {
-                trans = transducer_to_mem(ar, entry);
-            }
-            catch (...) {
-                // If that failed, try to /tmp
-                //std::cerr << "Failed to memory - falling back to /tmp" << std::endl;
-                trans = transducer_to_tmp_dir(ar);
+            if (use_cache) {
+                trans = transducer_to_shared_cache(ar, entry, cache_prefix,
+                                                   cache_stamp);
             }
-#else
-            // Try to /tmp first...
-            try {
-                trans = transducer_to_tmp_dir(ar);
-            }
-            catch (...) {
-                // If that failed, try to memory
-                //std::cerr << "Failed to /tmp - falling back to memory" << std::endl;
-                trans = transducer_to_mem(ar, entry);
+            if (trans == nullptr) {
+                trans = transducer_from_archive(ar, entry);
             }
-#endif
             if (trans == nullptr) {
                 throw ZHfstZipReadingError("Failed to extract error model");
             }
@@ -413,14 +947,18 @@ ZHfstOspeller::read_zhfst(const string& filename)
     archive_read_free(ar);
 #endif // USE_LIBARCHIVE_2
 
+    if (acceptors_.empty())
+      {
+        throw ZHfstZipReadingError("No automata found in zip");
+      }
+    // the automata read before may be kept, but not what was made of them
+    release_model();
     if ((errmodels_.find("default") != errmodels_.end()) &&
         (acceptors_.find("default") != acceptors_.end()))
       {
-        current_speller_ = new Speller(
-                                       errmodels_["default"],
-                                       acceptors_["default"]
-                                       );
-        current_sugger_ = current_speller_;
+        model_ = new SpellerModel(errmodels_["default"],
+                                  acceptors_["default"]);
+        owns_model_ = true;
         can_spell_ = true;
         can_correct_ = true;
       }
@@ -429,33 +967,29 @@ ZHfstOspeller::read_zhfst(const string& filename)
         fprintf(stderr, "Could not find default speller, using %s %s\n",
                 acceptors_.begin()->first.c_str(),
                 errmodels_.begin()->first.c_str());
-        current_speller_ = new Speller(
-                                       errmodels_.begin()->second,
-                                       acceptors_.begin()->second
-                                       );
-        current_sugger_ = current_speller_;
+        model_ = new SpellerModel(errmodels_.begin()->second,
+                                  acceptors_.begin()->second);
+        owns_model_ = true;
         can_spell_ = true;
         can_correct_ = true;
       }
     else if ((acceptors_.size() > 0) &&
              (acceptors_.find("default") != acceptors_.end()))
       {
-        current_speller_ = new Speller(0, acceptors_["default"]);
-        current_sugger_ = current_speller_;
+        model_ = new SpellerModel(0, acceptors_["default"]);
+        owns_model_ = true;
         can_spell_ = true;
         can_correct_ = false;
       }
-    else if (acceptors_.size() > 0)
+    else
       {
-        current_speller_ = new Speller(0, acceptors_.begin()->second);
-        current_sugger_ = current_speller_;
+        model_ = new SpellerModel(0, acceptors_.begin()->second);
+        owns_model_ = true;
         can_spell_ = true;
         can_correct_ = false;
       }
-    else
-      {
-        throw ZHfstZipReadingError("No automata found in zip");
-      }
+    model_->prefix_cache.configure(prefix_cache_length_,
+                                   prefix_cache_budget_);
     can_analyse_ = can_spell_ | can_correct_;
 #else
     throw ZHfstZipReadingError("Zip support was disabled");
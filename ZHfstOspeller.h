@@ -35,7 +35,12 @@
 #endif
 
 #include <stdexcept>
+#include <functional>
+#include <list>
 #include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "ospell.h"
 #include "hfst-ol.h"
@@ -43,10 +48,138 @@
 
 namespace hfst_ol
   {
+    //! @brief how a ResultCache is doing
+    struct ResultCacheStatistics
+      {
+        size_t entries; //!< results kept
+        unsigned long hits; //!< results found
+        unsigned long misses; //!< results not found
+      };
+
+    //! @brief Bounded cache of query results by key, for ZHfstOspeller.
+    //!
+    //! The entries are spread over shards by the hash of their key, each
+    //! with a lock of its own, so that calls from many threads seldom wait
+    //! for each other. A full shard drops its least recently used entry.
+    template <class Value>
+    class ResultCache
+      {
+        public:
+            ResultCache() : shard_capacity_(0) {}
+            //! @brief keep at most about @a entries results, or none for 0
+            void set_capacity(size_t entries)
+              {
+                shard_capacity_ = (entries + SHARD_COUNT - 1) / SHARD_COUNT;
+                for (auto& shard : shards_)
+                  {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    trim(shard);
+                  }
+              }
+            //! @brief get the result for @a key into @a value, and tell
+            //!        whether there is one
+            bool find(const std::string& key, Value& value)
+              {
+                if (shard_capacity_ == 0)
+                  {
+                    return false;
+                  }
+                Shard& shard = shard_for(key);
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                auto found = shard.positions.find(key);
+                if (found == shard.positions.end())
+                  {
+                    ++shard.misses;
+                    return false;
+                  }
+                ++shard.hits;
+                shard.entries.splice(shard.entries.begin(), shard.entries,
+                                     found->second);
+                value = found->second->second;
+                return true;
+              }
+            //! @brief keep @a value as the result for @a key
+            void insert(const std::string& key, const Value& value)
+              {
+                if (shard_capacity_ == 0)
+                  {
+                    return;
+                  }
+                Shard& shard = shard_for(key);
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                if (shard.positions.count(key) != 0)
+                  {
+                    // another call got there first, with the same result
+                    return;
+                  }
+                shard.entries.push_front(Entry(key, value));
+                shard.positions[key] = shard.entries.begin();
+                trim(shard);
+              }
+            //! @brief drop all results
+            void clear()
+              {
+                for (auto& shard : shards_)
+                  {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    shard.entries.clear();
+                    shard.positions.clear();
+                  }
+              }
+            //! @brief how the cache is doing
+            ResultCacheStatistics get_statistics()
+              {
+                ResultCacheStatistics statistics = {0, 0, 0};
+                for (auto& shard : shards_)
+                  {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    statistics.entries += shard.entries.size();
+                    statistics.hits += shard.hits;
+                    statistics.misses += shard.misses;
+                  }
+                return statistics;
+              }
+        private:
+            typedef std::pair<std::string, Value> Entry;
+            struct Shard
+              {
+                Shard() : hits(0), misses(0) {}
+                std::mutex mutex;
+                //! @brief most recently used first
+                std::list<Entry> entries;
+                std::unordered_map<std::string,
+                                   typename std::list<Entry>::iterator>
+                    positions;
+                unsigned long hits;
+                unsigned long misses;
+              };
+            static const size_t SHARD_COUNT = 16;
+            Shard& shard_for(const std::string& key)
+              {
+                return shards_[std::hash<std::string>()(key) % SHARD_COUNT];
+              }
+            void trim(Shard& shard)
+              {
+                while (shard.entries.size() > shard_capacity_)
+                  {
+                    shard.positions.erase(shard.entries.back().first);
+                    shard.entries.pop_back();
+                  }
+              }
+            //! @brief entries each shard keeps at most
+            size_t shard_capacity_;
+            Shard shards_[SHARD_COUNT];
+      };
+
     //! @brief ZHfstOspeller class holds one speller contained in one
     //!        zhfst file.
     //!        Ospeller can perform all basic writer tool functionality that
     //!        is supporte by the automata in the zhfst archive.
+    //!
+    //! The automata are loaded once, and spell(), suggest() and the
+    //! analyses can be called from many threads at the same time, each
+    //! call searching with a Speller of its own. The settings must not be
+    //! changed while calls are going on.
     class ZHfstOspeller
       {
         public:
@@ -57,6 +190,10 @@ namespace hfst_ol
             OSPELL_API ~ZHfstOspeller();
 
             //! @brief assign a speller-suggestor circumventing the ZHFST format
+            //!
+            //! The ospeller takes @a s over, and also its model if @a s owns
+            //! it. The spellers and the model of the speller given before,
+            //! if any, are deleted, so no call may be using them.
             OSPELL_API void inject_speller(Speller * s);
             //! @brief set upper limit to priority queue when performing
             //         suggestions or analyses.
@@ -67,6 +204,61 @@ namespace hfst_ol
             OSPELL_API void set_beam(Weight beam);
             //! @brief set time cutoff for correcting
             OSPELL_API void set_time_cutoff(float time_cutoff);
+            //! @brief stop correcting after taking @a max_expanded search
+            //!        nodes or having more than @a max_frontier of them
+            //!        waiting, where 0 is no limit for either
+            OSPELL_API void set_search_budget(unsigned long max_expanded,
+                                              size_t max_frontier = 0);
+            //! @brief search the best corrections first and stop as soon
+            //!        as the limits rule out the rest
+            OSPELL_API void set_best_first(bool best_first);
+            //! @brief skip search states already reached with less
+            //!        weight, which keeps only the cheapest of the
+            //!        corrections completed the same way
+            OSPELL_API void set_prune_visited(bool prune_visited);
+            //! @brief share the search of a correction with @a threads - 1
+            //!        more threads once it has taken @a split_after search
+            //!        nodes, 1 for none and 0 for one per processor
+            OSPELL_API void set_search_threads(unsigned int threads,
+                                               unsigned long split_after =
+                                               1024);
+            //! @brief keep the search states after the first @a length
+            //!        input symbols, at most @a memory_budget bytes of them
+            //!        or any amount for 0, for reuse by later corrections
+            OSPELL_API void set_prefix_cache(size_t length,
+                                             size_t memory_budget = 0);
+            //! @brief get the size and use of the prefix cache so far
+            OSPELL_API PrefixCache::Statistics get_prefix_cache_statistics();
+            //! @brief build the prefix cache for every symbol an input can
+            //!        start with now, so that the first corrections aren't
+            //!        slow, in @a threads threads, or one per processor for 0
+            OSPELL_API void warm_up_prefix_cache(unsigned int threads = 0);
+            //! @brief write the prefix cache to the file @a filename, and
+            //!        tell whether it could be written
+            OSPELL_API bool save_prefix_cache(const std::string& filename);
+            //! @brief add the prefix cache saved in the file @a filename,
+            //!        and tell whether it was saved for the same automata
+            //!        and could be read
+            OSPELL_API bool load_prefix_cache(const std::string& filename);
+            //! @brief remember the results of about @a entries calls of
+            //!        each of spell(), suggest(), analyse() and
+            //!        analyseSymbols(), or none for 0, which is the
+            //!        default. Suggestions are remembered with the limits
+            //!        they were made with, unless the time cutoff or the
+            //!        search budget stopped them.
+            OSPELL_API void set_result_cache(size_t entries);
+            //! @brief get the size and use of the result caches so far
+            OSPELL_API ResultCacheStatistics get_result_cache_statistics();
+            //! @brief load automata through cache files mapped read-only,
+            //!        so that processes using the same speller share one
+            //!        copy of it in memory. The cache files are named
+            //!        after the path, size, inode and mtime of the archive,
+            //!        and ones left from earlier versions of it are removed.
+            //! @param shared     whether read_zhfst should use cache files
+            //! @param cache_dir  directory for the cache files, or empty to
+            //!                   put them next to the zhfst archive
+            OSPELL_API void set_shared_cache(bool shared,
+                                             const std::string& cache_dir = "");
             //! @brief construct speller from named file containing valid
             //!        zhfst archive.
             OSPELL_API void read_zhfst(const std::string& filename);
@@ -76,6 +268,31 @@ namespace hfst_ol
             //! @brief construct an ordered set of corrections for misspelled
             //!        word form.
             OSPELL_API CorrectionQueue suggest(const std::string& wordform);
+            //! @brief construct an ordered set of corrections for misspelled
+            //!        word form, and set @a truncated to whether the time
+            //!        cutoff or the search budget stopped the search, so
+            //!        that better ones may have been left out
+            OSPELL_API CorrectionQueue suggest(const std::string& wordform,
+                                               bool& truncated);
+            //! @brief construct an ordered set of corrections for each of
+            //!        @a wordforms, searching the prefixes they have in
+            //!        common once
+            OSPELL_API std::vector<CorrectionQueue> suggest_batch(
+                const std::vector<std::string>& wordforms);
+            //! @brief construct an ordered set of corrections for each of
+            //!        @a wordforms, and set @a truncated to whether the
+            //!        time cutoff or the search budget stopped the search
+            //!        for each one
+            OSPELL_API std::vector<CorrectionQueue> suggest_batch(
+                const std::vector<std::string>& wordforms,
+                std::vector<bool>& truncated);
+            //! @brief start checking a word form as it is typed
+            //!
+            //! The caller owns the session, or gets 0 if nothing loaded
+            //! can check spelling. The session reads the automata loaded
+            //! now, so it must be deleted before read_zhfst() or
+            //! inject_speller() replaces them, or the ospeller is deleted.
+            OSPELL_API CheckSession* start_session();
             //! @brief analyse word form morphologically
             //! @param wordform   the string to analyse
             //! @param ask_sugger whether to use the spelling correction model
@@ -112,6 +329,23 @@ namespace hfst_ol
             Weight beam_;
             //! @brief upper bound for search time in seconds
             float time_cutoff_;
+            //! @brief upper bound for search nodes expanded, 0 for none
+            unsigned long max_expanded_;
+            //! @brief upper bound for search nodes waiting, 0 for none
+            size_t max_frontier_;
+            //! @brief whether corrections are searched best first
+            bool best_first_;
+            //! @brief whether searches skip states reached before for less
+            bool prune_visited_;
+            //! @brief number of threads sharing a long correction search
+            unsigned int search_threads_;
+            //! @brief search nodes taken before a search is shared
+            unsigned long split_after_;
+            //! @brief longest input prefix whose search states are kept
+            size_t prefix_cache_length_;
+            //! @brief upper bound for memory of prefix cache in bytes, 0 for
+            //!        none
+            size_t prefix_cache_budget_;
             //! @brief whether automatons loaded yet can be used to check
             //!        spelling
             bool can_spell_;
@@ -124,20 +358,53 @@ namespace hfst_ol
             //! @brief whether automatons loaded yet can be used to hyphenate
             //!        word forms
             bool can_hyphenate_;
+            //! @brief whether automata are loaded through shared cache files
+            bool shared_cache_;
+            //! @brief where the shared cache files go, empty for beside
+            //!        the archive
+            std::string shared_cache_dir_;
             //! @brief dictionaries loaded
             std::map<std::string, Transducer*> acceptors_;
             //! @brief error models loaded
             std::map<std::string, Transducer*> errmodels_;
-            //! @brief pointer to current speller
-            Speller* current_speller_;
-            //! @brief pointer to current correction model
-            Speller* current_sugger_;
+            //! @brief automata of current speller and correction model
+            SpellerModel* model_;
+            //! @brief whether model_ is deleted with the ospeller
+            bool owns_model_;
+            //! @brief spellers for model_ that no call is using
+            std::vector<Speller*> idle_spellers_;
+            //! @brief guards idle_spellers_
+            std::mutex idle_spellers_mutex_;
+            //! @brief results of spell() by word form
+            ResultCache<bool> spell_results_;
+            //! @brief results of suggest() by limits and word form
+            ResultCache<CorrectionQueue> suggest_results_;
+            //! @brief results of analyse() by word form
+            ResultCache<AnalysisQueue> analyse_results_;
+            //! @brief results of analyseSymbols() by word form
+            ResultCache<AnalysisSymbolsQueue> analyse_symbols_results_;
             //! @brief pointer to current morphological analyser
             Speller* current_analyser_;
             //! @brief pointer to current hyphenator
             Transducer* current_hyphenator_;
             //! @brief the metadata of loaded speller
             ZHfstOspellerXmlMetadata metadata_;
+
+            //! @brief lends an idle speller to a call, or a new one if
+            //!        every one is in use
+            class SpellerLease;
+            //! @brief take an idle speller, or make one
+            Speller* acquire_speller();
+            //! @brief give back a speller taken by acquire_speller()
+            void release_speller(Speller* speller);
+            //! @brief delete the idle spellers and model_ if owned, and
+            //!        forget the results of it, before model_ is replaced
+            void release_model();
+            //! @brief forget the results of the automata before
+            void clear_results();
+            //! @brief key of the suggestions for @a wordform with the
+            //!        current limits
+            std::string suggestion_key(const std::string& wordform) const;
       };
 
     //! @brief Top-level exception for zhfst handling.
@@ -0,0 +1,358 @@
+/*
+
+  Copyright 2016 University of Helsinki
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+*/
+
+/*
+  Converts optimized-lookup automata, on their own or inside a zhfst
+  archive, to the native format that can be mapped and used in place.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+#if HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+#if HAVE_LIBARCHIVE
+#  include <archive.h>
+#  include <archive_entry.h>
+#endif
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <stdio.h>
+
+#include "ol-exceptions.h"
+#include "hfst-ol.h"
+
+static bool verbose = false;
+
+bool print_usage(void)
+{
+    std::cout <<
+    "\n" <<
+    "Usage: hfst-ospell-convert [OPTIONS] INPUT OUTPUT\n" <<
+    "Convert the automaton or zhfst archive INPUT to the native format\n"
+    "\n" <<
+    "  -h, --help                Print this help message\n" <<
+    "  -V, --version             Print version information\n" <<
+    "  -v, --verbose             Be verbose\n" <<
+    "\n" <<
+    "\n" <<
+    "Report bugs to " << PACKAGE_BUGREPORT << "\n" <<
+    "\n";
+    return true;
+}
+
+bool print_version(void)
+{
+    std::cout <<
+    "\n" <<
+    PACKAGE_STRING << std::endl <<
+    "copyright (C) 2009 - 2016 University of Helsinki\n";
+    return true;
+}
+
+bool print_short_help(void)
+{
+    print_usage();
+    return true;
+}
+
+static int
+convert_hfstol(const char * input, const char * output)
+  {
+    hfst_ol::MappedFile data(input);
+    FILE * f = fopen(output, "wb");
+    if (f == NULL)
+      {
+        perror(output);
+        return EXIT_FAILURE;
+      }
+    try
+      {
+        hfst_ol::write_native_transducer(data.get_data(),
+                                         data.get_data() + data.get_size(),
+                                         f);
+      }
+    catch (...)
+      {
+        // a truncated or broken input leaves no output behind
+        fclose(f);
+        remove(output);
+        throw;
+      }
+    if (fclose(f) != 0)
+      {
+        perror(output);
+        return EXIT_FAILURE;
+      }
+    return EXIT_SUCCESS;
+  }
+
+#if HAVE_LIBARCHIVE
+// write the native form of the automaton at @a raw, which ends by @a end,
+// into @a native
+static void
+convert_to_string(char * raw, const char * end, std::string & native)
+  {
+    FILE * f = tmpfile();
+    if (f == NULL)
+      {
+        HFST_THROW_MESSAGE(hfst_ol::TransducerWritingException,
+                           "cannot create temporary file\n");
+      }
+    try
+      {
+        hfst_ol::write_native_transducer(raw, end, f);
+      }
+    catch (...)
+      {
+        fclose(f);
+        throw;
+      }
+    native.resize(ftell(f));
+    rewind(f);
+    if (native.size() > 0 &&
+        fread(&native[0], native.size(), 1, f) != 1)
+      {
+        fclose(f);
+        HFST_THROW_MESSAGE(hfst_ol::TransducerWritingException,
+                           "cannot read back temporary file\n");
+      }
+    fclose(f);
+  }
+
+static int
+convert_zhfst(const char * input, const char * output)
+  {
+    struct archive* in = archive_read_new();
+    struct archive* out = archive_write_new();
+    struct archive_entry* entry = 0;
+#if USE_LIBARCHIVE_2
+    archive_read_support_compression_all(in);
+#else
+    archive_read_support_filter_all(in);
+#endif // USE_LIBARCHIVE_2
+    archive_read_support_format_all(in);
+    archive_write_set_format_zip(out);
+    if (archive_read_open_filename(in, input, 10240) != ARCHIVE_OK)
+      {
+        fprintf(stderr, "cannot read archive %s: %s\n", input,
+                archive_error_string(in));
+        return EXIT_FAILURE;
+      }
+    if (archive_write_open_filename(out, output) != ARCHIVE_OK)
+      {
+        fprintf(stderr, "cannot write archive %s: %s\n", output,
+                archive_error_string(out));
+        return EXIT_FAILURE;
+      }
+    int rv = EXIT_SUCCESS;
+    for (int rr = archive_read_next_header(in, &entry);
+         rr != ARCHIVE_EOF;
+         rr = archive_read_next_header(in, &entry))
+      {
+        if (rr != ARCHIVE_OK)
+          {
+            fprintf(stderr, "cannot read archive %s: %s\n", input,
+                    archive_error_string(in));
+            rv = EXIT_FAILURE;
+            break;
+          }
+        std::string name = archive_entry_pathname(entry);
+        hfst_ol::MappedFile data(archive_entry_size(entry));
+        size_t full_length = 0;
+        while (full_length < data.get_size())
+          {
+            ssize_t curr = archive_read_data(in, data.get_data() + full_length,
+                                             data.get_size() - full_length);
+            if (curr == ARCHIVE_RETRY)
+              {
+                continue;
+              }
+            else if (curr <= 0)
+              {
+                break;
+              }
+            full_length += curr;
+          }
+        if (full_length != data.get_size())
+          {
+            fprintf(stderr, "cannot read %s from archive %s\n",
+                    name.c_str(), input);
+            rv = EXIT_FAILURE;
+            break;
+          }
+        std::string contents;
+        if ((name.compare(0, strlen("acceptor."), "acceptor.") == 0) ||
+            (name.compare(0, strlen("errmodel."), "errmodel.") == 0))
+          {
+            if (verbose)
+              {
+                fprintf(stderr, "converting %s\n", name.c_str());
+              }
+            try
+              {
+                convert_to_string(data.get_data(),
+                                  data.get_data() + data.get_size(),
+                                  contents);
+              }
+            catch (const hfst_ol::OspellException & e)
+              {
+                fprintf(stderr, "cannot convert %s from archive %s: %s\n",
+                        name.c_str(), input, e.name.c_str());
+                rv = EXIT_FAILURE;
+                break;
+              }
+          }
+        else
+          {
+            contents.assign(data.get_data(), data.get_size());
+          }
+        struct archive_entry* converted = archive_entry_new();
+        archive_entry_set_pathname(converted, name.c_str());
+        archive_entry_set_size(converted, contents.size());
+        archive_entry_set_filetype(converted, AE_IFREG);
+        archive_entry_set_perm(converted, 0644);
+        if ((archive_write_header(out, converted) != ARCHIVE_OK) ||
+            (archive_write_data(out, contents.data(), contents.size()) !=
+             static_cast<ssize_t>(contents.size())))
+          {
+            fprintf(stderr, "cannot write %s to archive %s: %s\n",
+                    name.c_str(), output, archive_error_string(out));
+            rv = EXIT_FAILURE;
+          }
+        archive_entry_free(converted);
+        if (rv != EXIT_SUCCESS)
+          {
+            break;
+          }
+      }
+    archive_read_close(in);
+    if (archive_write_close(out) != ARCHIVE_OK)
+      {
+        fprintf(stderr, "cannot write archive %s: %s\n", output,
+                archive_error_string(out));
+        rv = EXIT_FAILURE;
+      }
+#if USE_LIBARCHIVE_2
+    archive_read_finish(in);
+    archive_write_finish(out);
+#else
+    archive_read_free(in);
+    archive_write_free(out);
+#endif // USE_LIBARCHIVE_2
+    if (rv != EXIT_SUCCESS)
+      {
+        remove(output);
+      }
+    return rv;
+  }
+#endif // HAVE_LIBARCHIVE
+
+// zip archives, and so zhfst files, start with a local file header
+static bool
+is_zip(const char * filename)
+  {
+    char magic[4] = {0};
+    FILE * f = fopen(filename, "rb");
+    if (f == NULL)
+      {
+        return false;
+      }
+    bool rv = (fread(magic, sizeof(magic), 1, f) == 1) &&
+        (memcmp(magic, "PK\003\004", sizeof(magic)) == 0);
+    fclose(f);
+    return rv;
+  }
+
+int main(int argc, char **argv)
+{
+    int c;
+#if HAVE_GETOPT_H
+    while (true) {
+        static struct option long_options[] =
+            {
+            // first the hfst-mandated options
+            {"help",         no_argument,       0, 'h'},
+            {"version",      no_argument,       0, 'V'},
+            {"verbose",      no_argument,       0, 'v'},
+            {0,              0,                 0,  0 }
+            };
+
+        int option_index = 0;
+        c = getopt_long(argc, argv, "hVv", long_options, &option_index);
+
+        if (c == -1) // no more options to look at
+            break;
+
+        switch (c) {
+        case 'h':
+            print_usage();
+            return EXIT_SUCCESS;
+            break;
+
+        case 'V':
+            print_version();
+            return EXIT_SUCCESS;
+            break;
+
+        case 'v':
+            verbose = true;
+            break;
+
+        default:
+            std::cerr << "Invalid option\n\n";
+            print_short_help();
+            return EXIT_FAILURE;
+            break;
+        }
+    }
+#else
+    int optind = 1;
+#endif
+    if (argc - optind != 2)
+      {
+        std::cerr << "Give an INPUT and an OUTPUT file\n";
+        print_short_help();
+        return EXIT_FAILURE;
+      }
+    const char * input = argv[optind];
+    const char * output = argv[optind + 1];
+    try
+      {
+        if (is_zip(input))
+          {
+#if HAVE_LIBARCHIVE
+            return convert_zhfst(input, output);
+#else
+            std::cerr << "Zip support was disabled, cannot convert "
+                      << input << std::endl;
+            return EXIT_FAILURE;
+#endif
+          }
+        return convert_hfstol(input, output);
+      }
+    catch (const hfst_ol::OspellException & e)
+      {
+        std::cerr << "cannot convert " << input << ": " << e.name
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+}
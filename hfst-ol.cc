@@ -14,9 +14,17 @@
 
 #include "hfst-ol.h"
 #include <string>
+#include <algorithm>
+#include <cstdint>
 #if HAVE_CONFIG_H
 #  include <config.h>
 #endif
+#if HAVE_SYS_MMAN_H && HAVE_MMAP
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
 
 namespace hfst_ol {
 
@@ -28,6 +36,43 @@ inline T hfst_deref(T* ptr)
     return dest;
 }
 
+template <typename T>
+inline T swap_bytes(T value)
+{
+    char * bytes = reinterpret_cast<char *>(&value);
+    std::reverse(bytes, bytes + sizeof(T));
+    return value;
+}
+
+template <typename T>
+inline T native_value(char * raw, bool swapped)
+{
+    T value = hfst_deref((T *) raw);
+    return swapped ? swap_bytes(value) : value;
+}
+
+template <typename T>
+inline void put_native_value(char * raw, T value)
+{
+    memcpy(raw, &value, sizeof(value));
+}
+
+// zeros needed after @a bytes bytes to reach the next section
+inline size_t native_padding(size_t bytes)
+{
+    return (NATIVE_ALIGNMENT - bytes % NATIVE_ALIGNMENT) % NATIVE_ALIGNMENT;
+}
+
+// Native tables are stored as one array per column, each followed by
+// padding up to the next section
+template <typename T>
+void write_native_array(FILE * f, const T * src, size_t count)
+{
+    static const char zeros[NATIVE_ALIGNMENT] = {0};
+    fwrite(src, sizeof(T), count, f);
+    fwrite(zeros, 1, native_padding(count * sizeof(T)), f);
+}
+
 void skip_c_string(char ** raw)
 {
     while (**raw != 0) {
@@ -36,6 +81,113 @@ void skip_c_string(char ** raw)
     ++(*raw);
 }
 
+// throw with @a message unless there are @a bytes of header at @a raw
+// before @a end, which is NULL if the data is trusted to be long enough
+static void need_header_bytes(const char * raw, const char * end,
+                              size_t bytes, const char * message)
+{
+    if (end != NULL && (raw > end || static_cast<size_t>(end - raw) < bytes)) {
+        HFST_THROW_MESSAGE(HeaderParsingException, message);
+    }
+}
+
+uint64_t hash_bytes(uint64_t hash, const void * bytes, size_t size)
+{
+    const unsigned char * p = static_cast<const unsigned char *>(bytes);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ p[i]) * 1099511628211u;
+    }
+    return hash;
+}
+
+MappedFile::MappedFile(const std::string & filename):
+    data(NULL),
+    size(0),
+    mapped(false)
+{
+#if HAVE_SYS_MMAN_H && HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        HFST_THROW_MESSAGE(FileMappingException,
+                           "cannot open " + filename + "\n");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        HFST_THROW_MESSAGE(FileMappingException,
+                           "cannot stat " + filename + "\n");
+    }
+    size = static_cast<size_t>(st.st_size);
+    // a shared read-only mapping is backed by the page cache, so every
+    // process mapping the same file uses the same physical pages
+    void * m = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays valid without the descriptor
+    if (m == MAP_FAILED) {
+        HFST_THROW_MESSAGE(FileMappingException,
+                           "cannot map " + filename + "\n");
+    }
+    data = static_cast<char *>(m);
+    mapped = true;
+#else
+    FILE * f = fopen(filename.c_str(), "rb");
+    if (f == NULL) {
+        HFST_THROW_MESSAGE(FileMappingException,
+                           "cannot open " + filename + "\n");
+    }
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (length <= 0) {
+        fclose(f);
+        HFST_THROW_MESSAGE(FileMappingException,
+                           "cannot read " + filename + "\n");
+    }
+    size = static_cast<size_t>(length);
+    data = (char*)(malloc(size));
+    if (fread(data, size, 1, f) != 1) {
+        fclose(f);
+        free(data);
+        HFST_THROW_MESSAGE(FileMappingException,
+                           "cannot read " + filename + "\n");
+    }
+    fclose(f);
+#endif
+}
+
+MappedFile::MappedFile(size_t buffer_size):
+    data((char*)(malloc(buffer_size))),
+    size(buffer_size),
+    mapped(false)
+{
+    if (data == NULL) {
+        HFST_THROW_MESSAGE(FileMappingException,
+                           "cannot allocate transducer buffer\n");
+    }
+}
+
+MappedFile::~MappedFile()
+{
+#if HAVE_SYS_MMAN_H && HAVE_MMAP
+    if (mapped) {
+        munmap(data, size);
+        return;
+    }
+#endif
+    free(data);
+}
+
+char *
+MappedFile::get_data()
+{
+    return data;
+}
+
+size_t
+MappedFile::get_size() const
+{
+    return size;
+}
+
 bool is_big_endian()
 {
 #ifdef WORDS_BIGENDIAN
@@ -188,11 +340,13 @@ void TransducerHeader::skip_hfst3_header(FILE * f)
                                "Found broken HFST3 header\n");
         }
         std::string header_tail(headervalue, remaining_header_len);
+        delete[] headervalue;
         size_t type_field = header_tail.find("type");
         if (type_field != std::string::npos) {
-            if (header_tail.find("HFST_OL") != type_field + 5 &&
-                header_tail.find("HFST_OLW") != type_field + 5) {
-                delete[] headervalue;
+            if (header_tail.find("OSPELL_NATIVE") == type_field + 5) {
+                table_format = NativeTables;
+            } else if (header_tail.find("HFST_OL") != type_field + 5 &&
+                       header_tail.find("HFST_OLW") != type_field + 5) {
                 HFST_THROW_MESSAGE(
                     TransducerTypeException,
                     "Transducer has incorrect type, should be "
@@ -209,14 +363,14 @@ void TransducerHeader::skip_hfst3_header(FILE * f)
     }
 }
 
-void TransducerHeader::skip_hfst3_header(char ** raw)
+void TransducerHeader::skip_hfst3_header(char ** raw, const char * end)
 {
     const char* header1 = "HFST";
     unsigned int header_loc = 0; // how much of the header has been found
 
     for(header_loc = 0; header_loc < strlen(header1) + 1; header_loc++)
     {
-        if(**raw != header1[header_loc]) {
+        if((end != NULL && *raw >= end) || **raw != header1[header_loc]) {
             //std::cerr << header_loc << ": " << int(**raw) << " != " << header1[header_loc] << std::endl;
             break;
         }
@@ -225,26 +379,158 @@ void TransducerHeader::skip_hfst3_header(char ** raw)
     if(header_loc == strlen(header1) + 1) // we found it
     {
         uint16_t remaining_header_len = 0;
+        need_header_bytes(*raw, end, sizeof(uint16_t) + 1,
+                          "Found broken HFST3 header\n");
         if (is_big_endian()) {
             remaining_header_len = read_uint16_flipping_endianness(*raw);
         } else {
             remaining_header_len = *((unsigned short *) *raw);
         }
         //std::cerr << "remaining_header_len " << remaining_header_len << std::endl;
-        (*raw) += sizeof(uint16_t) + 1 + remaining_header_len;
+        (*raw) += sizeof(uint16_t) + 1;
+        need_header_bytes(*raw, end, remaining_header_len,
+                          "HFST3 header ended unexpectedly\n");
+        if (end != NULL && (remaining_header_len == 0 ||
+                            (*raw)[remaining_header_len - 1] != '\0')) {
+            HFST_THROW_MESSAGE(HeaderParsingException,
+                               "Found broken HFST3 header\n");
+        }
+        std::string header_tail(*raw, remaining_header_len);
+        (*raw) += remaining_header_len;
+        size_t type_field = header_tail.find("type");
+        if (type_field != std::string::npos) {
+            if (header_tail.find("OSPELL_NATIVE") == type_field + 5) {
+                table_format = NativeTables;
+            } else if (header_tail.find("HFST_OL") != type_field + 5 &&
+                       header_tail.find("HFST_OLW") != type_field + 5) {
+                HFST_THROW_MESSAGE(
+                    TransducerTypeException,
+                    "Transducer has incorrect type, should be "
+                    "hfst-optimized-lookup\n");
+            }
+        }
     } else // nope. put back what we've taken
     {
-        --(*raw); // first the non-matching character
-        for(int i = header_loc - 1; i>=0; i--) {
-            // then the characters that did match (if any)
-            --(*raw);
+        // the non-matching character was never consumed, only the
+        // characters that did match (if any)
+        (*raw) -= header_loc;
+    }
+}
+
+void TransducerHeader::read_native(char ** raw, const char * end)
+{
+    need_header_bytes(*raw, end, NATIVE_HEADER_SIZE,
+                      "Header ended unexpectedly\n");
+    char * block = *raw;
+    bool swapped = false;
+    uint32_t byte_order_mark = native_value<uint32_t>(block, false);
+    if (byte_order_mark != NATIVE_BYTE_ORDER_MARK) {
+        if (swap_bytes(byte_order_mark) != NATIVE_BYTE_ORDER_MARK) {
+            HFST_THROW_MESSAGE(HeaderParsingException,
+                               "Unknown byte order in native header\n");
+        }
+        swapped = true;
+        table_format = NativeTablesSwapped;
+    }
+    if (native_value<uint32_t>(block + 4, swapped) != NATIVE_FORMAT_VERSION) {
+        HFST_THROW_MESSAGE(HeaderParsingException,
+                           "Unsupported native format version\n");
+    }
+    number_of_input_symbols = native_value<SymbolNumber>(block + 8, swapped);
+    number_of_symbols = native_value<SymbolNumber>(block + 10, swapped);
+    size_of_transition_index_table =
+        native_value<TransitionTableIndex>(block + 12, swapped);
+    size_of_transition_target_table =
+        native_value<TransitionTableIndex>(block + 16, swapped);
+    number_of_states = native_value<TransitionTableIndex>(block + 20, swapped);
+    number_of_transitions =
+        native_value<TransitionTableIndex>(block + 24, swapped);
+    uint32_t properties = native_value<uint32_t>(block + 28, swapped);
+    weighted = (properties >> Weighted) & 1;
+    deterministic = (properties >> Deterministic) & 1;
+    input_deterministic = (properties >> Input_deterministic) & 1;
+    minimized = (properties >> Minimized) & 1;
+    cyclic = (properties >> Cyclic) & 1;
+    has_epsilon_epsilon_transitions =
+        (properties >> Has_epsilon_epsilon_transitions) & 1;
+    has_input_epsilon_transitions =
+        (properties >> Has_input_epsilon_transitions) & 1;
+    has_input_epsilon_cycles = (properties >> Has_input_epsilon_cycles) & 1;
+    has_unweighted_input_epsilon_cycles =
+        (properties >> Has_unweighted_input_epsilon_cycles) & 1;
+    uint32_t alphabet_bytes = native_value<uint32_t>(block + 32, swapped);
+    checksum = native_value<uint64_t>(block + 40, swapped);
+    // the padding goes before the alphabet so that the tables after it
+    // start aligned
+    need_header_bytes(
+        *raw, end, NATIVE_HEADER_SIZE + native_padding(alphabet_bytes),
+        "Header ended unexpectedly\n");
+    (*raw) += NATIVE_HEADER_SIZE + native_padding(alphabet_bytes);
+}
+
+void TransducerHeader::read_native(FILE * f)
+{
+    char block[NATIVE_HEADER_SIZE];
+    if (fread(block, NATIVE_HEADER_SIZE, 1, f) != 1) {
+        HFST_THROW_MESSAGE(HeaderParsingException,
+                           "Header ended unexpectedly\n");
+    }
+    char * p = block;
+    read_native(&p, NULL);
+    for (size_t i = p - block - NATIVE_HEADER_SIZE; i > 0; --i) {
+        if (getc(f) == EOF) {
+            HFST_THROW_MESSAGE(HeaderParsingException,
+                               "Header ended unexpectedly\n");
         }
     }
 }
 
-TransducerHeader::TransducerHeader(FILE* f)
+void TransducerHeader::write_native(FILE * f, uint32_t alphabet_bytes,
+                                    uint64_t table_checksum) const
+{
+    // An HFST3 header naming our own type, so that other readers refuse
+    // the file instead of misreading it. Its length keeps the header
+    // block aligned.
+    const char type[] = "type\0OSPELL_NATIVE";
+    char hfst3[32] = "HFST";
+    hfst3[5] = sizeof(hfst3) - 8; // little-endian length of what follows
+    memcpy(hfst3 + 8, type, sizeof(type));
+    uint32_t properties =
+        (weighted << Weighted) |
+        (deterministic << Deterministic) |
+        (input_deterministic << Input_deterministic) |
+        (minimized << Minimized) |
+        (cyclic << Cyclic) |
+        (has_epsilon_epsilon_transitions << Has_epsilon_epsilon_transitions) |
+        (has_input_epsilon_transitions << Has_input_epsilon_transitions) |
+        (has_input_epsilon_cycles << Has_input_epsilon_cycles) |
+        (has_unweighted_input_epsilon_cycles <<
+         Has_unweighted_input_epsilon_cycles);
+    char block[NATIVE_HEADER_SIZE + NATIVE_ALIGNMENT] = {0};
+    put_native_value(block, NATIVE_BYTE_ORDER_MARK);
+    put_native_value(block + 4, NATIVE_FORMAT_VERSION);
+    put_native_value(block + 8, number_of_input_symbols);
+    put_native_value(block + 10, number_of_symbols);
+    put_native_value(block + 12, size_of_transition_index_table);
+    put_native_value(block + 16, size_of_transition_target_table);
+    put_native_value(block + 20, number_of_states);
+    put_native_value(block + 24, number_of_transitions);
+    put_native_value(block + 28, properties);
+    put_native_value(block + 32, alphabet_bytes);
+    put_native_value(block + 40, table_checksum);
+    fwrite(hfst3, sizeof(hfst3), 1, f);
+    fwrite(block, NATIVE_HEADER_SIZE + native_padding(alphabet_bytes), 1, f);
+}
+
+TransducerHeader::TransducerHeader(FILE* f):
+    table_format(ClassicTables),
+    checksum(0)
 {
     skip_hfst3_header(f); // skip header iff it is present
+    if (table_format != ClassicTables) {
+        read_native(f);
+        return;
+    }
     if (is_big_endian()) {
         // no error checking yet
         number_of_input_symbols = read_uint16_flipping_endianness(f);
@@ -291,9 +577,20 @@ TransducerHeader::TransducerHeader(FILE* f)
     read_property(has_unweighted_input_epsilon_cycles,f);
 }
 
-TransducerHeader::TransducerHeader(char** raw)
+TransducerHeader::TransducerHeader(char** raw, const char* end):
+    table_format(ClassicTables),
+    checksum(0)
 {
-    skip_hfst3_header(raw); // skip header iff it is present
+    skip_hfst3_header(raw, end); // skip header iff it is present
+    if (table_format != ClassicTables) {
+        read_native(raw, end);
+        return;
+    }
+    // the counts, the sizes and nine properties of 32 bits
+    need_header_bytes(
+        *raw, end, 2 * sizeof(SymbolNumber) +
+        4 * sizeof(TransitionTableIndex) + 9 * sizeof(uint32_t),
+        "Header ended unexpectedly\n");
     if (is_big_endian()) {
         number_of_input_symbols = read_uint16_flipping_endianness(*raw);
         (*raw) += sizeof(SymbolNumber);
@@ -352,17 +649,29 @@ TransducerHeader::input_symbol_count()
     return number_of_input_symbols;
 }
 TransitionTableIndex
-TransducerHeader::index_table_size()
+TransducerHeader::index_table_size() const
 {
     return size_of_transition_index_table;
 }
 
 TransitionTableIndex
-TransducerHeader::target_table_size()
+TransducerHeader::target_table_size() const
 {
     return size_of_transition_target_table;
 }
 
+TableFormat
+TransducerHeader::get_table_format() const
+{
+    return table_format;
+}
+
+uint64_t
+TransducerHeader::get_checksum() const
+{
+    return checksum;
+}
+
 bool
 TransducerHeader::probe_flag(HeaderFlag flag)
 {
@@ -423,6 +732,8 @@ void TransducerAlphabet::read(FILE * f, SymbolNumber number_of_symbols)
     value_bucket[std::string()] = 0; // empty value = neutral
     ValueNumber val_num = 1;
     SymbolNumber feat_num = 0;
+    operations.assign(number_of_symbols, FlagDiacriticOperation());
+    flag_symbols.assign(number_of_symbols, false);
 
     kt.push_back(std::string("")); // zeroth symbol is epsilon
     int byte;
@@ -474,11 +785,9 @@ void TransducerAlphabet::read(FILE * f, SymbolNumber number_of_symbols)
                     ++val_num;
                 }
 
-                operations.insert(
-                    std::pair<SymbolNumber, FlagDiacriticOperation>(
-                        k,
-                        FlagDiacriticOperation(
-                            op, feature_bucket[feat], value_bucket[val])));
+                operations[k] = FlagDiacriticOperation(
+                    op, feature_bucket[feat], value_bucket[val]);
+                flag_symbols[k] = true;
 
                 kt.push_back(std::string(""));
                 continue;
@@ -503,18 +812,32 @@ void TransducerAlphabet::read(FILE * f, SymbolNumber number_of_symbols)
     flag_state_size = static_cast<SymbolNumber>(feature_bucket.size());
 }
 
-void TransducerAlphabet::read(char ** raw, SymbolNumber number_of_symbols)
+// throw unless the symbol string at @a raw ends before @a end, if it is set
+static void check_symbol(const char * raw, const char * end)
+{
+    if (end != NULL && (raw >= end || memchr(raw, 0, end - raw) == NULL)) {
+        HFST_THROW_MESSAGE(AlphabetParsingException,
+                           "alphabet ends past the data\n");
+    }
+}
+
+void TransducerAlphabet::read(char ** raw, SymbolNumber number_of_symbols,
+                              const char * end)
 {
     std::map<std::string, SymbolNumber> feature_bucket;
     std::map<std::string, ValueNumber> value_bucket;
     value_bucket[std::string()] = 0; // empty value = neutral
     ValueNumber val_num = 1;
     SymbolNumber feat_num = 0;
+    operations.assign(number_of_symbols, FlagDiacriticOperation());
+    flag_symbols.assign(number_of_symbols, false);
 
     kt.push_back(std::string("")); // zeroth symbol is epsilon
+    check_symbol(*raw, end);
     skip_c_string(raw);
 
     for (SymbolNumber k = 1; k < number_of_symbols; ++k) {
+        check_symbol(*raw, end);
 
         // Detect and handle special symbols, which begin and end with @
         if ((*raw)[0] == '@' && (*raw)[strlen(*raw) - 1] == '@') {
@@ -547,11 +870,9 @@ void TransducerAlphabet::read(char ** raw, SymbolNumber number_of_symbols)
                     ++val_num;
                 }
 
-                operations.insert(
-                    std::pair<SymbolNumber, FlagDiacriticOperation>(
-                        k,
-                        FlagDiacriticOperation(
-                            op, feature_bucket[feat], value_bucket[val])));
+                operations[k] = FlagDiacriticOperation(
+                    op, feature_bucket[feat], value_bucket[val]);
+                flag_symbols[k] = true;
 
                 kt.push_back(std::string(""));
                 skip_c_string(raw);
@@ -589,12 +910,13 @@ TransducerAlphabet::TransducerAlphabet(FILE* f, SymbolNumber number_of_symbols):
 }
 
 TransducerAlphabet::TransducerAlphabet(char** raw,
-                                       SymbolNumber number_of_symbols):
+                                       SymbolNumber number_of_symbols,
+                                       const char* end):
     unknown_symbol(NO_SYMBOL),
     identity_symbol(NO_SYMBOL),
     orig_symbol_count(number_of_symbols)
 {
-    read(raw, number_of_symbols);
+    read(raw, number_of_symbols, end);
 }
 
 void TransducerAlphabet::add_symbol(std::string & sym)
@@ -615,10 +937,29 @@ TransducerAlphabet::get_key_table()
     return &kt;
 }
 
+const KeyTable*
+TransducerAlphabet::get_key_table() const
+{
+    return &kt;
+}
+
+const OperationVector*
+TransducerAlphabet::get_operations() const
+{
+    return &operations;
+}
+
 OperationMap*
 TransducerAlphabet::get_operation_map()
 {
-    return &operations;
+    if (operation_map.empty()) {
+        for (SymbolNumber k = 0; k < operations.size(); ++k) {
+            if (is_flag(k)) {
+                operation_map.insert(OperationMap::value_type(k, operations[k]));
+            }
+        }
+    }
+    return &operation_map;
 }
 
 SymbolNumber
@@ -655,91 +996,315 @@ bool TransducerAlphabet::has_string(std::string const & s) const
     return string_to_symbol.count(s) != 0;
 }
 
-bool
-TransducerAlphabet::is_flag(SymbolNumber symbol)
+// whether tables in @a format are in the other byte order than the host
+inline bool swapped_tables(TableFormat format)
 {
-    return operations.count(symbol) == 1;
+    return (format == ClassicTables) ? is_big_endian() :
+        (format == NativeTablesSwapped);
 }
 
-void IndexTable::read(FILE * f,
-                      TransitionTableIndex number_of_table_entries)
+// Reverses the bytes of @a count values of type T found @a stride bytes
+// apart from @a first on
+template <typename T>
+void swap_column(char * first, size_t stride, TransitionTableIndex count)
 {
-    size_t table_size = number_of_table_entries*TransitionIndex::SIZE;
-    indices = (char*)(malloc(table_size));
-    if (fread(indices,table_size, 1, f) != 1) {
+    for (TransitionTableIndex i = 0; i < count; ++i) {
+        std::reverse(first + i * stride, first + i * stride + sizeof(T));
+    }
+}
+
+// bytes taken by a native column of @a count values of type T
+template <typename T>
+inline size_t native_column_bytes(TransitionTableIndex count)
+{
+    size_t bytes = (static_cast<size_t>(count) + 1) * sizeof(T);
+    return bytes + native_padding(bytes);
+}
+
+// whether native tables can be used in place at @a raw, i.e. their
+// columns are aligned for the values in them
+inline bool native_aligned(const char * raw)
+{
+    return reinterpret_cast<uintptr_t>(raw) % NATIVE_ALIGNMENT == 0;
+}
+
+// the native column at @a column, which starts a whole number of
+// NATIVE_ALIGNMENT blocks into a table at an aligned address
+template <typename T>
+inline const T * native_array(const char * column)
+{
+    return reinterpret_cast<const T *>(column);
+}
+
+size_t IndexTable::table_bytes(TransitionTableIndex entries,
+                               TableFormat format)
+{
+    if (format == ClassicTables) {
+        return static_cast<size_t>(entries) * TransitionIndex::SIZE;
+    }
+    return native_column_bytes<SymbolNumber>(entries) +
+        native_column_bytes<TransitionTableIndex>(entries);
+}
+
+void IndexTable::set_columns(char * table, TableFormat format, bool swap)
+{
+    char * inputs = table;
+    char * targets_start;
+    size_t symbol_stride;
+    size_t value_stride;
+    if (format == ClassicTables) {
+        targets_start = inputs + sizeof(SymbolNumber);
+        symbol_stride = TransitionIndex::SIZE;
+        value_stride = TransitionIndex::SIZE;
+    } else {
+        targets_start = inputs + native_column_bytes<SymbolNumber>(size);
+        symbol_stride = sizeof(SymbolNumber);
+        value_stride = sizeof(TransitionTableIndex);
+    }
+    if (swap) {
+        swap_column<SymbolNumber>(inputs, symbol_stride, size);
+        swap_column<TransitionTableIndex>(targets_start, value_stride, size);
+    }
+    if (format == ClassicTables) {
+        input_symbols = TableColumn<SymbolNumber>(inputs, symbol_stride);
+        targets = TableColumn<TransitionTableIndex>(targets_start,
+                                                    value_stride);
+    } else {
+        input_symbols = TableColumn<SymbolNumber>(
+            native_array<SymbolNumber>(inputs));
+        targets = TableColumn<TransitionTableIndex>(
+            native_array<TransitionTableIndex>(targets_start));
+    }
+    final_weights = TableColumn<Weight>(targets_start, value_stride);
+}
+
+void IndexTable::read(FILE * f, TableFormat format)
+{
+    size_t bytes = table_bytes(size, format);
+    borrowed = false;
+    data = (char*)(malloc(bytes));
+    if (fread(data, 1, bytes, f) != bytes) {
         HFST_THROW(IndexTableReadingException);
     }
-    if (is_big_endian()) {
-        convert_to_big_endian();
+    set_columns(data, format, swapped_tables(format));
+}
+
+void IndexTable::read(char ** raw, bool borrow, TableFormat format,
+                      const char * end)
+{
+    size_t bytes = table_bytes(size, format);
+    if (end != NULL && static_cast<size_t>(end - *raw) < bytes) {
+        HFST_THROW_MESSAGE(IndexTableReadingException,
+                           "index table ends past the data\n");
     }
+    if (borrow && !swapped_tables(format) &&
+        (format == ClassicTables || native_aligned(*raw))) {
+        // the table is already in host order, use it where it lies
+        borrowed = true;
+        data = *raw;
+        set_columns(data, format, false);
+    } else {
+        borrowed = false;
+        data = (char*)(malloc(bytes));
+        memcpy(data, *raw, bytes);
+        set_columns(data, format, swapped_tables(format));
+    }
+    (*raw) += bytes;
 }
 
-void IndexTable::read(char ** raw,
-                      TransitionTableIndex number_of_table_entries)
+void IndexTable::write_native(FILE * f) const
 {
-    size_t table_size = number_of_table_entries*TransitionIndex::SIZE;
-    indices = (char*)(malloc(table_size));
-    memcpy((void *) indices, (const void *) *raw, table_size);
-    (*raw) += table_size;
-    if (is_big_endian()) {
-        convert_to_big_endian();
+    // the entry past the end is written as the sentinel the accessors give
+    std::vector<SymbolNumber> input_column(size + 1);
+    std::vector<TransitionTableIndex> target_column(size + 1);
+    for (TransitionTableIndex i = 0; i <= size; ++i) {
+        input_column[i] = input_symbol(i);
+        target_column[i] = target(i);
     }
+    write_native_array(f, &input_column[0], size + 1);
+    write_native_array(f, &target_column[0], size + 1);
 }
 
-void IndexTable::convert_to_big_endian()
+bool IndexTable::borrows_memory() const
 {
-    //std::cerr << "IndexTable::convert_to_big_endian " << size << std::endl;
-    // We have a sequence of uint_16's and uint_32's in memory,
-    // and we're going to flip endianness of each one.
-    for(size_t i = 0; i < size; ++i) {
-        // first the uint_16
-        std::swap(*(indices + i * TransitionIndex::SIZE + 0), *(indices + i * TransitionIndex::SIZE + 1));
-        // then the uint_32
-        std::swap(*(indices + i * TransitionIndex::SIZE + 2), *(indices + i * TransitionIndex::SIZE + 5));
-        std::swap(*(indices + i * TransitionIndex::SIZE + 3), *(indices + i * TransitionIndex::SIZE + 4));
+    return borrowed;
+}
+
+size_t TransitionTable::table_bytes(TransitionTableIndex entries,
+                                    TableFormat format)
+{
+    if (format == ClassicTables) {
+        return static_cast<size_t>(entries) * Transition::SIZE;
+    }
+    return 2 * native_column_bytes<SymbolNumber>(entries) +
+        native_column_bytes<TransitionTableIndex>(entries) +
+        native_column_bytes<Weight>(entries);
+}
+
+void TransitionTable::set_columns(char * table, TableFormat format,
+                                  bool swap)
+{
+    char * inputs = table;
+    char * outputs;
+    char * targets_start;
+    char * weights_start;
+    size_t symbol_stride;
+    size_t value_stride;
+    if (format == ClassicTables) {
+        outputs = inputs + sizeof(SymbolNumber);
+        targets_start = outputs + sizeof(SymbolNumber);
+        weights_start = targets_start + sizeof(TransitionTableIndex);
+        symbol_stride = Transition::SIZE;
+        value_stride = Transition::SIZE;
+    } else {
+        outputs = inputs + native_column_bytes<SymbolNumber>(size);
+        targets_start = outputs + native_column_bytes<SymbolNumber>(size);
+        weights_start = targets_start +
+            native_column_bytes<TransitionTableIndex>(size);
+        symbol_stride = sizeof(SymbolNumber);
+        value_stride = sizeof(TransitionTableIndex);
+    }
+    if (swap) {
+        swap_column<SymbolNumber>(inputs, symbol_stride, size);
+        swap_column<SymbolNumber>(outputs, symbol_stride, size);
+        swap_column<TransitionTableIndex>(targets_start, value_stride, size);
+        swap_column<Weight>(weights_start, value_stride, size);
+    }
+    if (format == ClassicTables) {
+        input_symbols = TableColumn<SymbolNumber>(inputs, symbol_stride);
+        output_symbols = TableColumn<SymbolNumber>(outputs, symbol_stride);
+        targets = TableColumn<TransitionTableIndex>(targets_start,
+                                                    value_stride);
+        weights = TableColumn<Weight>(weights_start, value_stride);
+    } else {
+        input_symbols = TableColumn<SymbolNumber>(
+            native_array<SymbolNumber>(inputs));
+        output_symbols = TableColumn<SymbolNumber>(
+            native_array<SymbolNumber>(outputs));
+        targets = TableColumn<TransitionTableIndex>(
+            native_array<TransitionTableIndex>(targets_start));
+        weights = TableColumn<Weight>(native_array<Weight>(weights_start));
     }
 }
 
-void TransitionTable::read(FILE * f,
-                           TransitionTableIndex number_of_table_entries)
+void TransitionTable::read(FILE * f, TableFormat format)
 {
-    size_t table_size = number_of_table_entries*Transition::SIZE;
-    transitions = (char*)(malloc(table_size));
-    if (fread(transitions, table_size, 1, f) != 1) {
+    size_t bytes = table_bytes(size, format);
+    borrowed = false;
+    data = (char*)(malloc(bytes));
+    if (fread(data, 1, bytes, f) != bytes) {
         HFST_THROW(TransitionTableReadingException);
     }
-    if (is_big_endian()) {
-        convert_to_big_endian();
+    set_columns(data, format, swapped_tables(format));
+}
+
+void TransitionTable::read(char ** raw, bool borrow, TableFormat format,
+                           const char * end)
+{
+    size_t bytes = table_bytes(size, format);
+    if (end != NULL && static_cast<size_t>(end - *raw) < bytes) {
+        HFST_THROW_MESSAGE(TransitionTableReadingException,
+                           "transition table ends past the data\n");
+    }
+    if (borrow && !swapped_tables(format) &&
+        (format == ClassicTables || native_aligned(*raw))) {
+        borrowed = true;
+        data = *raw;
+        set_columns(data, format, false);
+    } else {
+        borrowed = false;
+        data = (char*)(malloc(bytes));
+        memcpy(data, *raw, bytes);
+        set_columns(data, format, swapped_tables(format));
     }
+    (*raw) += bytes;
 }
 
-void TransitionTable::read(char ** raw,
-                           TransitionTableIndex number_of_table_entries)
+void TransitionTable::write_native(FILE * f) const
 {
-    size_t table_size = number_of_table_entries*Transition::SIZE;
-    transitions = (char*)(malloc(table_size));
-    memcpy((void *) transitions, (const void *) *raw, table_size);
-    (*raw) += table_size;
-    if (is_big_endian()) {
-        convert_to_big_endian();
+    std::vector<SymbolNumber> input_column(size + 1);
+    std::vector<SymbolNumber> output_column(size + 1);
+    std::vector<TransitionTableIndex> target_column(size + 1);
+    std::vector<Weight> weight_column(size + 1);
+    for (TransitionTableIndex i = 0; i <= size; ++i) {
+        input_column[i] = input_symbol(i);
+        output_column[i] = output_symbol(i);
+        target_column[i] = target(i);
+        weight_column[i] = weight(i);
     }
+    write_native_array(f, &input_column[0], size + 1);
+    write_native_array(f, &output_column[0], size + 1);
+    write_native_array(f, &target_column[0], size + 1);
+    write_native_array(f, &weight_column[0], size + 1);
+}
+
+bool TransitionTable::borrows_memory() const
+{
+    return borrowed;
 }
 
-void TransitionTable::convert_to_big_endian()
+uint64_t transducer_checksum(const TransducerAlphabet & alphabet,
+                             const IndexTable & indices,
+                             const TransitionTable & transitions)
 {
-    //std::cerr << "TransitionTable::convert_to_big_endian " << size << std::endl;
-    // We have a sequence of [ uint_16, uint_16, uint_32, float ] in memory,
-    // and we're going to flip endianness of each one.
-    for(size_t i = 0; i < size; ++i) {
-        // first the uint_16s
-        std::swap(*(transitions + i * Transition::SIZE + 0), *(transitions + i * Transition::SIZE + 1));
-        std::swap(*(transitions + i * Transition::SIZE + 2), *(transitions + i * Transition::SIZE + 3));
-        // then the uint_32
-        std::swap(*(transitions + i * Transition::SIZE + 4), *(transitions + i * Transition::SIZE + 7));
-        std::swap(*(transitions + i * Transition::SIZE + 5), *(transitions + i * Transition::SIZE + 6));
-        // then the float
-        std::swap(*(transitions + i * Transition::SIZE + 8), *(transitions + i * Transition::SIZE + 11));
-        std::swap(*(transitions + i * Transition::SIZE + 9), *(transitions + i * Transition::SIZE + 10));
+    // Only the symbols of the file, as spellers add their own later. The
+    // key table has no strings for flags, and the readers differ on the
+    // unknown and identity symbols, so those go in by their operations
+    // and numbers instead.
+    const KeyTable & keys = *alphabet.get_key_table();
+    const OperationVector & operations = *alphabet.get_operations();
+    uint64_t hash = HASH_BASIS;
+    for (SymbolNumber k = 0; k < alphabet.get_orig_symbol_count(); ++k) {
+        if (k != alphabet.get_unknown() && k != alphabet.get_identity()) {
+            hash = hash_bytes(hash, keys[k].c_str(), keys[k].size() + 1);
+        }
+        hash = hash_word(hash, operations[k].Operation());
+        hash = hash_word(hash, operations[k].Feature());
+        hash = hash_word(hash, operations[k].Value());
+    }
+    hash = hash_word(hash, alphabet.get_unknown());
+    hash = hash_word(hash, alphabet.get_identity());
+    hash = hash_word(hash, indices.get_size());
+    for (TransitionTableIndex i = 0; i < indices.get_size(); ++i) {
+        hash = hash_word(hash, indices.input_symbol(i));
+        hash = hash_word(hash, indices.target(i));
+    }
+    hash = hash_word(hash, transitions.get_size());
+    for (TransitionTableIndex i = 0; i < transitions.get_size(); ++i) {
+        Weight weight = transitions.weight(i);
+        uint32_t weight_bits;
+        memcpy(&weight_bits, &weight, sizeof(weight_bits));
+        hash = hash_word(hash, transitions.input_symbol(i));
+        hash = hash_word(hash, transitions.output_symbol(i));
+        hash = hash_word(hash, transitions.target(i));
+        hash = hash_word(hash, weight_bits);
+    }
+    return hash;
+}
+
+void write_native_transducer(char * raw, const char * end, FILE * f)
+{
+    TransducerHeader header(&raw, end);
+    // the alphabet is copied as it is
+    char * alphabet_start = raw;
+    TransducerAlphabet alphabet(&raw, header.symbol_count(), end);
+    uint32_t alphabet_bytes = static_cast<uint32_t>(raw - alphabet_start);
+    IndexTable indices(&raw, header.index_table_size(), true,
+                       header.get_table_format(), end);
+    TransitionTable transitions(&raw, header.target_table_size(), true,
+                                header.get_table_format(), end);
+    // a native file being converted again keeps its checksum
+    uint64_t checksum = header.get_checksum();
+    if (checksum == 0) {
+        checksum = transducer_checksum(alphabet, indices, transitions);
+    }
+    header.write_native(f, alphabet_bytes, checksum);
+    fwrite(alphabet_start, 1, alphabet_bytes, f);
+    indices.write_native(f);
+    transitions.write_native(f);
+    if (ferror(f)) {
+        HFST_THROW_MESSAGE(TransducerWritingException,
+                           "writing native transducer failed\n");
     }
 }
 
@@ -879,148 +1444,63 @@ Transition::final() const
 }
 
 IndexTable::IndexTable(FILE* f,
-                       TransitionTableIndex number_of_table_entries):
-    indices(NULL),
-    size(number_of_table_entries)
+                       TransitionTableIndex number_of_table_entries,
+                       TableFormat format):
+    size(number_of_table_entries),
+    data(NULL),
+    borrowed(false)
 {
-    read(f, number_of_table_entries);
+    read(f, format);
 }
 
 IndexTable::IndexTable(char ** raw,
-                       TransitionTableIndex number_of_table_entries):
-    indices(NULL),
-    size(number_of_table_entries)
+                       TransitionTableIndex number_of_table_entries,
+                       bool borrow,
+                       TableFormat format,
+                       const char * end):
+    size(number_of_table_entries),
+    data(NULL),
+    borrowed(false)
 {
-    read(raw, number_of_table_entries);
+    read(raw, borrow, format, end);
 }
 
 IndexTable::~IndexTable()
 {
-    if (indices) {
-        free(indices);
-    }
-}
-
-SymbolNumber
-IndexTable::input_symbol(TransitionTableIndex i) const
-{
-    if (i < size) {
-        return hfst_deref((SymbolNumber *)
-                          (indices + TransitionIndex::SIZE * i));
-    } else {
-        return NO_SYMBOL;
-    }
-}
-
-TransitionTableIndex
-IndexTable::target(TransitionTableIndex i) const
-{
-    if (i < size) {
-        return hfst_deref((TransitionTableIndex *)
-                          (indices + TransitionIndex::SIZE * i +
-                           sizeof(SymbolNumber)));
-    } else {
-        return NO_TABLE_INDEX;
-    }
-}
-
-bool
-IndexTable::final(TransitionTableIndex i) const
-{
-    return input_symbol(i) == NO_SYMBOL && target(i) != NO_TABLE_INDEX;
-}
-
-Weight
-IndexTable::final_weight(TransitionTableIndex i) const
-{
-    if (i < size) {
-        return hfst_deref((Weight *)
-                          (indices + TransitionIndex::SIZE * i +
-                           sizeof(SymbolNumber)));
-    } else {
-        return INFINITE_WEIGHT;
+    if (!borrowed) {
+        free(data);
     }
 }
 
 TransitionTable::TransitionTable(FILE * f,
-                                 TransitionTableIndex transition_count):
-    transitions(NULL),
-    size(transition_count)
+                                 TransitionTableIndex transition_count,
+                                 TableFormat format):
+    size(transition_count),
+    data(NULL),
+    borrowed(false)
 {
-    read(f, transition_count);
+    read(f, format);
 }
 
 TransitionTable::TransitionTable(char ** raw,
-                                 TransitionTableIndex transition_count):
-    transitions(NULL),
-    size(transition_count)
+                                 TransitionTableIndex transition_count,
+                                 bool borrow,
+                                 TableFormat format,
+                                 const char * end):
+    size(transition_count),
+    data(NULL),
+    borrowed(false)
 {
-    read(raw, transition_count);
+    read(raw, borrow, format, end);
 }
 
 TransitionTable::~TransitionTable()
 {
-    if (transitions) {
-        free(transitions);
+    if (!borrowed) {
+        free(data);
     }
 }
 
-SymbolNumber
-TransitionTable::input_symbol(TransitionTableIndex i) const
-{
-    if (i < size) {
-        return hfst_deref((SymbolNumber *)
-                          (transitions + Transition::SIZE * i));
-    } else {
-        return NO_SYMBOL;
-    }
-}
-
-SymbolNumber
-TransitionTable::output_symbol(TransitionTableIndex i) const
-{
-    if (i < size) {
-        return hfst_deref((SymbolNumber *)
-                          (transitions + Transition::SIZE * i +
-                           sizeof(SymbolNumber)));
-    } else {
-        return NO_SYMBOL;
-    }
-}
-
-TransitionTableIndex
-TransitionTable::target(TransitionTableIndex i) const
-{
-    if (i < size) {
-        return hfst_deref((TransitionTableIndex *)
-                          (transitions + Transition::SIZE * i +
-                           2*sizeof(SymbolNumber)));
-    } else {
-        return NO_TABLE_INDEX;
-    }
-}
-
-Weight
-TransitionTable::weight(TransitionTableIndex i) const
-{
-    if (i < size) {
-        return hfst_deref((Weight *)
-                          (transitions + Transition::SIZE * i +
-                           2*sizeof(SymbolNumber) +
-                           sizeof(TransitionTableIndex)));
-    } else {
-        return INFINITE_WEIGHT;
-    }
-}
-
-bool
-TransitionTable::final(TransitionTableIndex i) const
-{
-    return input_symbol(i) == NO_SYMBOL &&
-        output_symbol(i) == NO_SYMBOL &&
-        target(i) == 1;
-}
-
 SymbolNumber Encoder::find_key(char ** p)
 {
     if (ascii_symbols[(unsigned char)(**p)] == NO_SYMBOL)
@@ -53,6 +53,7 @@ typedef std::vector<TransitionIndex*> TransitionIndexVector;
 typedef std::vector<Transition*> TransitionVector;
 
 typedef std::map<SymbolNumber, FlagDiacriticOperation> OperationMap;
+typedef std::vector<FlagDiacriticOperation> OperationVector;
 
 const SymbolNumber NO_SYMBOL = USHRT_MAX;
 const TransitionTableIndex NO_TABLE_INDEX = UINT_MAX;
@@ -72,6 +73,21 @@ enum HeaderFlag {Weighted, Deterministic, Input_deterministic, Minimized,
                  Has_input_epsilon_transitions, Has_input_epsilon_cycles,
                  Has_unweighted_input_epsilon_cycles};
 
+// The native format is an HFST3 header of type OSPELL_NATIVE followed by a
+// fixed-size header block, the alphabet and then every table column as its
+// own array. Sections start at multiples of NATIVE_ALIGNMENT bytes from the
+// beginning of the file, and the header block starts with a byte order mark
+// written in the byte order of the machine that wrote the file. The header
+// block also keeps the transducer_checksum() of the automaton, so that
+// readers can tell automata apart without going through their tables.
+const uint32_t NATIVE_FORMAT_VERSION = 1;
+const uint32_t NATIVE_BYTE_ORDER_MARK = 0x01020304u;
+const size_t NATIVE_HEADER_SIZE = 64;
+const size_t NATIVE_ALIGNMENT = 8;
+
+//! how the tables are laid out in the data being read
+enum TableFormat {ClassicTables, NativeTables, NativeTablesSwapped};
+
 // Will probably turn into a compile-time constant
 bool is_big_endian(void);
 uint16_t read_uint16_flipping_endianness(FILE * f);
@@ -82,6 +98,49 @@ float read_float_flipping_endianness(FILE * f);
 // Utility function for dealing with raw memory
 void skip_c_string(char ** raw);
 
+//! start value for hash_bytes() and hash_word()
+const uint64_t HASH_BASIS = 14695981039346656037u;
+//!
+//! 64 bit FNV-1a of @a size bytes at @a bytes, continuing from @a hash
+uint64_t hash_bytes(uint64_t hash, const void * bytes, size_t size);
+//!
+//! like hash_bytes(), but a word at a time, for the long tables
+inline uint64_t hash_word(uint64_t hash, uint32_t word)
+{
+    return (hash ^ word) * 1099511628211u;
+}
+
+//! write the transducer at @a raw, in either format, to @a f in the native
+//! format, throwing if it doesn't end by @a end
+void write_native_transducer(char * raw, const char * end, FILE * f);
+
+//! Internal class for keeping transducer data in memory.
+
+//! Holds the raw bytes of a transducer, either mapped read-only from a file
+//! with mmap or, where mapping is not available, in an owned heap buffer.
+//! A Transducer built over it borrows its tables instead of copying them.
+class MappedFile
+{
+private:
+    char * data;
+    size_t size;
+    bool mapped;
+public:
+    //!
+    //! map file @a filename read-only into memory
+    MappedFile(const std::string & filename);
+    //!
+    //! allocate an owned buffer of @a buffer_size bytes for the caller to fill
+    MappedFile(size_t buffer_size);
+    ~MappedFile(void);
+    //!
+    //! start of the data
+    char * get_data(void);
+    //!
+    //! length of the data in bytes
+    size_t get_size(void) const;
+};
+
 //! Internal class for Transducer processing.
 
 //! Contains low-level processing stuff.
@@ -105,10 +164,14 @@ private:
     bool has_input_epsilon_transitions;
     bool has_input_epsilon_cycles;
     bool has_unweighted_input_epsilon_cycles;
+    TableFormat table_format;
+    uint64_t checksum; //!< stored in native headers, 0 if not known
     void read_property(bool &property, FILE * f);
     void read_property(bool &property, char ** raw);
     void skip_hfst3_header(FILE * f);
-    void skip_hfst3_header(char ** f);
+    void skip_hfst3_header(char ** f, const char * end);
+    void read_native(FILE * f);
+    void read_native(char ** raw, const char * end);
 
 public:
     //!
@@ -116,8 +179,9 @@ public:
     TransducerHeader(FILE * f);
 
     //!
-    //! read header from raw memory data @a raw
-    TransducerHeader(char ** raw);
+    //! read header from raw memory data @a raw, throwing if it doesn't
+    //! end by @a end unless that is NULL
+    TransducerHeader(char ** raw, const char * end = NULL);
     //!
     //! count symbols
     SymbolNumber symbol_count(void);
@@ -126,13 +190,25 @@ public:
     SymbolNumber input_symbol_count(void);
     //!
     //! index table size
-    TransitionTableIndex index_table_size(void);
+    TransitionTableIndex index_table_size(void) const;
     //!
     //! target table size
-    TransitionTableIndex target_table_size(void);
+    TransitionTableIndex target_table_size(void) const;
     //!
     //! check for flag
     bool probe_flag(HeaderFlag flag);
+    //!
+    //! layout of the tables following the alphabet
+    TableFormat get_table_format(void) const;
+    //!
+    //! transducer_checksum() stored with the header, or 0 if there is none
+    uint64_t get_checksum(void) const;
+    //!
+    //! write the header in the native format, to be followed by
+    //! @a alphabet_bytes bytes of alphabet, with @a table_checksum as the
+    //! checksum
+    void write_native(FILE * f, uint32_t alphabet_bytes,
+                      uint64_t table_checksum) const;
 };
 
 //! Internal class for flag diacritic processing.
@@ -141,9 +217,9 @@ public:
 class FlagDiacriticOperation
 {
 private:
-    const FlagDiacriticOperator operation;
-    const SymbolNumber feature;
-    const ValueNumber value;
+    FlagDiacriticOperator operation;
+    SymbolNumber feature;
+    ValueNumber value;
 public:
     //!
     //! Construct flag diacritic of from \@ @a op . @a feat . @a val \@.
@@ -178,7 +254,12 @@ class TransducerAlphabet
 {
 private:
     KeyTable kt;
-    OperationMap operations;
+    //! flag operation of each symbol of the file, dummies for non-flags
+    OperationVector operations;
+    //! whether each symbol of the file is a flag diacritic
+    std::vector<bool> flag_symbols;
+    //! the flag operations as a map, made for get_operation_map()
+    OperationMap operation_map;
     SymbolNumber unknown_symbol;
     SymbolNumber identity_symbol;
     SymbolNumber flag_state_size;
@@ -187,25 +268,39 @@ private:
     void process_symbol(char * line);
 
     void read(FILE * f, SymbolNumber number_of_symbols);
-    void read(char ** raw, SymbolNumber number_of_symbols);
+    void read(char ** raw, SymbolNumber number_of_symbols,
+              const char * end);
 
 public:
     //!
     //! read alphabets from file @a f
     TransducerAlphabet(FILE *f, SymbolNumber number_of_symbols);
     //!
-    //! read alphabes from raw data @a raw
-    TransducerAlphabet(char ** raw, SymbolNumber number_of_symbols);
+    //! read alphabes from raw data @a raw, throwing if they don't end by
+    //! @a end unless that is NULL
+    TransducerAlphabet(char ** raw, SymbolNumber number_of_symbols,
+                       const char * end = NULL);
 
     void add_symbol(std::string & sym);
     void add_symbol(char * sym);
     //!
     //! get alphabet's keytable mapping
     KeyTable * get_key_table(void);
+    const KeyTable * get_key_table(void) const;
+    //!
+    //! get flag operations, indexed by symbol
+    const OperationVector * get_operations(void) const;
     //!
-    //! get flag operation map stuff
+    //! get flag operation map stuff. Deprecated, get_operations() gives
+    //! the same without a map, which is made the first time it's asked for
     OperationMap * get_operation_map(void);
     //!
+    //! flag operation of @a symbol, which must be a flag
+    const FlagDiacriticOperation & get_operation(SymbolNumber symbol) const
+    {
+        return operations[symbol];
+    }
+    //!
     //! get state's size
     SymbolNumber get_state_size(void);
     //!
@@ -220,7 +315,10 @@ public:
     bool has_string(std::string const & s) const;
     //!
     //! get if given symbol is a flag
-    bool is_flag(SymbolNumber symbol);
+    bool is_flag(SymbolNumber symbol) const
+    {
+        return symbol < flag_symbols.size() && flag_symbols[symbol];
+    }
 };
 
 class LetterTrie;
@@ -362,93 +460,259 @@ public:
     bool final(void) const;
 };
 
+//! Internal class for reading table columns.
+
+//! One field of every entry of a table, read straight from the table data.
+//! Classic tables interleave the fields, so their columns have the size of
+//! an entry as stride and the values are copied out, as they needn't be
+//! aligned. Native ones keep each column as an aligned array, which can
+//! also be read as such through get_array().
+template <typename T>
+class TableColumn
+{
+private:
+    const char * first;
+    size_t stride;
+    const T * array; //!< the column as an array, NULL if interleaved
+public:
+    TableColumn(void):
+        first(NULL),
+        stride(sizeof(T)),
+        array(NULL)
+        {}
+    TableColumn(const char * column, size_t entry_size):
+        first(column),
+        stride(entry_size),
+        array(NULL)
+        {}
+    explicit TableColumn(const T * column):
+        first(reinterpret_cast<const char *>(column)),
+        stride(sizeof(T)),
+        array(column)
+        {}
+    T operator[](TransitionTableIndex i) const
+    {
+        T value;
+        memcpy(&value, first + static_cast<size_t>(i) * stride,
+               sizeof(value));
+        return value;
+    }
+    //!
+    //! the values as an array, or NULL for a column of a classic table
+    const T * get_array(void) const
+    {
+        return array;
+    }
+};
+
 //! Internal class for Transducer processing.
 
-//! Contains low-level processing stuff.
+//! Contains low-level processing stuff. The columns are read where they lie
+//! in either format, and every accessor is bounds checked.
 class IndexTable
 {
 private:
-    char * indices;
+    TableColumn<SymbolNumber> input_symbols;
+    TableColumn<TransitionTableIndex> targets;
+    TableColumn<Weight> final_weights; //!< the targets read as weights
     TransitionTableIndex size;
-    void read(FILE * f,
-              TransitionTableIndex number_of_table_entries);
-    void read(char ** raw,
-              TransitionTableIndex number_of_table_entries);
-    void convert_to_big_endian(void);
+    char * data; //!< the table, or NULL if it is empty
+    bool borrowed; //!< whether data is owned by someone else
+    void set_columns(char * table, TableFormat format, bool swap);
+    void read(FILE * f, TableFormat format);
+    void read(char ** raw, bool borrow, TableFormat format,
+              const char * end);
 
 public:
     //!
     //! read index table from file @a f.
     IndexTable(FILE * f,
-               TransitionTableIndex number_of_table_entries);
+               TransitionTableIndex number_of_table_entries,
+               TableFormat format = ClassicTables);
     //!
-    //! read index table from raw data @a raw.
+    //! read index table from raw data @a raw. If @a borrow is set, a table
+    //! in host byte order is used in place and @a raw must outlive it. If
+    //! @a end is given, the table must end before it.
     IndexTable(char ** raw,
-               TransitionTableIndex number_of_table_entries);
+               TransitionTableIndex number_of_table_entries,
+               bool borrow = false,
+               TableFormat format = ClassicTables,
+               const char * end = NULL);
     ~IndexTable(void);
     //!
+    //! bytes taken by a table of @a entries entries in @a format
+    static size_t table_bytes(TransitionTableIndex entries,
+                              TableFormat format);
+    //!
+    //! number of entries
+    TransitionTableIndex get_size(void) const
+    {
+        return size;
+    }
+    //!
+    //! whether the table lives in memory it doesn't own
+    bool borrows_memory(void) const;
+    //!
+    //! write the table in the native format
+    void write_native(FILE * f) const;
+    //!
     //! input symbol for the index
-    SymbolNumber input_symbol(TransitionTableIndex i) const;
+    SymbolNumber input_symbol(TransitionTableIndex i) const
+    {
+        return (i < size) ? input_symbols[i] : NO_SYMBOL;
+    }
     //!
     //! target state location for the index
-    TransitionTableIndex target(TransitionTableIndex i) const;
+    TransitionTableIndex target(TransitionTableIndex i) const
+    {
+        return (i < size) ? targets[i] : NO_TABLE_INDEX;
+    }
     //!
     //! whether it's final transition
-    bool final(TransitionTableIndex i) const;
+    bool final(TransitionTableIndex i) const
+    {
+        return input_symbol(i) == NO_SYMBOL && target(i) != NO_TABLE_INDEX;
+    }
     //!
     //! transition's weight
-    Weight final_weight(TransitionTableIndex i) const;
+    Weight final_weight(TransitionTableIndex i) const
+    {
+        return (i < size) ? final_weights[i] : INFINITE_WEIGHT;
+    }
+    //!
+    //! whether the columns are native arrays, which have an entry past the
+    //! end with NO_SYMBOL as its symbol
+    bool has_arrays(void) const
+    {
+        return input_symbols.get_array() != NULL;
+    }
 };
 
 //! Internal class for transition processing.
 
-//! Contains low-level processing stuff.
+//! Contains low-level processing stuff. The columns are read where they lie
+//! in either format, and every accessor but the array_ ones is bounds
+//! checked, so scanning a state's transitions always stops at the end of
+//! the table.
 class TransitionTable
 {
 protected:
     //!
-    //! raw transition data
-    char * transitions;
+    //! transition data, one column per field
+    TableColumn<SymbolNumber> input_symbols;
+    TableColumn<SymbolNumber> output_symbols;
+    TableColumn<TransitionTableIndex> targets;
+    TableColumn<Weight> weights;
     TransitionTableIndex size;
+    char * data; //!< the table, or NULL if it is empty
+    bool borrowed; //!< whether data is owned by someone else
 
+    void set_columns(char * table, TableFormat format, bool swap);
     //!
     //! read known amount of transitions from file @a f
-    void read(FILE * f,
-              TransitionTableIndex number_of_table_entries);
+    void read(FILE * f, TableFormat format);
     //! read known amount of transitions from raw dara @a data
-    void read(char ** raw,
-              TransitionTableIndex number_of_table_entries);
-    void convert_to_big_endian(void);
+    void read(char ** raw, bool borrow, TableFormat format,
+              const char * end);
 public:
     //!
     //! read transition table from file @a f
     TransitionTable(FILE * f,
-                    TransitionTableIndex transition_count);
+                    TransitionTableIndex transition_count,
+                    TableFormat format = ClassicTables);
     //!
-    //! read transition table from raw data @a raw
+    //! read transition table from raw data @a raw. If @a borrow is set, a
+    //! table in host byte order is used in place and @a raw must outlive
+    //! it. If @a end is given, the table must end before it.
     TransitionTable(char ** raw,
-                    TransitionTableIndex transition_count);
+                    TransitionTableIndex transition_count,
+                    bool borrow = false,
+                    TableFormat format = ClassicTables,
+                    const char * end = NULL);
 
     ~TransitionTable(void);
     //!
+    //! bytes taken by a table of @a entries entries in @a format
+    static size_t table_bytes(TransitionTableIndex entries,
+                              TableFormat format);
+    //!
+    //! number of entries
+    TransitionTableIndex get_size(void) const
+    {
+        return size;
+    }
+    //!
+    //! whether the table lives in memory it doesn't own
+    bool borrows_memory(void) const;
+    //!
+    //! write the table in the native format
+    void write_native(FILE * f) const;
+    //!
     //! transition's input symbol
-    SymbolNumber input_symbol(TransitionTableIndex i) const;
+    SymbolNumber input_symbol(TransitionTableIndex i) const
+    {
+        return (i < size) ? input_symbols[i] : NO_SYMBOL;
+    }
     //!
     //! transition's output symbol
-    SymbolNumber output_symbol(TransitionTableIndex i) const;
+    SymbolNumber output_symbol(TransitionTableIndex i) const
+    {
+        return (i < size) ? output_symbols[i] : NO_SYMBOL;
+    }
     //!
     //! target node location
-    TransitionTableIndex target(TransitionTableIndex i) const;
+    TransitionTableIndex target(TransitionTableIndex i) const
+    {
+        return (i < size) ? targets[i] : NO_TABLE_INDEX;
+    }
     //!
     //! weight of transiton
-    Weight weight(TransitionTableIndex i) const;
+    Weight weight(TransitionTableIndex i) const
+    {
+        return (i < size) ? weights[i] : INFINITE_WEIGHT;
+    }
     //!
     //! whether it's final
-    bool final(TransitionTableIndex i) const;
-
-
+    bool final(TransitionTableIndex i) const
+    {
+        return input_symbol(i) == NO_SYMBOL &&
+            output_symbol(i) == NO_SYMBOL &&
+            target(i) == 1;
+    }
+    //!
+    //! whether the columns are native arrays, which have an entry past the
+    //! end with NO_SYMBOL as its symbols
+    bool has_arrays(void) const
+    {
+        return input_symbols.get_array() != NULL;
+    }
+    //!
+    //! the accessors above without the bounds check, for tables that
+    //! has_arrays() and @a i up to the size
+    SymbolNumber array_input_symbol(TransitionTableIndex i) const
+    {
+        return input_symbols.get_array()[i];
+    }
+    SymbolNumber array_output_symbol(TransitionTableIndex i) const
+    {
+        return output_symbols.get_array()[i];
+    }
+    TransitionTableIndex array_target(TransitionTableIndex i) const
+    {
+        return targets.get_array()[i];
+    }
+    Weight array_weight(TransitionTableIndex i) const
+    {
+        return weights.get_array()[i];
+    }
 };
 
+//! checksum of the automaton made of @a alphabet, @a indices and
+//! @a transitions, which is the same whichever format they were read from
+uint64_t transducer_checksum(const TransducerAlphabet & alphabet,
+                             const IndexTable & indices,
+                             const TransitionTable & transitions);
+
 template <class printable>
 void debug_print(printable p)
 {
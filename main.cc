@@ -50,6 +50,18 @@ static unsigned long suggs = 0;
 static hfst_ol::Weight max_weight = -1.0;
 static hfst_ol::Weight beam = -1.0;
 static float time_cutoff = 0.0;
+static unsigned long max_nodes = 0;
+static size_t max_frontier = 0;
+static bool best_first = false;
+static bool prune_visited = false;
+static size_t prefix_cache_length = 1;
+static size_t prefix_cache_budget = 0;
+static bool warm_up = false;
+static unsigned int warm_up_threads = 0;
+static unsigned int search_threads = 1;
+static unsigned long split_after = 1024;
+static std::string prefix_cache_filename = "";
+static size_t result_cache_size = 0;
 static std::string error_model_filename = "";
 static std::string lexicon_filename = "";
 #ifdef WINDOWS
@@ -57,6 +69,11 @@ static std::string lexicon_filename = "";
 #endif
 static bool suggest = false;
 static bool suggest_reals = false;
+static bool batch = false;
+//! corrections and whether they were cut short, for the word forms of the
+//! input corrected together with --batch
+static std::map<std::string, std::pair<hfst_ol::CorrectionQueue, bool> >
+    batch_corrections;
 
 #ifdef WINDOWS
 static std::string wide_string_to_string(const std::wstring & wstr)
@@ -132,8 +149,21 @@ bool print_usage(void)
     "  -w, --max-weight=W        Suppress corrections with weights above W\n" <<
     "  -b, --beam=W              Suppress corrections worse than best candidate by more than W\n" <<
     "  -t, --time-cutoff=T       Stop trying to find better corrections after T seconds (T is a float)\n" <<
+    "  -N, --max-nodes=N         Stop trying to find better corrections after N search steps\n" <<
+    "  -F, --max-frontier=N      Stop trying to find better corrections when N search states are waiting\n" <<
+    "  -B, --best-first          Search the best corrections first and stop when the limits are reached\n" <<
+    "  -P, --prune-visited       Skip search states already reached with less weight\n" <<
+    "  -T, --threads=N           Share long searches for corrections among N threads (0 for one per processor)\n" <<
+    "  -A, --split-after=N       Share a search among the threads after N search steps (default 1024)\n" <<
+    "  -p, --prefix-cache=N      Reuse search states after the first N input symbols (default 1)\n" <<
+    "  -M, --cache-memory=MB     Keep at most MB megabytes of cached search states\n" <<
+    "  -W, --warm-up=N           Cache the search states for every first symbol at start, in N threads (0 for one per processor)\n" <<
+    "  -c, --cache-file=FILE     Load cached search states from FILE at start and save them there at end\n" <<
+    "  -r, --result-cache=N      Remember the results for about N words (0 for none, the default)\n" <<
     "  -S, --suggest             Suggest corrections to mispellings\n" <<
     "  -X, --real-word           Also suggest corrections to correct words\n" <<
+    "  -x, --batch               Read all of the input first and correct its words together\n" <<
+    "                            (words share the search of long prefixes only with -w)\n" <<
     "  -m, --error-model         Use this error model (must also give lexicon as option)\n" <<
     "  -l, --lexicon             Use this lexicon (must also give erro model as option)\n" <<
 #ifdef WINDOWS
@@ -164,7 +194,25 @@ bool print_short_help(void)
 void
 do_suggest(ZHfstOspeller& speller, const std::string& str)
   {
-    hfst_ol::CorrectionQueue corrections = speller.suggest(str);
+    bool truncated;
+    hfst_ol::CorrectionQueue corrections;
+    std::map<std::string, std::pair<hfst_ol::CorrectionQueue, bool> >::
+        const_iterator batched = batch_corrections.find(str);
+    if (batched != batch_corrections.end())
+      {
+        corrections = batched->second.first;
+        truncated = batched->second.second;
+      }
+    else
+      {
+        corrections = speller.suggest(str, truncated);
+      }
+    if (truncated && verbose)
+      {
+        hfst_fprintf(stdout, "Search for corrections to \"%s\" was "
+                     "stopped by the time cutoff or the search budget\n",
+                     str.c_str());
+      }
     if (corrections.size() > 0) 
     {
         hfst_fprintf(stdout, "Corrections for \"%s\":\n", str.c_str());
@@ -273,6 +321,89 @@ do_spell(ZHfstOspeller& speller, const std::string& str)
       }
   }
 
+void
+do_spell_batch(ZHfstOspeller& speller, const std::vector<std::string>& strs)
+  {
+    // the corrections are searched all at once, and then printed as
+    // do_spell() would have one by one
+    std::vector<std::string> misspelt;
+    for (size_t i = 0; i < strs.size(); ++i)
+      {
+        if ((speller.spell(strs[i]) ? suggest_reals : suggest) &&
+            (batch_corrections.find(strs[i]) == batch_corrections.end()))
+          {
+            batch_corrections[strs[i]];
+            misspelt.push_back(strs[i]);
+          }
+      }
+    std::vector<bool> truncated;
+    std::vector<hfst_ol::CorrectionQueue> corrections =
+        speller.suggest_batch(misspelt, truncated);
+    for (size_t i = 0; i < misspelt.size(); ++i)
+      {
+        batch_corrections[misspelt[i]] =
+            std::make_pair(corrections[i], truncated[i]);
+      }
+    for (size_t i = 0; i < strs.size(); ++i)
+      {
+        do_spell(speller, strs[i]);
+      }
+    batch_corrections.clear();
+  }
+
+void
+prepare_prefix_cache(ZHfstOspeller& speller)
+  {
+    if (prefix_cache_filename != "")
+      {
+        if (speller.load_prefix_cache(prefix_cache_filename))
+          {
+            if (verbose)
+              {
+                hfst_fprintf(stdout, "Loaded prefix cache from %s\n",
+                             prefix_cache_filename.c_str());
+              }
+          }
+        else if (verbose)
+          {
+            hfst_fprintf(stdout, "No usable prefix cache in %s\n",
+                         prefix_cache_filename.c_str());
+          }
+      }
+    if (warm_up)
+      {
+        speller.warm_up_prefix_cache(warm_up_threads);
+      }
+  }
+
+void
+save_prefix_cache(ZHfstOspeller& speller)
+  {
+    if ((prefix_cache_filename != "") &&
+        !speller.save_prefix_cache(prefix_cache_filename))
+      {
+        hfst_fprintf(stderr, "Could not save prefix cache to %s\n",
+                     prefix_cache_filename.c_str());
+      }
+  }
+
+void
+print_prefix_cache_statistics(ZHfstOspeller& speller)
+  {
+    hfst_ol::PrefixCache::Statistics stats =
+        speller.get_prefix_cache_statistics();
+    hfst_fprintf(stdout, "Prefix cache: %lu entries in %lu bytes, "
+                 "%lu hits, %lu misses, %lu evictions\n",
+                 (unsigned long) stats.entries.size(),
+                 (unsigned long) stats.memory,
+                 stats.hits, stats.misses, stats.evictions);
+    hfst_ol::ResultCacheStatistics results =
+        speller.get_result_cache_statistics();
+    hfst_fprintf(stdout, "Result cache: %lu entries, %lu hits, %lu misses\n",
+                 (unsigned long) results.entries, results.hits,
+                 results.misses);
+  }
+
 int
 zhfst_spell(char* zhfst_filename)
 {
@@ -340,7 +471,21 @@ zhfst_spell(char* zhfst_filename)
   {
       hfst_fprintf(stdout, "Not trying to find better suggestions after %f seconds\n", time_cutoff);
   }
+  speller.set_search_budget(max_nodes, max_frontier);
+  if ((max_nodes > 0 || max_frontier > 0) && verbose)
+  {
+      hfst_fprintf(stdout, "Not trying to find better suggestions after %lu "
+                   "search steps or with %lu waiting\n",
+                   max_nodes, (unsigned long)max_frontier);
+  }
+  speller.set_best_first(best_first);
+  speller.set_prune_visited(prune_visited);
+  speller.set_search_threads(search_threads, split_after);
+  speller.set_prefix_cache(prefix_cache_length, prefix_cache_budget);
+  speller.set_result_cache(result_cache_size);
+  prepare_prefix_cache(speller);
   char * str = (char*) malloc(2000);
+  std::vector<std::string> strs;
 
 
 #ifdef WINDOWS
@@ -371,7 +516,23 @@ zhfst_spell(char* zhfst_filename)
             exit(1);
 #endif
           }
-        do_spell(speller, str);
+        if (batch)
+          {
+            strs.push_back(str);
+          }
+        else
+          {
+            do_spell(speller, str);
+          }
+      }
+    if (batch)
+      {
+        do_spell_batch(speller, strs);
+      }
+    save_prefix_cache(speller);
+    if (verbose)
+      {
+        print_prefix_cache_statistics(speller);
       }
     free(str);
     return EXIT_SUCCESS;
@@ -397,7 +558,17 @@ int
       {
           hfst_fprintf(stdout, "Not printing suggestions worse than best by margin %f\n", suggs);
       }
+      speller.set_time_cutoff(time_cutoff);
+      speller.set_search_budget(max_nodes, max_frontier);
+      speller.set_best_first(best_first);
+      speller.set_prune_visited(prune_visited);
+  speller.set_prune_visited(prune_visited);
+      speller.set_search_threads(search_threads, split_after);
+      speller.set_prefix_cache(prefix_cache_length, prefix_cache_budget);
+      speller.set_result_cache(result_cache_size);
+      prepare_prefix_cache(speller);
       char * str = (char*) malloc(2000);
+      std::vector<std::string> strs;
       
 #ifdef WINDOWS
     SetConsoleCP(65001);
@@ -427,8 +598,24 @@ int
             exit(1);
 #endif
           }
-        do_spell(speller, str);
+        if (batch)
+          {
+            strs.push_back(str);
+          }
+        else
+          {
+            do_spell(speller, str);
+          }
     }
+    if (batch)
+      {
+        do_spell_batch(speller, strs);
+      }
+    save_prefix_cache(speller);
+    if (verbose)
+      {
+        print_prefix_cache_statistics(speller);
+      }
     free(str);
     return EXIT_SUCCESS;
 }
@@ -455,7 +642,19 @@ int main(int argc, char **argv)
             {"beam",         required_argument, 0, 'b'},
             {"suggest",      no_argument,       0, 'S'},
             {"time-cutoff",  required_argument, 0, 't'},
+            {"max-nodes",    required_argument, 0, 'N'},
+            {"max-frontier", required_argument, 0, 'F'},
+            {"best-first",   no_argument,       0, 'B'},
+            {"prune-visited", no_argument,      0, 'P'},
+            {"threads",      required_argument, 0, 'T'},
+            {"split-after",  required_argument, 0, 'A'},
+            {"prefix-cache", required_argument, 0, 'p'},
+            {"cache-memory", required_argument, 0, 'M'},
+            {"warm-up",      required_argument, 0, 'W'},
+            {"cache-file",   required_argument, 0, 'c'},
+            {"result-cache", required_argument, 0, 'r'},
             {"real-word",    no_argument,       0, 'X'},
+            {"batch",        no_argument,       0, 'x'},
             {"error-model",  required_argument, 0, 'm'},
             {"lexicon",      required_argument, 0, 'l'},
 #ifdef WINDOWS
@@ -465,7 +664,7 @@ int main(int argc, char **argv)
             };
           
         int option_index = 0;
-        c = getopt_long(argc, argv, "hVvqsan:w:b:t:SXm:l:k", long_options, &option_index);
+        c = getopt_long(argc, argv, "hVvqsan:w:b:t:N:F:BPT:A:p:M:W:c:r:SXxm:l:k", long_options, &option_index);
         char* endptr = 0;
 
         if (c == -1) // no more options to look at
@@ -546,6 +745,112 @@ int main(int argc, char **argv)
               }
 
             break;
+        case 'N':
+            max_nodes = strtoul(optarg, &endptr, 10);
+            if (endptr == optarg)
+              {
+                fprintf(stderr, "%s not a strtoul number\n", optarg);
+                exit(1);
+              }
+            else if (*endptr != '\0')
+              {
+                fprintf(stderr, "%s truncated from max nodes parameter\n", endptr);
+              }
+            break;
+        case 'F':
+            max_frontier = strtoul(optarg, &endptr, 10);
+            if (endptr == optarg)
+              {
+                fprintf(stderr, "%s not a strtoul number\n", optarg);
+                exit(1);
+              }
+            else if (*endptr != '\0')
+              {
+                fprintf(stderr, "%s truncated from max frontier parameter\n", endptr);
+              }
+            break;
+        case 'B':
+            best_first = true;
+            break;
+        case 'P':
+            prune_visited = true;
+            break;
+        case 'T':
+            search_threads = strtoul(optarg, &endptr, 10);
+            if (endptr == optarg)
+              {
+                fprintf(stderr, "%s not a strtoul number\n", optarg);
+                exit(1);
+              }
+            else if (*endptr != '\0')
+              {
+                fprintf(stderr, "%s truncated from threads parameter\n", endptr);
+              }
+            break;
+        case 'A':
+            split_after = strtoul(optarg, &endptr, 10);
+            if (endptr == optarg)
+              {
+                fprintf(stderr, "%s not a strtoul number\n", optarg);
+                exit(1);
+              }
+            else if (*endptr != '\0')
+              {
+                fprintf(stderr, "%s truncated from split-after parameter\n", endptr);
+              }
+            break;
+        case 'p':
+            prefix_cache_length = strtoul(optarg, &endptr, 10);
+            if (endptr == optarg)
+              {
+                fprintf(stderr, "%s not a strtoul number\n", optarg);
+                exit(1);
+              }
+            else if (*endptr != '\0')
+              {
+                fprintf(stderr, "%s truncated from prefix cache parameter\n", endptr);
+              }
+            break;
+        case 'M':
+            prefix_cache_budget = strtoul(optarg, &endptr, 10) * 1024 * 1024;
+            if (endptr == optarg)
+              {
+                fprintf(stderr, "%s not a strtoul number\n", optarg);
+                exit(1);
+              }
+            else if (*endptr != '\0')
+              {
+                fprintf(stderr, "%s truncated from cache memory parameter\n", endptr);
+              }
+            break;
+        case 'W':
+            warm_up = true;
+            warm_up_threads = strtoul(optarg, &endptr, 10);
+            if (endptr == optarg)
+              {
+                fprintf(stderr, "%s not a strtoul number\n", optarg);
+                exit(1);
+              }
+            else if (*endptr != '\0')
+              {
+                fprintf(stderr, "%s truncated from warm-up parameter\n", endptr);
+              }
+            break;
+        case 'c':
+            prefix_cache_filename = optarg;
+            break;
+        case 'r':
+            result_cache_size = strtoul(optarg, &endptr, 10);
+            if (endptr == optarg)
+              {
+                fprintf(stderr, "%s not a strtoul number\n", optarg);
+                exit(1);
+              }
+            else if (*endptr != '\0')
+              {
+                fprintf(stderr, "%s truncated from result cache parameter\n", endptr);
+              }
+            break;
 #ifdef WINDOWS
         case 'k':
             output_to_console = true;
@@ -557,6 +862,9 @@ int main(int argc, char **argv)
         case 'X':
             suggest_reals = true;
             break;
+        case 'x':
+            batch = true;
+            break;
         case 'm':
             error_model_filename = optarg;
             break;
@@ -598,8 +906,19 @@ int main(int argc, char **argv)
               print_short_help();
               return EXIT_FAILURE;
           }
-          FILE * err_file = fopen(error_model_filename.c_str(), "r");
-          FILE * lex_file = fopen(lexicon_filename.c_str(), "r");
+          hfst_ol::MappedFile * err_file = NULL;
+          hfst_ol::MappedFile * lex_file = NULL;
+          try
+            {
+              err_file = new hfst_ol::MappedFile(error_model_filename);
+              lex_file = new hfst_ol::MappedFile(lexicon_filename);
+            }
+          catch (const hfst_ol::FileMappingException & fme)
+            {
+              std::cerr << fme.name << std::endl;
+              delete err_file;
+              return EXIT_FAILURE;
+            }
           hfst_ol::Transducer err(err_file);
           hfst_ol::Transducer lex(lex_file);
           hfst_ol::Speller * s = new hfst_ol::Speller(&err, &lex);
@@ -35,7 +35,6 @@
 #include <vector>
 #include <string>
 #include <algorithm>
-#include <map>
 #include <sstream>
 #include <stdexcept>
 #include <cmath>
@@ -54,9 +53,6 @@
 using hfst_ol::ZHfstOspeller;
 using hfst_ol::Transducer;
 
-typedef std::map<UnicodeString,bool> valid_words_t;
-valid_words_t valid_words;
-
 struct word_t {
 	size_t start, count;
 	UnicodeString buffer;
@@ -67,6 +63,7 @@ UnicodeString ubuffer, uc_buffer;
 size_t cw;
 
 bool verbatim = false;
+bool shared_cache = false;
 bool uc_first = false;
 bool uc_all = true;
 
@@ -115,7 +112,7 @@ bool find_alternatives(ZHfstOspeller& speller, size_t suggs) {
 	return false;
 }
 
-bool is_valid_word(ZHfstOspeller& speller, const std::string& word, size_t suggs) {
+bool is_valid_word(ZHfstOspeller& speller, const std::string& word) {
 	ubuffer.setTo(UnicodeString::fromUTF8(word));
 
 	if (word.size() == 13 && word[5] == 'D' && word == "nuvviDspeller") {
@@ -197,73 +194,49 @@ bool is_valid_word(ZHfstOspeller& speller, const std::string& word, size_t suggs
 		}
 	}
 
+	// The speller remembers the words it has checked, so checking the same
+	// variants again is cheap
 	for (size_t i=0, e=cw ; i<e ; ++i) {
-		// If we are looking for suggestions, don't use the cache
-		valid_words_t::iterator it = suggs ? valid_words.end() : valid_words.find(words[i].buffer);
+		buffer.clear();
+		words[i].buffer.toUTF8String(buffer);
+		bool valid = speller.spell(buffer);
 
-		if (it == valid_words.end()) {
+		if (!valid && !verbatim) {
+			// If the word was not valid, fold it to lower case and try again
 			buffer.clear();
-			words[i].buffer.toUTF8String(buffer);
-			bool valid = speller.spell(buffer);
-			it = valid_words.insert(std::make_pair(words[i].buffer,valid)).first;
-
-			if (!valid && !verbatim) {
-				// If the word was not valid, fold it to lower case and try again
-				buffer.clear();
-				ubuffer = words[i].buffer;
-				ubuffer.toLower();
-				ubuffer.toUTF8String(buffer);
+			ubuffer = words[i].buffer;
+			ubuffer.toLower();
+			ubuffer.toUTF8String(buffer);
+
+			// Add the lower case variant to the list so that we get suggestions using that, if need be
+			words[cw].start = words[i].start;
+			words[cw].count = words[i].count;
+			words[cw].buffer = ubuffer;
+			++cw;
 
-				// Add the lower case variant to the list so that we get suggestions using that, if need be
-				words[cw].start = words[i].start;
-				words[cw].count = words[i].count;
-				words[cw].buffer = ubuffer;
-				++cw;
-
-				// Don't try again if the lower cased variant has already been tried
-				valid_words_t::iterator itl = suggs ? valid_words.end() : valid_words.find(ubuffer);
-				if (itl != valid_words.end()) {
-					it->second = itl->second;
-					it = itl;
-				}
-				else {
-					valid = speller.spell(buffer);
-					it->second = valid; // Also mark the original mixed case variant as whatever the lower cased one was
-					it = valid_words.insert(std::make_pair(words[i].buffer,valid)).first;
-				}
-			}
+			valid = speller.spell(buffer);
+		}
 
-			if (!valid && !verbatim && (uc_all || uc_first)) {
-				// If the word was still not valid but had upper case, try a first-upper variant
-				buffer.clear();
-				ubuffer.setTo(words[i].buffer, 0, 1);
-				ubuffer.toUpper();
-				uc_buffer.setTo(words[i].buffer, 1);
-				uc_buffer.toLower();
-				ubuffer.append(uc_buffer);
-				ubuffer.toUTF8String(buffer);
+		if (!valid && !verbatim && (uc_all || uc_first)) {
+			// If the word was still not valid but had upper case, try a first-upper variant
+			buffer.clear();
+			ubuffer.setTo(words[i].buffer, 0, 1);
+			ubuffer.toUpper();
+			uc_buffer.setTo(words[i].buffer, 1);
+			uc_buffer.toLower();
+			ubuffer.append(uc_buffer);
+			ubuffer.toUTF8String(buffer);
+
+			// Add the first-upper variant to the list so that we get suggestions using that, if need be
+			words[cw].start = words[i].start;
+			words[cw].count = words[i].count;
+			words[cw].buffer = ubuffer;
+			++cw;
 
-				// Add the first-upper variant to the list so that we get suggestions using that, if need be
-				words[cw].start = words[i].start;
-				words[cw].count = words[i].count;
-				words[cw].buffer = ubuffer;
-				++cw;
-
-				// Don't try again if the first-upper variant has already been tried
-				valid_words_t::iterator itl = suggs ? valid_words.end() : valid_words.find(ubuffer);
-				if (itl != valid_words.end()) {
-					it->second = itl->second;
-					it = itl;
-				}
-				else {
-					valid = speller.spell(buffer);
-					it->second = valid; // Also mark the original mixed case variant as whatever the first-upper one was
-					it = valid_words.insert(std::make_pair(words[i].buffer,valid)).first;
-				}
-			}
+			valid = speller.spell(buffer);
 		}
 
-		if (it->second == true) {
+		if (valid) {
 			return true;
 		}
 	}
@@ -274,6 +247,7 @@ bool is_valid_word(ZHfstOspeller& speller, const std::string& word, size_t suggs
 int zhfst_spell(const char* zhfst_filename) {
 	ZHfstOspeller speller;
 	try {
+		speller.set_shared_cache(shared_cache);
 		speller.read_zhfst(zhfst_filename);
 		speller.set_time_cutoff(6.0);
 	}
@@ -302,11 +276,6 @@ int zhfst_spell(const char* zhfst_filename) {
 		if (line.empty()) {
 			continue;
 		}
-		// Just in case anyone decides to use the speller for a minor eternity
-		if (valid_words.size() > 20480) {
-			valid_words.clear();
-		}
-
 		ss.clear();
 		ss.str(line);
 		size_t suggs = 0;
@@ -316,7 +285,7 @@ int zhfst_spell(const char* zhfst_filename) {
 			continue;
 		}
 
-		if (is_valid_word(speller, line, suggs)) {
+		if (is_valid_word(speller, line)) {
 			std::cout << "*" << std::endl;
 			continue;
 		}
@@ -345,6 +314,10 @@ int main(int argc, char **argv) {
 			verbatim = true;
 			it = args.erase(it);
 		}
+		else if (*it == "--shared-cache") {
+			shared_cache = true;
+			it = args.erase(it);
+		}
 		else {
 			++it;
 		}
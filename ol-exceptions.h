@@ -81,5 +81,9 @@ HFST_EXCEPTION_CHILD_DECLARATION(TransitionTableReadingException);
 HFST_EXCEPTION_CHILD_DECLARATION(UnweightedSpellerException);
 
 HFST_EXCEPTION_CHILD_DECLARATION(TransducerTypeException);
+
+HFST_EXCEPTION_CHILD_DECLARATION(FileMappingException);
+
+HFST_EXCEPTION_CHILD_DECLARATION(TransducerWritingException);
 } // namespace
 #endif // _OL_EXCEPTIONS_H
@@ -16,86 +16,1361 @@
 #  include <config.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#if HAVE_MKSTEMP
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
 #include "ospell.h"
 
 namespace hfst_ol {
 
-int nByte_utf8(unsigned char c)
+int nByte_utf8(unsigned char c)
+{
+    /* utility function to determine how many bytes to peel off as
+       a utf-8 character for representing as unknown symbol */
+    if (c <= 127) {
+        return 1;
+    } else if ( (c & (128 + 64 + 32 + 16)) == (128 + 64 + 32 + 16) ) {
+        return 4;
+    } else if ( (c & (128 + 64 + 32 )) == (128 + 64 + 32) ) {
+        return 3;
+    } else if ( (c & (128 + 64 )) == (128 + 64)) {
+        return 2;
+    } else {
+        return 0;
+    }
+}
+
+void WeightQueue::push(Weight w)
+{
+    heap.push_back(w);
+    std::push_heap(heap.begin(), heap.end());
+    lowest = std::min(lowest, w);
+}
+
+void WeightQueue::pop(void)
+{
+    std::pop_heap(heap.begin(), heap.end());
+    heap.pop_back();
+    // the lowest weight only goes with the last one
+    if (heap.empty()) {
+        lowest = std::numeric_limits<Weight>::max();
+    }
+}
+
+void WeightQueue::replace(Weight old_w, Weight new_w)
+{
+    std::vector<Weight>::iterator found =
+        std::find(heap.begin(), heap.end(), old_w);
+    if (found == heap.end()) {
+        push(new_w);
+        return;
+    }
+    *found = new_w;
+    std::make_heap(heap.begin(), heap.end());
+    lowest = std::min(lowest, new_w);
+}
+
+void WeightQueue::clear(void)
+{
+    heap.clear();
+    lowest = std::numeric_limits<Weight>::max();
+}
+
+void WeightQueue::reserve(size_t capacity)
+{
+    heap.reserve(capacity);
+}
+
+Transducer::Transducer(FILE* f):
+    header(TransducerHeader(f)),
+    alphabet(TransducerAlphabet(f, header.symbol_count())),
+    keys(alphabet.get_key_table()),
+    encoder(keys,header.input_symbol_count()),
+    mapping(NULL),
+    distances_ready(false),
+    checksum(0),
+    properties_ready(false),
+    indices(f,header.index_table_size(), header.get_table_format()),
+    transitions(f,header.target_table_size(), header.get_table_format())
+{
+    unchecked_arrays = check_arrays();
+}
+
+Transducer::Transducer(char* raw):
+    Transducer(raw, false, NULL)
+{}
+
+Transducer::Transducer(char* raw, bool borrow_tables):
+    Transducer(raw, borrow_tables, NULL)
+{}
+
+Transducer::Transducer(char* raw, bool borrow_tables, const char* end):
+    header(TransducerHeader(&raw, end)),
+    alphabet(TransducerAlphabet(&raw, header.symbol_count(), end)),
+    keys(alphabet.get_key_table()),
+    encoder(keys,header.input_symbol_count()),
+    mapping(NULL),
+    distances_ready(false),
+    checksum(0),
+    properties_ready(false),
+    indices(&raw,header.index_table_size(), borrow_tables,
+            header.get_table_format(), end),
+    transitions(&raw,header.target_table_size(), borrow_tables,
+                header.get_table_format(), end)
+{
+    unchecked_arrays = check_arrays();
+}
+
+Transducer::Transducer(MappedFile* file)
+try:
+    Transducer(file->get_data(), true, file->get_data() + file->get_size())
+{
+    if (indices.borrows_memory() || transitions.borrows_memory()) {
+        mapping = file;
+    } else {
+        // tables in the other byte order were swapped into memory of their own
+        delete file;
+    }
+}
+catch (...)
+{
+    delete file;
+}
+
+Transducer::~Transducer()
+{
+    // borrowed tables don't touch their memory when they are destroyed
+    delete mapping;
+}
+
+bool
+Transducer::check_arrays() const
+{
+    if (!indices.has_arrays() || !transitions.has_arrays()) {
+        return false;
+    }
+    TransitionTableIndex index_count = indices.get_size();
+    TransitionTableIndex transition_count = transitions.get_size();
+    // the scans of take_found_non_epsilons() stop at the entry past the end
+    if (transitions.array_input_symbol(transition_count) != NO_SYMBOL) {
+        return false;
+    }
+    // next() starts them at an index table target, which has_transitions()
+    // has found to be on the symbol, or right after a transition target
+    for (TransitionTableIndex i = 0; i < index_count; ++i) {
+        TransitionTableIndex target = indices.target(i);
+        if (indices.input_symbol(i) != NO_SYMBOL &&
+            (target < TARGET_TABLE ||
+             target - TARGET_TABLE >= transition_count)) {
+            return false;
+        }
+    }
+    for (TransitionTableIndex i = 0; i < transition_count; ++i) {
+        TransitionTableIndex target = transitions.array_target(i);
+        if (transitions.array_input_symbol(i) != NO_SYMBOL &&
+            target >= TARGET_TABLE &&
+            target - TARGET_TABLE >= transition_count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void
+Transducer::scan_tables() const
+{
+    TransitionTableIndex index_count = header.index_table_size();
+    TransitionTableIndex transition_count = header.target_table_size();
+    negative_weights = false;
+    input_deterministic = true;
+    for (TransitionTableIndex i = 0; i < index_count; ++i) {
+        if (indices.final(i) && indices.final_weight(i) < 0.0) {
+            negative_weights = true;
+        }
+    }
+    for (TransitionTableIndex i = 0; i < transition_count; ++i) {
+        SymbolNumber symbol = transitions.input_symbol(i);
+        if ((transitions.final(i) || symbol != NO_SYMBOL) &&
+            transitions.weight(i) < 0.0) {
+            negative_weights = true;
+        }
+        if (symbol == 0) {
+            input_deterministic = false;
+        } else if (symbol != NO_SYMBOL && i > 0 &&
+                   transitions.input_symbol(i - 1) == symbol) {
+            // the transitions with the same symbol are next to each other
+            input_deterministic = false;
+        }
+    }
+}
+
+void
+Transducer::compute_state_properties() const
+{
+    std::call_once(properties_computed, &Transducer::find_state_properties,
+                   this);
+}
+
+// sets the bit of @a position in @a bits
+static inline void
+set_state_bit(std::vector<uint64_t> & bits, size_t position)
+{
+    bits[position >> 6] |= static_cast<uint64_t>(1) << (position & 63);
+}
+
+void
+Transducer::find_state_properties() const
+{
+    TransitionTableIndex index_count = indices.get_size();
+    TransitionTableIndex transition_count = transitions.get_size();
+    SymbolNumber symbol_count = static_cast<SymbolNumber>(keys->size());
+    // both tables with the entry past their end, and one for outside them
+    size_t position_count = static_cast<size_t>(index_count) +
+        transition_count + 3;
+    for (int p = 0; p < STATE_PROPERTY_COUNT; ++p) {
+        state_bits[p].assign((position_count + 63) / 64, 0);
+    }
+    final_weights.assign(position_count, INFINITE_WEIGHT);
+    for (TransitionTableIndex i = 0; i <= index_count; ++i) {
+        SymbolNumber symbol = indices.input_symbol(i);
+        if (indices.final(i)) {
+            set_state_bit(state_bits[StateIsFinal], i);
+            final_weights[i] = indices.final_weight(i);
+        }
+        if (symbol == 0) {
+            // flags are indexed as epsilons, so look for them among the
+            // transitions the entry leads to
+            set_state_bit(state_bits[StateHasEpsilons], i);
+            for (TransitionTableIndex k = indices.target(i) - TARGET_TABLE;
+                 k < transition_count &&
+                     (transitions.input_symbol(k) == 0 ||
+                      is_flag(transitions.input_symbol(k)));
+                 ++k) {
+                if (transitions.input_symbol(k) != 0) {
+                    set_state_bit(state_bits[StateHasFlags], i);
+                    break;
+                }
+            }
+        } else if (symbol != NO_SYMBOL && symbol < symbol_count &&
+                   symbol <= i) {
+            // an entry for symbol n belongs to the state n places before it
+            set_state_bit(state_bits[StateHasNonEpsilons], i - symbol);
+        }
+    }
+    for (TransitionTableIndex k = 0; k <= transition_count; ++k) {
+        size_t position = static_cast<size_t>(index_count) + 1 + k;
+        SymbolNumber symbol = transitions.input_symbol(k);
+        if (transitions.final(k)) {
+            set_state_bit(state_bits[StateIsFinal], position);
+            final_weights[position] = transitions.weight(k);
+        }
+        if (symbol == 0) {
+            set_state_bit(state_bits[StateHasEpsilons], position);
+        } else if (symbol != NO_SYMBOL && is_flag(symbol)) {
+            set_state_bit(state_bits[StateHasFlags], position);
+        } else if (symbol != NO_SYMBOL) {
+            set_state_bit(state_bits[StateHasNonEpsilons], position);
+        }
+    }
+    properties_ready.store(true, std::memory_order_release);
+}
+
+void
+Transducer::compute_distances_to_final() const
+{
+    std::call_once(distances_computed, &Transducer::find_distances_to_final,
+                   this);
+}
+
+void
+Transducer::find_distances_to_final() const
+{
+    TransitionTableIndex index_count = header.index_table_size();
+    TransitionTableIndex transition_count = header.target_table_size();
+    if (has_negative_weights()) {
+        // shortest distances don't work with negative weights, so these
+        // stay at 0.0, which is what the search assumed before it knew any
+        // better
+        return;
+    }
+    /*
+      Index table positions are numbered as they are, and transition table
+      position k as index_count + 1 + k. Collect every arc backwards, and
+      find the distances from the final states by Dijkstra's algorithm.
+    */
+    const TransitionTableIndex node_count = index_count + transition_count + 2;
+    SymbolNumber symbol_count = static_cast<SymbolNumber>(keys->size());
+    std::vector<TransitionTableIndex> arc_sources;
+    std::vector<TransitionTableIndex> arc_targets;
+    std::vector<Weight> arc_weights;
+    for (TransitionTableIndex i = 0; i <= index_count; ++i) {
+        SymbolNumber symbol = indices.input_symbol(i);
+        if (symbol == NO_SYMBOL || symbol >= symbol_count || symbol >= i) {
+            continue;
+        }
+        // the transitions of state i - symbol - 1 with symbol start here,
+        // with the flags among the epsilons
+        for (TransitionTableIndex k = indices.target(i) - TARGET_TABLE;
+             (symbol == 0) ? has_epsilons_or_flags(k + TARGET_TABLE) :
+                 transitions.input_symbol(k) == symbol;
+             ++k) {
+            arc_sources.push_back(i - symbol - 1);
+            arc_targets.push_back(transitions.target(k));
+            arc_weights.push_back(transitions.weight(k));
+        }
+    }
+    TransitionTableIndex state = NO_TABLE_INDEX;
+    for (TransitionTableIndex k = 0; k <= transition_count; ++k) {
+        if (transitions.input_symbol(k) == NO_SYMBOL) {
+            // a state in the transition table starts with its final entry
+            state = index_count + 1 + k;
+        } else if (state != NO_TABLE_INDEX) {
+            arc_sources.push_back(state);
+            arc_targets.push_back(transitions.target(k));
+            arc_weights.push_back(transitions.weight(k));
+        }
+    }
+    // group the arcs by their target node
+    std::vector<TransitionTableIndex> first_arc(node_count + 1, 0);
+    for (size_t a = 0; a < arc_targets.size(); ++a) {
+        TransitionTableIndex target = arc_targets[a];
+        if (target >= TARGET_TABLE &&
+            target - TARGET_TABLE <= transition_count) {
+            target = index_count + 1 + (target - TARGET_TABLE);
+        } else if (target > index_count) {
+            // arcs out of the tables lead nowhere
+            arc_targets[a] = NO_TABLE_INDEX;
+            continue;
+        }
+        arc_targets[a] = target;
+        ++first_arc[target + 1];
+    }
+    for (TransitionTableIndex n = 0; n < node_count; ++n) {
+        first_arc[n + 1] += first_arc[n];
+    }
+    std::vector<TransitionTableIndex> incoming(arc_targets.size());
+    {
+        std::vector<TransitionTableIndex> next_arc(first_arc.begin(),
+                                                   first_arc.end() - 1);
+        for (size_t a = 0; a < arc_targets.size(); ++a) {
+            if (arc_targets[a] != NO_TABLE_INDEX) {
+                incoming[next_arc[arc_targets[a]]++] = a;
+            }
+        }
+    }
+    std::vector<Weight> distances(node_count,
+                                  std::numeric_limits<Weight>::infinity());
+    typedef std::pair<Weight, TransitionTableIndex> Distance;
+    std::priority_queue<Distance, std::vector<Distance>,
+                        std::greater<Distance> > closest;
+    for (TransitionTableIndex i = 0; i <= index_count; ++i) {
+        if (indices.final(i)) {
+            distances[i] = indices.final_weight(i);
+            closest.push(Distance(distances[i], i));
+        }
+    }
+    for (TransitionTableIndex k = 0; k <= transition_count; ++k) {
+        if (transitions.final(k)) {
+            distances[index_count + 1 + k] = transitions.weight(k);
+            closest.push(Distance(transitions.weight(k), index_count + 1 + k));
+        }
+    }
+    while (!closest.empty()) {
+        Distance d = closest.top();
+        closest.pop();
+        if (d.first > distances[d.second]) {
+            continue; // already found a shorter one
+        }
+        for (TransitionTableIndex a = first_arc[d.second];
+             a < first_arc[d.second + 1]; ++a) {
+            TransitionTableIndex source = arc_sources[incoming[a]];
+            Weight through = d.first + arc_weights[incoming[a]];
+            if (through < distances[source]) {
+                distances[source] = through;
+                closest.push(Distance(through, source));
+            }
+        }
+    }
+    index_distances.assign(distances.begin(),
+                           distances.begin() + index_count + 1);
+    transition_distances.assign(distances.begin() + index_count + 1,
+                                distances.end());
+    distances_ready.store(true, std::memory_order_release);
+}
+
+void MutatorBounds::set_mutator(Transducer * mutator_ptr)
+{
+    mutator = mutator_ptr;
+    index_count = mutator->index_table_size();
+    TransitionTableIndex transition_count = mutator->transition_table_size();
+    numbers.assign(index_count + transition_count + 2, NO_TABLE_INDEX);
+    states.clear();
+    // number the states reachable from the start by any arc
+    std::vector<TransitionTableIndex> arc_sources;
+    std::vector<TransitionTableIndex> arc_targets;
+    std::vector<Weight> arc_weights;
+    SymbolNumber symbol_count =
+        static_cast<SymbolNumber>(mutator->get_key_table()->size());
+    numbers[0] = 0;
+    states.push_back(0);
+    for (TransitionTableIndex n = 0; n < states.size(); ++n) {
+        TransitionTableIndex state = states[n];
+        std::vector<TransitionTableIndex> arcs;
+        if (state >= TARGET_TABLE) {
+            for (TransitionTableIndex k = state - TARGET_TABLE + 1;
+                 mutator->transitions.input_symbol(k) != NO_SYMBOL; ++k) {
+                arcs.push_back(k);
+            }
+        } else {
+            for (SymbolNumber symbol = 0; symbol < symbol_count; ++symbol) {
+                if (state + 1 + symbol > index_count ||
+                    mutator->indices.input_symbol(state + 1 + symbol) !=
+                    symbol) {
+                    continue;
+                }
+                for (TransitionTableIndex k =
+                         mutator->indices.target(state + 1 + symbol) -
+                         TARGET_TABLE;
+                     mutator->transitions.input_symbol(k) == symbol;
+                     ++k) {
+                    arcs.push_back(k);
+                }
+            }
+        }
+        for (size_t a = 0; a < arcs.size(); ++a) {
+            TransitionTableIndex target = mutator->transitions.target(arcs[a]);
+            if ((target >= TARGET_TABLE) ?
+                (target - TARGET_TABLE > transition_count) :
+                (target > index_count)) {
+                continue; // arcs out of the tables lead nowhere
+            }
+            TransitionTableIndex & target_number = (target >= TARGET_TABLE) ?
+                numbers[index_count + 1 + (target - TARGET_TABLE)] :
+                numbers[target];
+            if (target_number == NO_TABLE_INDEX) {
+                target_number = states.size();
+                states.push_back(target);
+            }
+            if (mutator->transitions.input_symbol(arcs[a]) == 0) {
+                arc_sources.push_back(n);
+                arc_targets.push_back(target_number);
+                arc_weights.push_back(mutator->transitions.weight(arcs[a]));
+            }
+        }
+    }
+    // group the epsilon arcs by their target
+    first_incoming.assign(states.size() + 1, 0);
+    for (size_t a = 0; a < arc_targets.size(); ++a) {
+        ++first_incoming[arc_targets[a] + 1];
+    }
+    for (TransitionTableIndex n = 0; n < states.size(); ++n) {
+        first_incoming[n + 1] += first_incoming[n];
+    }
+    incoming_sources.resize(arc_targets.size());
+    incoming_weights.resize(arc_targets.size());
+    std::vector<TransitionTableIndex> next_arc(first_incoming.begin(),
+                                               first_incoming.end() - 1);
+    for (size_t a = 0; a < arc_targets.size(); ++a) {
+        TransitionTableIndex i = next_arc[arc_targets[a]]++;
+        incoming_sources[i] = arc_sources[a];
+        incoming_weights[i] = arc_weights[a];
+    }
+}
+
+Weight MutatorBounds::consume_bound(TransitionTableIndex state,
+                                    SymbolNumber symbol,
+                                    const Weight * next_bounds) const
+{
+    /* the arcs Speller::consume_input() would take, and the least weight
+       of going on from them
+     */
+    SymbolNumber consumed[2] = {symbol, NO_SYMBOL};
+    if (!mutator->has_transitions(state + 1, symbol)) {
+        consumed[0] = NO_SYMBOL;
+        if (symbol >= mutator->get_alphabet()->get_orig_symbol_count()) {
+            consumed[0] = mutator->get_identity();
+            consumed[1] = mutator->get_unknown();
+        }
+    }
+    Weight least = std::numeric_limits<Weight>::infinity();
+    for (int c = 0; c < 2; ++c) {
+        if (!mutator->has_transitions(state + 1, consumed[c])) {
+            continue;
+        }
+        TransitionTableIndex next_m = mutator->next(state, consumed[c]);
+        STransition i_s = mutator->take_non_epsilons(next_m, consumed[c]);
+        while (i_s.symbol != NO_SYMBOL) {
+            least = std::min(least, i_s.weight + next_bounds[number(i_s.index)]);
+            ++next_m;
+            i_s = mutator->take_non_epsilons(next_m, consumed[c]);
+        }
+    }
+    return least;
+}
+
+void MutatorBounds::compute(const SymbolVector & input,
+                            std::vector<Weight> & bounds) const
+{
+    bounds.clear();
+    if (mutator == NULL || mutator->has_negative_weights()) {
+        return;
+    }
+    TransitionTableIndex state_count = states.size();
+    bounds.resize((input.size() + 1) * state_count);
+    typedef std::pair<Weight, TransitionTableIndex> Distance;
+    std::priority_queue<Distance, std::vector<Distance>,
+                        std::greater<Distance> > closest;
+    for (size_t p = input.size() + 1; p-- > 0; ) {
+        Weight * here = &bounds[p * state_count];
+        // first by consuming the input at p, or by stopping at the end
+        for (TransitionTableIndex n = 0; n < state_count; ++n) {
+            if (p == input.size()) {
+                here[n] = mutator->is_final(states[n]) ?
+                    mutator->final_weight(states[n]) :
+                    std::numeric_limits<Weight>::infinity();
+            } else {
+                here[n] = consume_bound(states[n], input[p],
+                                        here + state_count);
+            }
+            if (here[n] < std::numeric_limits<Weight>::infinity()) {
+                closest.push(Distance(here[n], n));
+            }
+        }
+        // then by epsilons before that
+        while (!closest.empty()) {
+            Distance d = closest.top();
+            closest.pop();
+            if (d.first > here[d.second]) {
+                continue;
+            }
+            for (TransitionTableIndex a = first_incoming[d.second];
+                 a < first_incoming[d.second + 1]; ++a) {
+                Weight through = d.first + incoming_weights[a];
+                if (through < here[incoming_sources[a]]) {
+                    here[incoming_sources[a]] = through;
+                    closest.push(Distance(through, incoming_sources[a]));
+                }
+            }
+        }
+    }
+}
+
+// a power of two of room for @a used entries at most half full, or more
+// if the table already has that, unless that is much more
+static size_t
+table_size(size_t current, size_t used)
+{
+    size_t wanted = 64;
+    while (wanted < used * 2) {
+        wanted *= 2;
+    }
+    if (current >= wanted && current <= wanted * 4) {
+        return current;
+    }
+    return wanted;
+}
+
+// Cache files are made of values and arrays in the byte order and layout
+// of the machine, like the native tables. Reading stops with false rather
+// than going past the end.
+static void
+append_bytes(std::vector<char> & out, const void * bytes, size_t size)
+{
+    const char * begin = static_cast<const char *>(bytes);
+    out.insert(out.end(), begin, begin + size);
+}
+
+template<typename T>
+static void
+append_value(std::vector<char> & out, const T & value)
+{
+    append_bytes(out, &value, sizeof(T));
+}
+
+template<typename T>
+static void
+append_array(std::vector<char> & out, const std::vector<T> & values)
+{
+    append_value(out, static_cast<uint64_t>(values.size()));
+    append_bytes(out, values.data(), values.size() * sizeof(T));
+}
+
+static void
+append_results(std::vector<char> & out, const StringWeightVector & results)
+{
+    append_value(out, static_cast<uint64_t>(results.size()));
+    for (auto& it : results) {
+        append_value(out, static_cast<uint64_t>(it.first.size()));
+        append_bytes(out, it.first.data(), it.first.size());
+        append_value(out, it.second);
+    }
+}
+
+template<typename T>
+static bool
+read_value(char ** raw, const char * end, T & value)
+{
+    if (static_cast<size_t>(end - *raw) < sizeof(T)) {
+        return false;
+    }
+    memcpy(&value, *raw, sizeof(T));
+    *raw += sizeof(T);
+    return true;
+}
+
+// @a blank is for types without a default constructor
+template<typename T>
+static bool
+read_array(char ** raw, const char * end, std::vector<T> & values,
+           const T & blank = T())
+{
+    uint64_t count;
+    if (!read_value(raw, end, count) ||
+        count > static_cast<size_t>(end - *raw) / sizeof(T)) {
+        return false;
+    }
+    values.assign(count, blank);
+    if (count > 0) {
+        memcpy(values.data(), *raw, count * sizeof(T));
+    }
+    *raw += count * sizeof(T);
+    return true;
+}
+
+static bool
+read_results(char ** raw, const char * end, StringWeightVector & results)
+{
+    uint64_t count;
+    if (!read_value(raw, end, count)) {
+        return false;
+    }
+    results.clear();
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t length;
+        if (!read_value(raw, end, length) ||
+            length > static_cast<size_t>(end - *raw)) {
+            return false;
+        }
+        std::string result(*raw, length);
+        *raw += length;
+        Weight weight;
+        if (!read_value(raw, end, weight)) {
+            return false;
+        }
+        results.push_back(StringWeightPair(result, weight));
+    }
+    return true;
+}
+
+void OutputArena::reset(const OutputArena * base_arena)
+{
+    base = base_arena;
+    base_size = (base_arena == NULL) ? 0 : base_arena->size();
+    symbols.clear();
+    parents.clear();
+}
+
+void OutputArena::materialize(PathIndex path, SymbolVector & result) const
+{
+    result.clear();
+    for (; path != EMPTY_PATH; path = parent(path)) {
+        result.push_back(symbol(path));
+    }
+    std::reverse(result.begin(), result.end());
+}
+
+size_t OutputArena::memory_size(void) const
+{
+    return symbols.capacity() * sizeof(SymbolNumber) +
+        parents.capacity() * sizeof(PathIndex);
+}
+
+void OutputArena::write(std::vector<char> & out) const
+{
+    append_array(out, symbols);
+    append_array(out, parents);
+}
+
+bool OutputArena::read(char ** raw, const char * end)
+{
+    if (!read_array(raw, end, symbols) ||
+        !read_array(raw, end, parents) ||
+        symbols.size() != parents.size()) {
+        return false;
+    }
+    base = NULL;
+    base_size = 0;
+    return true;
+}
+
+// reads what a path spells backwards, byte by byte, with a boundary in
+// front of each symbol if the symbols are told apart
+class ReverseOutput
+{
+private:
+    const OutputArena & paths;
+    const KeyTable & keys;
+    bool separate;
+    PathIndex path; // the rest of the path
+    const std::string * symbol; // the symbol being read
+    size_t left; // bytes of it still to read
+    bool boundary; // whether a boundary is still to come
+public:
+    static const int BOUNDARY = 256;
+    static const int END = -1;
+
+    ReverseOutput(const OutputArena & output_paths, const KeyTable & key_table,
+                  bool separate_symbols, PathIndex output_path):
+        paths(output_paths),
+        keys(key_table),
+        separate(separate_symbols),
+        path(output_path),
+        symbol(NULL),
+        left(0),
+        boundary(false)
+        {}
+
+    int next(void)
+    {
+        while (true) {
+            if (left > 0) {
+                return static_cast<unsigned char>((*symbol)[--left]);
+            }
+            if (boundary) {
+                boundary = false;
+                return BOUNDARY;
+            }
+            if (path == EMPTY_PATH) {
+                return END;
+            }
+            SymbolNumber s = paths.symbol(path);
+            path = paths.parent(path);
+            // stringify() leaves out symbols without a string
+            if (s < keys.size()) {
+                symbol = &keys[s];
+                left = symbol->size();
+                boundary = separate;
+            }
+        }
+    }
+};
+
+void ResultTable::reset(const OutputArena * output_paths, KeyTable * key_table,
+                        bool separate_symbols)
+{
+    paths = output_paths;
+    keys = key_table;
+    separate = separate_symbols;
+    // sized for the last search, so that a warmed up table doesn't
+    // allocate and a big search doesn't make the next ones slow to clear
+    slots.resize(table_size(slots.size(), results.size()));
+    std::fill(slots.begin(), slots.end(), UINT_MAX);
+    results.clear();
+}
+
+size_t ResultTable::hash_output(PathIndex path) const
+{
+    ReverseOutput output(*paths, *keys, separate, path);
+    size_t hash = 2166136261u;
+    for (int c = output.next(); c != ReverseOutput::END; c = output.next()) {
+        hash = (hash ^ static_cast<size_t>(c)) * 16777619u;
+    }
+    return hash;
+}
+
+bool ResultTable::same_output(PathIndex lhs, PathIndex rhs) const
+{
+    if (lhs == rhs) {
+        return true;
+    }
+    ReverseOutput lhs_output(*paths, *keys, separate, lhs);
+    ReverseOutput rhs_output(*paths, *keys, separate, rhs);
+    while (true) {
+        int c = lhs_output.next();
+        if (c != rhs_output.next()) {
+            return false;
+        } else if (c == ReverseOutput::END) {
+            return true;
+        }
+    }
+}
+
+void ResultTable::grow(void)
+{
+    slots.assign(slots.size() * 2, UINT_MAX);
+    size_t mask = slots.size() - 1;
+    for (size_t i = 0; i < results.size(); ++i) {
+        size_t slot = results[i].hash & mask;
+        while (slots[slot] != UINT_MAX) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = static_cast<uint32_t>(i);
+    }
+}
+
+bool ResultTable::insert(PathIndex path, Weight weight, Weight * previous)
+{
+    size_t hash = hash_output(path);
+    size_t mask = slots.size() - 1;
+    size_t slot = hash & mask;
+    for (; slots[slot] != UINT_MAX; slot = (slot + 1) & mask) {
+        Result & result = results[slots[slot]];
+        if (result.hash == hash && same_output(result.path, path)) {
+            if (result.weight > weight) {
+                if (previous != NULL) {
+                    *previous = result.weight;
+                }
+                result.path = path;
+                result.weight = weight;
+                return true;
+            }
+            return false;
+        }
+    }
+    if (previous != NULL) {
+        *previous = std::numeric_limits<Weight>::max();
+    }
+    Result result = {path, weight, hash};
+    slots[slot] = static_cast<uint32_t>(results.size());
+    results.push_back(result);
+    // keep the table at most half full
+    if (results.size() * 2 > slots.size()) {
+        grow();
+    }
+    return true;
+}
+
+void ResultTable::stringify(StringWeightVector & strings, Weight limit) const
+{
+    strings.clear();
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (results[i].weight <= limit) {
+            strings.push_back(StringWeightPair(
+                                  hfst_ol::stringify(keys, *paths,
+                                                     results[i].path),
+                                  results[i].weight));
+        }
+    }
+    std::sort(strings.begin(), strings.end());
+}
+
+void VisitedTable::reset(void)
+{
+    // sized for the last search, like ResultTable
+    Entry unused = {UINT_MAX, 0, 0, 0, 0.0};
+    entries.resize(table_size(entries.size(), count));
+    std::fill(entries.begin(), entries.end(), unused);
+    count = 0;
+}
+
+size_t VisitedTable::slot(const Entry & entry) const
+{
+    size_t hash = 2166136261u;
+    hash = (hash ^ entry.input_state) * 16777619u;
+    hash = (hash ^ entry.mutator_state) * 16777619u;
+    hash = (hash ^ entry.lexicon_state) * 16777619u;
+    hash = (hash ^ entry.flag_state) * 16777619u;
+    return hash & (entries.size() - 1);
+}
+
+void VisitedTable::grow(void)
+{
+    Entry unused = {UINT_MAX, 0, 0, 0, 0.0};
+    std::vector<Entry> old_entries(entries.size() * 2, unused);
+    std::swap(entries, old_entries);
+    for (size_t i = 0; i < old_entries.size(); ++i) {
+        if (old_entries[i].input_state != UINT_MAX) {
+            size_t s = slot(old_entries[i]);
+            while (entries[s].input_state != UINT_MAX) {
+                s = (s + 1) & (entries.size() - 1);
+            }
+            entries[s] = old_entries[i];
+        }
+    }
+}
+
+bool VisitedTable::visit(const TreeNode & node)
+{
+    Entry entry = {node.input_state, node.mutator_state, node.lexicon_state,
+                   node.flag_state, node.weight};
+    size_t mask = entries.size() - 1;
+    size_t s = slot(entry);
+    for (; entries[s].input_state != UINT_MAX; s = (s + 1) & mask) {
+        Entry & seen = entries[s];
+        if (seen.input_state == entry.input_state &&
+            seen.mutator_state == entry.mutator_state &&
+            seen.lexicon_state == entry.lexicon_state &&
+            seen.flag_state == entry.flag_state) {
+            if (seen.weight <= entry.weight) {
+                return false;
+            }
+            seen.weight = entry.weight;
+            return true;
+        }
+    }
+    entries[s] = entry;
+    ++count;
+    // keep the table at most half full
+    if (count * 2 > entries.size()) {
+        grow();
+    }
+    return true;
+}
+
+void FlagStatePool::reset(size_t size, const FlagStatePool * base_pool)
 {
-    /* utility function to determine how many bytes to peel off as
-       a utf-8 character for representing as unknown symbol */
-    if (c <= 127) {
-        return 1;
-    } else if ( (c & (128 + 64 + 32 + 16)) == (128 + 64 + 32 + 16) ) {
-        return 4;
-    } else if ( (c & (128 + 64 + 32 )) == (128 + 64 + 32) ) {
-        return 3;
-    } else if ( (c & (128 + 64 )) == (128 + 64)) {
-        return 2;
+    base = base_pool;
+    values.clear();
+    // sized for the last search, like ResultTable
+    interned.resize(table_size(interned.size(), state_count));
+    memo.resize(table_size(memo.size(), memo_count));
+    std::fill(interned.begin(), interned.end(), NO_FLAG_STATE);
+    MemoEntry unused = {NO_FLAG_STATE, NO_SYMBOL, NO_FLAG_STATE};
+    std::fill(memo.begin(), memo.end(), unused);
+    memo_count = 0;
+    if (base_pool == NULL) {
+        base_size = 0;
+        state_size = size;
+        // UNSET_FLAGS
+        values.resize(state_size, 0);
+        state_count = 1;
+        insert_interned(0);
     } else {
-        return 0;
+        base_size = base_pool->size();
+        state_size = base_pool->state_size;
+        state_count = 0;
     }
 }
 
-void WeightQueue::push(Weight w)
+const ValueNumber * FlagStatePool::state_values(FlagStateIndex state) const
 {
-    for (WeightQueue::iterator it = begin(); it != end(); ++it) {
-        if (*it > w) {
-            insert(it, w);
-            return;
+    if (state < base_size) {
+        return base->state_values(state);
+    }
+    return values.data() + (state - base_size) * state_size;
+}
+
+size_t FlagStatePool::hash_values(const ValueNumber * state_values) const
+{
+    size_t hash = 2166136261u;
+    for (size_t f = 0; f < state_size; ++f) {
+        hash = (hash ^ static_cast<uint16_t>(state_values[f])) * 16777619u;
+    }
+    return hash;
+}
+
+FlagStateIndex FlagStatePool::find(const ValueNumber * state_values,
+                                   size_t hash) const
+{
+    if (base != NULL) {
+        FlagStateIndex found = base->find(state_values, hash);
+        if (found != NO_FLAG_STATE) {
+            return found;
+        }
+    }
+    size_t mask = interned.size() - 1;
+    for (size_t slot = hash & mask; interned[slot] != NO_FLAG_STATE;
+         slot = (slot + 1) & mask) {
+        const ValueNumber * candidate =
+            values.data() + interned[slot] * state_size;
+        if (std::equal(candidate, candidate + state_size, state_values)) {
+            return base_size + interned[slot];
         }
     }
-    push_back(w);
+    return NO_FLAG_STATE;
 }
 
-void WeightQueue::pop(void)
+void FlagStatePool::insert_interned(FlagStateIndex own_index)
 {
-    pop_back();
+    if ((own_index + 1) * 2 > interned.size()) {
+        // keep the table at most half full
+        std::vector<FlagStateIndex> grown(interned.size() * 2, NO_FLAG_STATE);
+        interned.swap(grown);
+        for (FlagStateIndex i = 0; i < own_index; ++i) {
+            insert_interned(i);
+        }
+    }
+    size_t mask = interned.size() - 1;
+    size_t slot = hash_values(values.data() + own_index * state_size) & mask;
+    while (interned[slot] != NO_FLAG_STATE) {
+        slot = (slot + 1) & mask;
+    }
+    interned[slot] = own_index;
 }
 
-Weight WeightQueue::get_lowest(void) const
+FlagStateIndex FlagStatePool::intern_last(void)
 {
-    if (size() == 0) {
-        return std::numeric_limits<Weight>::max();
+    // the new state has been written after the last one
+    const ValueNumber * candidate = values.data() + state_count * state_size;
+    FlagStateIndex found = find(candidate, hash_values(candidate));
+    if (found != NO_FLAG_STATE) {
+        values.resize(state_count * state_size);
+        return found;
     }
-    return front();
+    insert_interned(state_count);
+    return base_size + state_count++;
+}
+
+FlagStateIndex FlagStatePool::intern(const ValueNumber * state_values)
+{
+    values.insert(values.end(), state_values, state_values + state_size);
+    return intern_last();
 }
 
-Weight WeightQueue::get_highest(void) const
+FlagStateIndex FlagStatePool::set_value(FlagStateIndex state,
+                                        SymbolNumber feature,
+                                        ValueNumber value)
 {
-    if (size() == 0) {
-        return std::numeric_limits<Weight>::max();
+    if (this->value(state, feature) == value) {
+        return state;
     }
-    return back();
+    size_t start = values.size();
+    values.resize(start + state_size);
+    // state_values may have moved in the resize
+    const ValueNumber * old_values = state_values(state);
+    std::copy(old_values, old_values + state_size, values.begin() + start);
+    values[start + feature] = value;
+    return intern_last();
 }
 
-Transducer::Transducer(FILE* f):
-    header(TransducerHeader(f)),
-    alphabet(TransducerAlphabet(f, header.symbol_count())),
-    keys(alphabet.get_key_table()),
-    encoder(keys,header.input_symbol_count()),
-    indices(f,header.index_table_size()),
-    transitions(f,header.target_table_size())
-    {}
+FlagStateIndex FlagStatePool::compute(FlagStateIndex state,
+                                      const FlagDiacriticOperation & op)
+{
+    ValueNumber value = this->value(state, op.Feature());
+    switch (op.Operation()) {
+    
+    case P: // positive set
+        return set_value(state, op.Feature(), op.Value());
+    
+    case N: // negative set (literally, in this implementation)
+        return set_value(state, op.Feature(), -1*op.Value());
+    
+    case R: // require
+        if (op.Value() == 0) { // "plain" require, return false if unset
+            return (value != 0) ? state : NO_FLAG_STATE;
+        }
+        return (value == op.Value()) ? state : NO_FLAG_STATE;
+    
+    case D: // disallow
+        if (op.Value() == 0) { // "plain" disallow, return true if unset
+            return (value == 0) ? state : NO_FLAG_STATE;
+        }
+        return (value != op.Value()) ? state : NO_FLAG_STATE;
+      
+    case C: // clear
+        return set_value(state, op.Feature(), 0);
+      
+    case U: // unification
+        /* if the feature is unset OR the feature is to this value already OR
+           the feature is negatively set to something else than this value */
+        if (value == 0 ||
+            value == op.Value() ||
+            (value < 0 &&
+             (value * -1 != op.Value()))
+            ) {
+            return set_value(state, op.Feature(), op.Value());
+        }
+        return NO_FLAG_STATE;
+    }
+    
+    return NO_FLAG_STATE; // to make the compiler happy
+}
 
-Transducer::Transducer(char* raw):
-    header(TransducerHeader(&raw)),
-    alphabet(TransducerAlphabet(&raw, header.symbol_count())),
-    keys(alphabet.get_key_table()),
-    encoder(keys,header.input_symbol_count()),
-    indices(&raw,header.index_table_size()),
-    transitions(&raw,header.target_table_size())
-    {}
+void FlagStatePool::insert_memo(const MemoEntry & entry)
+{
+    if ((memo_count + 1) * 2 > memo.size()) {
+        // keep the table at most half full
+        MemoEntry unused = {NO_FLAG_STATE, NO_SYMBOL, NO_FLAG_STATE};
+        std::vector<MemoEntry> old(memo.size() * 2, unused);
+        memo.swap(old);
+        memo_count = 0;
+        for (auto& it : old) {
+            if (it.state != NO_FLAG_STATE) {
+                insert_memo(it);
+            }
+        }
+    }
+    size_t mask = memo.size() - 1;
+    size_t slot = (entry.state * 2654435761u + entry.symbol) & mask;
+    while (memo[slot].state != NO_FLAG_STATE) {
+        slot = (slot + 1) & mask;
+    }
+    memo[slot] = entry;
+    ++memo_count;
+}
+
+FlagStateIndex FlagStatePool::apply(FlagStateIndex state, SymbolNumber symbol,
+                                    const OperationVector * operations)
+{
+    size_t mask = memo.size() - 1;
+    for (size_t slot = (state * 2654435761u + symbol) & mask;
+         memo[slot].state != NO_FLAG_STATE; slot = (slot + 1) & mask) {
+        if (memo[slot].state == state && memo[slot].symbol == symbol) {
+            return memo[slot].result;
+        }
+    }
+    MemoEntry entry = {state, symbol,
+                       compute(state, (*operations)[symbol])};
+    insert_memo(entry);
+    return entry.result;
+}
+
+size_t FlagStatePool::memory_size(void) const
+{
+    return values.capacity() * sizeof(ValueNumber) +
+        interned.capacity() * sizeof(FlagStateIndex) +
+        memo.capacity() * sizeof(MemoEntry);
+}
+
+void FlagStatePool::write(std::vector<char> & out) const
+{
+    append_value(out, static_cast<uint64_t>(state_size));
+    append_value(out, static_cast<uint32_t>(state_count));
+    append_array(out, values);
+}
+
+bool FlagStatePool::read(char ** raw, const char * end)
+{
+    uint64_t size;
+    uint32_t count;
+    if (!read_value(raw, end, size) ||
+        !read_value(raw, end, count) ||
+        !read_array(raw, end, values) ||
+        count == 0 || values.size() != size * count) {
+        return false;
+    }
+    base = NULL;
+    base_size = 0;
+    state_size = size;
+    state_count = count;
+    // the tables only depend on the states, and the memo fills up again
+    interned.assign(16, NO_FLAG_STATE);
+    for (FlagStateIndex i = 0; i < state_count; ++i) {
+        insert_interned(i);
+    }
+    MemoEntry unused = {NO_FLAG_STATE, NO_SYMBOL, NO_FLAG_STATE};
+    memo.assign(16, unused);
+    memo_count = 0;
+    return true;
+}
+
+size_t CacheContainer::memory_size(void) const
+{
+    size_t size = sizeof(CacheContainer) +
+        nodes.capacity() * sizeof(TreeNode) +
+        paths.memory_size() + flags.memory_size();
+    for (auto& it : results_len_0) {
+        size += sizeof(StringWeightPair) + it.first.capacity();
+    }
+    for (auto& it : results_len_1) {
+        size += sizeof(StringWeightPair) + it.first.capacity();
+    }
+    return size;
+}
+
+void CacheContainer::write(std::vector<char> & out) const
+{
+    append_array(out, nodes);
+    paths.write(out);
+    flags.write(out);
+    append_results(out, results_len_0);
+    append_results(out, results_len_1);
+}
+
+bool CacheContainer::read(char ** raw, const char * end)
+{
+    if (!read_array(raw, end, nodes, TreeNode(UNSET_FLAGS)) ||
+        !paths.read(raw, end) ||
+        !flags.read(raw, end) ||
+        !read_results(raw, end, results_len_0) ||
+        !read_results(raw, end, results_len_1)) {
+        return false;
+    }
+    empty = false;
+    return true;
+}
+
+size_t PrefixCache::PrefixHash::operator()(const SymbolVector & prefix) const
+{
+    size_t hash = prefix.size();
+    for (auto& it : prefix) {
+        hash = hash * 31 + it;
+    }
+    return hash;
+}
+
+void PrefixCache::configure(size_t length, size_t memory_budget)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    // there are always entries for the first symbols
+    max_length = std::max(length, static_cast<size_t>(1));
+    budget = memory_budget;
+    for (std::list<SymbolVector>::iterator it = recency.begin();
+         it != recency.end(); ) {
+        if (it->size() > max_length) {
+            EntryMap::iterator longer = entries.find(*it);
+            memory -= longer->second.memory;
+            entries.erase(longer);
+            it = recency.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    evict();
+}
+
+size_t PrefixCache::get_max_length(void) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return max_length;
+}
+
+bool PrefixCache::contains(const SymbolVector & prefix) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.find(prefix) != entries.end();
+}
+
+std::shared_ptr<const CacheContainer>
+PrefixCache::find(const SymbolVector & prefix)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    EntryMap::iterator found = entries.find(prefix);
+    if (found == entries.end()) {
+        return std::shared_ptr<const CacheContainer>();
+    }
+    ++hits;
+    ++found->second.hits;
+    recency.splice(recency.begin(), recency, found->second.use);
+    return found->second.search;
+}
+
+std::shared_ptr<const CacheContainer>
+PrefixCache::insert(const SymbolVector & prefix,
+                    const std::shared_ptr<const CacheContainer> & search)
+{
+    size_t search_memory = search->memory_size() +
+        prefix.capacity() * sizeof(SymbolNumber);
+    std::lock_guard<std::mutex> lock(mutex);
+    ++misses;
+    EntryMap::iterator found = entries.find(prefix);
+    if (found != entries.end()) {
+        // another search built it meanwhile
+        return found->second.search;
+    }
+    keep(prefix, search, search_memory);
+    return search;
+}
+
+void PrefixCache::keep(const SymbolVector & prefix,
+                       const std::shared_ptr<const CacheContainer> & search,
+                       size_t search_memory)
+{
+    if (budget > 0 && search_memory > budget) {
+        // it would only push everything else out
+        return;
+    }
+    recency.push_front(prefix);
+    Entry entry = {search, search_memory, 0, recency.begin()};
+    entries.insert(EntryMap::value_type(prefix, entry));
+    memory += search_memory;
+    evict();
+}
+
+void PrefixCache::evict(void)
+{
+    while (budget > 0 && memory > budget && !recency.empty()) {
+        EntryMap::iterator oldest = entries.find(recency.back());
+        memory -= oldest->second.memory;
+        entries.erase(oldest);
+        recency.pop_back();
+        ++evictions;
+    }
+}
+
+void PrefixCache::clear(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    recency.clear();
+    memory = 0;
+}
+
+PrefixCache::Statistics PrefixCache::get_statistics(void) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Statistics statistics;
+    statistics.memory = memory;
+    statistics.hits = hits;
+    statistics.misses = misses;
+    statistics.evictions = evictions;
+    for (auto& it : recency) {
+        const Entry & entry = entries.find(it)->second;
+        EntryStatistics entry_statistics = {it, entry.memory, entry.hits};
+        statistics.entries.push_back(entry_statistics);
+    }
+    return statistics;
+}
+
+void PrefixCache::write(std::vector<char> & out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    append_value(out, static_cast<uint64_t>(recency.size()));
+    // least recently used first, so that reading them keeps the order
+    for (std::list<SymbolVector>::const_reverse_iterator it =
+             recency.rbegin(); it != recency.rend(); ++it) {
+        append_array(out, *it);
+        entries.find(*it)->second.search->write(out);
+    }
+}
+
+bool PrefixCache::read(char ** raw, const char * end)
+{
+    uint64_t count;
+    if (!read_value(raw, end, count)) {
+        return false;
+    }
+    // read them all first, so that nothing is added from a broken file
+    std::vector<SymbolVector> prefixes;
+    std::vector<std::shared_ptr<const CacheContainer> > searches;
+    for (uint64_t i = 0; i < count; ++i) {
+        SymbolVector prefix;
+        std::shared_ptr<CacheContainer> search(new CacheContainer);
+        if (!read_array(raw, end, prefix) || prefix.empty() ||
+            !search->read(raw, end)) {
+            return false;
+        }
+        prefixes.push_back(prefix);
+        searches.push_back(search);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < prefixes.size(); ++i) {
+        if (prefixes[i].size() <= max_length &&
+            entries.find(prefixes[i]) == entries.end()) {
+            keep(prefixes[i], searches[i], searches[i]->memory_size() +
+                 prefixes[i].capacity() * sizeof(SymbolNumber));
+        }
+    }
+    return true;
+}
 
-TreeNode TreeNode::update_lexicon(SymbolNumber symbol,
+TreeNode TreeNode::update_lexicon(OutputArena & paths,
+                                  SymbolNumber symbol,
                                   TransitionTableIndex next_lexicon,
                                   Weight weight)
 {
-    SymbolVector str(this->string);
-    if (symbol != 0) {
-        str.push_back(symbol);
-    }
-    return TreeNode(str,
+    return TreeNode((symbol != 0) ? paths.extend(this->output, symbol) :
+                                    this->output,
                     this->input_state,
                     this->mutator_state,
                     next_lexicon,
@@ -106,7 +1381,7 @@ TreeNode TreeNode::update_lexicon(SymbolNumber symbol,
 TreeNode TreeNode::update_mutator(TransitionTableIndex next_mutator,
                                   Weight weight)
 {
-    return TreeNode(this->string,
+    return TreeNode(this->output,
                     this->input_state,
                     next_mutator,
                     this->lexicon_state,
@@ -114,17 +1389,15 @@ TreeNode TreeNode::update_mutator(TransitionTableIndex next_mutator,
                     this->weight + weight);
 }
 
-TreeNode TreeNode::update(SymbolNumber symbol,
+TreeNode TreeNode::update(OutputArena & paths,
+                          SymbolNumber symbol,
                           unsigned int next_input,
                           TransitionTableIndex next_mutator,
                           TransitionTableIndex next_lexicon,
                           Weight weight)
 {
-    SymbolVector str(this->string);
-    if (symbol != 0) {
-        str.push_back(symbol);
-    }
-    return TreeNode(str,
+    return TreeNode((symbol != 0) ? paths.extend(this->output, symbol) :
+                                    this->output,
                     next_input,
                     next_mutator,
                     next_lexicon,
@@ -132,16 +1405,14 @@ TreeNode TreeNode::update(SymbolNumber symbol,
                     this->weight + weight);
 }
 
-TreeNode TreeNode::update(SymbolNumber symbol,
+TreeNode TreeNode::update(OutputArena & paths,
+                          SymbolNumber symbol,
                           TransitionTableIndex next_mutator,
                           TransitionTableIndex next_lexicon,
                           Weight weight)
 {
-    SymbolVector str(this->string);
-    if (symbol != 0) {
-        str.push_back(symbol);
-    }
-    return TreeNode(str,
+    return TreeNode((symbol != 0) ? paths.extend(this->output, symbol) :
+                                    this->output,
                     this->input_state,
                     next_mutator,
                     next_lexicon,
@@ -149,70 +1420,125 @@ TreeNode TreeNode::update(SymbolNumber symbol,
                     this->weight + weight);
 }
 
-bool TreeNode::try_compatible_with(FlagDiacriticOperation op)
+bool TreeNode::try_compatible_with(FlagStatePool & flags,
+                                   SymbolNumber symbol,
+                                   const OperationVector * operations)
 {
-    switch (op.Operation()) {
-    
-    case P: // positive set
-        flag_state[op.Feature()] = op.Value();
-        return true;
-    
-    case N: // negative set (literally, in this implementation)
-        flag_state[op.Feature()] = -1*op.Value();
-        return true;
-    
-    case R: // require
-        if (op.Value() == 0) { // "plain" require, return false if unset
-            return (flag_state[op.Feature()] != 0);
-        }
-        return (flag_state[op.Feature()] == op.Value());
-    
-    case D: // disallow
-        if (op.Value() == 0) { // "plain" disallow, return true if unset
-            return (flag_state[op.Feature()] == 0);
-        }
-        return (flag_state[op.Feature()] != op.Value());
-      
-    case C: // clear
-        flag_state[op.Feature()] = 0;
-        return true;
-      
-    case U: // unification
-        /* if the feature is unset OR the feature is to this value already OR
-           the feature is negatively set to something else than this value */
-        if (flag_state[op.Feature()] == 0 ||
-            flag_state[op.Feature()] == op.Value() ||
-            (flag_state[op.Feature()] < 0 &&
-             (flag_state[op.Feature()] * -1 != op.Value()))
-            ) {
-            flag_state[op.Feature()] = op.Value();
-            return true;
-        }
+    FlagStateIndex next_state = flags.apply(flag_state, symbol, operations);
+    if (next_state == NO_FLAG_STATE) {
         return false;
     }
-    
-    return false; // to make the compiler happy
+    flag_state = next_state;
+    return true;
 }
 
-Speller::Speller(Transducer* mutator_ptr, Transducer* lexicon_ptr):
+SpellerModel::SpellerModel(Transducer* mutator_ptr, Transducer* lexicon_ptr):
         mutator(mutator_ptr),
         lexicon(lexicon_ptr),
-        input(),
-        queue(TreeNodeQueue()),
-        next_node(FlagDiacriticState(get_state_size(), 0)),
-        limit(std::numeric_limits<Weight>::max()),
-        alphabet_translator(SymbolVector()),
-        operations(lexicon->get_operations()),
-        limiting(None),
-        mode(Correct)
+        check_walk(GeneralWalk)
             {
                 if (mutator != NULL) {
                     build_alphabet_translator();
-                    cache = std::vector<CacheContainer>(
-                        mutator->get_key_table()->size(), CacheContainer());
+                    mutator_bounds.set_mutator(mutator);
+                    mutator->compute_state_properties();
+                }
+                lexicon->compute_state_properties();
+                if (lexicon->get_state_size() == 0) {
+                    // without flags, only the states need to be kept
+                    check_walk = lexicon->is_input_deterministic() ?
+                        DirectWalk : StackWalk;
                 }
             }
 
+// the searches compiled for automata with the features FLAGS, UNKNOWNS
+// and BOUNDED, where lookups don't depend on BOUNDED
+template <bool FLAGS, bool UNKNOWNS, bool BOUNDED>
+static const SearchKernels * kernels_for(void)
+{
+    typedef SearchFeatures<false, FLAGS, UNKNOWNS, true> Lookup;
+    typedef SearchFeatures<true, FLAGS, UNKNOWNS, BOUNDED> Correct;
+    static const SearchKernels kernels = {
+        &Speller::lookup_queue<Lookup>,
+        &Speller::correct_depth_first<Correct>,
+        &Speller::correct_best_first<Correct>,
+        &Speller::build_cache<Correct>,
+        &Speller::extend_cache<Correct>
+    };
+    return &kernels;
+}
+
+// whether @a t has the unknown or the identity symbol
+static bool has_unknowns(Transducer * t)
+{
+    return t->get_unknown() != NO_SYMBOL || t->get_identity() != NO_SYMBOL;
+}
+
+// the searches compiled for the features of the automata of @a model
+static const SearchKernels * search_kernels(const SpellerModel * model)
+{
+    bool flags = model->lexicon->get_state_size() > 0;
+    bool unknowns = has_unknowns(model->lexicon) ||
+        (model->mutator != NULL && has_unknowns(model->mutator));
+    bool bounded = !model->lexicon->has_negative_weights() &&
+        (model->mutator == NULL || !model->mutator->has_negative_weights());
+    if (flags) {
+        if (unknowns) {
+            return bounded ? kernels_for<true, true, true>() :
+                kernels_for<true, true, false>();
+        }
+        return bounded ? kernels_for<true, false, true>() :
+            kernels_for<true, false, false>();
+    }
+    if (unknowns) {
+        return bounded ? kernels_for<false, true, true>() :
+            kernels_for<false, true, false>();
+    }
+    return bounded ? kernels_for<false, false, true>() :
+        kernels_for<false, false, false>();
+}
+
+Speller::Speller(Transducer* mutator_ptr, Transducer* lexicon_ptr):
+        Speller(new SpellerModel(mutator_ptr, lexicon_ptr))
+            {
+                owns_model = true;
+            }
+
+Speller::Speller(SpellerModel* model_ptr):
+        model(model_ptr),
+        owns_model(false),
+        kernels(search_kernels(model_ptr)),
+        mutator(model_ptr->mutator),
+        lexicon(model_ptr->lexicon),
+        input(),
+        queue(TreeNodeQueue()),
+        next_node(UNSET_FLAGS),
+        prune_visited(false),
+        limit(std::numeric_limits<Weight>::max()),
+        alphabet_translator(model_ptr->alphabet_translator),
+        output_keys(*model_ptr->lexicon->get_key_table()),
+        operations(lexicon->get_operation_vector()),
+        limiting(None),
+        mode(Correct),
+        search(DepthFirst),
+        resumed_state(0),
+        max_expanded(0),
+        max_frontier(0),
+        max_time(0.0),
+        expanded(0),
+        limit_reached(false),
+        threads(1),
+        split_after(1024),
+        splitting(false),
+        parallel(NULL)
+            { }
+
+Speller::~Speller(void)
+{
+    if (owns_model) {
+        delete model;
+    }
+}
+
 
 SymbolNumber
 Speller::get_state_size()
@@ -221,26 +1547,36 @@ Speller::get_state_size()
 }
 
 
+template <class Features>
 void Speller::lexicon_epsilons(void)
 {
-    if (!lexicon->has_epsilons_or_flags(next_node.lexicon_state + 1)) {
+    if (Features::flags ?
+        !lexicon->has_epsilons_or_flags(next_node.lexicon_state + 1) :
+        !lexicon->has_epsilons(next_node.lexicon_state + 1)) {
         return;
     }
     TransitionTableIndex next = lexicon->next(next_node.lexicon_state, 0);
-    STransition i_s = lexicon->take_epsilons_and_flags(next);
+    STransition i_s = Features::flags ?
+        lexicon->take_epsilons_and_flags(next) : lexicon->take_epsilons(next);
     
     while (i_s.symbol != NO_SYMBOL) {
-        if (is_under_weight_limit(next_node.weight + i_s.weight)) {
-            if (lexicon->transitions.input_symbol(next) == 0) {
-                queue.push_back(next_node.update_lexicon((mode == Correct) ? 0 : i_s.symbol,
+        if (is_under_weight_limit(
+                lower_bound<Features>(next_node.weight + i_s.weight,
+                                      next_node.input_state,
+                                      next_node.mutator_state,
+                                      i_s.index))) {
+            if (!Features::flags ||
+                lexicon->transitions.input_symbol(next) == 0) {
+                queue.push_back(next_node.update_lexicon(paths,
+                                                         Features::correct ? 0 : i_s.symbol,
                                                          i_s.index,
                                                          i_s.weight));
             } else {
-                FlagDiacriticState old_flags = next_node.flag_state;
-                if (next_node.try_compatible_with( // this is terrible
-                        operations->operator[](
-                            lexicon->transitions.input_symbol(next)))) {
-                    queue.push_back(next_node.update_lexicon(0,
+                FlagStateIndex old_flags = next_node.flag_state;
+                if (next_node.try_compatible_with(
+                        flags, lexicon->transitions.input_symbol(next),
+                        operations)) {
+                    queue.push_back(next_node.update_lexicon(paths, 0,
                                                              i_s.index,
                                                              i_s.weight));
                     next_node.flag_state = old_flags;
@@ -248,10 +1584,13 @@ void Speller::lexicon_epsilons(void)
             }
         }
         ++next;
-        i_s = lexicon->take_epsilons_and_flags(next);
+        i_s = Features::flags ?
+            lexicon->take_epsilons_and_flags(next) :
+            lexicon->take_epsilons(next);
     }
 }
 
+template <class Features>
 void Speller::lexicon_consume(void)
 {
     unsigned int input_state = next_node.input_state;
@@ -270,30 +1609,32 @@ void Speller::lexicon_consume(void)
     if(!lexicon->has_transitions(
            next_node.lexicon_state + 1, this_input)) {
         // we have no regular transitions for this
-        if (this_input >= lexicon->get_alphabet()->get_orig_symbol_count()) {
+        if (Features::unknowns &&
+            this_input >= lexicon->get_alphabet()->get_orig_symbol_count()) {
             // this input was not originally in the alphabet, so unknown or identity
             // may apply
             if (lexicon->get_unknown() != NO_SYMBOL &&
                 lexicon->has_transitions(next_node.lexicon_state + 1,
                                          lexicon->get_unknown())) {
-                queue_lexicon_arcs(lexicon->get_unknown(),
-                                   next_node.mutator_state,
-                                   0.0, 1);
+                queue_lexicon_arcs<Features>(lexicon->get_unknown(),
+                                             next_node.mutator_state,
+                                             0.0, 1);
             }
             if (lexicon->get_identity() != NO_SYMBOL &&
                 lexicon->has_transitions(next_node.lexicon_state + 1,
                                          lexicon->get_identity())) {
-                queue_lexicon_arcs(lexicon->get_identity(),
-                                   next_node.mutator_state,
-                                   0.0, 1);
+                queue_lexicon_arcs<Features>(lexicon->get_identity(),
+                                             next_node.mutator_state,
+                                             0.0, 1);
             }
         }
         return;
     }
-    queue_lexicon_arcs(this_input,
-                       next_node.mutator_state, 0.0, 1);
+    queue_lexicon_arcs<Features>(this_input,
+                                 next_node.mutator_state, 0.0, 1);
 }
 
+template <class Features>
 void Speller::queue_lexicon_arcs(SymbolNumber input_sym,
                                  unsigned int mutator_state,
                                  Weight mutator_weight,
@@ -301,27 +1642,32 @@ void Speller::queue_lexicon_arcs(SymbolNumber input_sym,
 {
     TransitionTableIndex next = lexicon->next(next_node.lexicon_state,
                                               input_sym);
-    STransition i_s = lexicon->take_non_epsilons(next, input_sym);
+    STransition i_s = lexicon->take_found_non_epsilons(next, input_sym);
     while (i_s.symbol != NO_SYMBOL) {
-        if (i_s.symbol == lexicon->get_identity()) {
+        if (Features::unknowns && i_s.symbol == lexicon->get_identity()) {
             i_s.symbol = input[next_node.input_state];
         }
-        if (is_under_weight_limit(next_node.weight + i_s.weight + mutator_weight)) {
-            queue.push_back(next_node.update(
-                                (mode == Correct) ? input_sym : i_s.symbol,
+        if (is_under_weight_limit(
+                lower_bound<Features>(
+                    next_node.weight + i_s.weight + mutator_weight,
+                    next_node.input_state + input_increment,
+                    mutator_state, i_s.index))) {
+            queue.push_back(next_node.update(paths,
+                                Features::correct ? input_sym : i_s.symbol,
                                 next_node.input_state + input_increment,
                                 mutator_state,
                                 i_s.index,
                                 i_s.weight + mutator_weight));
         }
         ++next;
-        i_s = lexicon->take_non_epsilons(next, input_sym);
+        i_s = lexicon->take_found_non_epsilons(next, input_sym);
     }
 }
 
+template <class Features>
 void Speller::mutator_epsilons(void)
 {
-    if (!mutator->has_transitions(next_node.mutator_state + 1, 0)) {
+    if (!mutator->has_epsilons(next_node.mutator_state + 1)) {
         return;
     }
     TransitionTableIndex next_m = mutator->next(next_node.mutator_state, 0);
@@ -330,7 +1676,10 @@ void Speller::mutator_epsilons(void)
     while (mutator_i_s.symbol != NO_SYMBOL) {
         if (mutator_i_s.symbol == 0) {
             if (is_under_weight_limit(
-                    next_node.weight + mutator_i_s.weight)) {
+                    lower_bound<Features>(next_node.weight + mutator_i_s.weight,
+                                          next_node.input_state,
+                                          mutator_i_s.index,
+                                          next_node.lexicon_state))) {
                 queue.push_back(next_node.update_mutator(mutator_i_s.index,
                                                          mutator_i_s.weight));
             }
@@ -341,28 +1690,31 @@ void Speller::mutator_epsilons(void)
                        next_node.lexicon_state + 1,
                        alphabet_translator[mutator_i_s.symbol])) {
             // we have no regular transitions for this
-            if (alphabet_translator[mutator_i_s.symbol] >= lexicon->get_alphabet()->get_orig_symbol_count()) {
+            if (Features::unknowns &&
+                alphabet_translator[mutator_i_s.symbol] >= lexicon->get_alphabet()->get_orig_symbol_count()) {
                 // this input was not originally in the alphabet, so unknown or identity
                 // may apply
                 if (lexicon->get_unknown() != NO_SYMBOL &&
                     lexicon->has_transitions(next_node.lexicon_state + 1,
                                              lexicon->get_unknown())) {
-                    queue_lexicon_arcs(lexicon->get_unknown(),
-                                       mutator_i_s.index, mutator_i_s.weight);
+                    queue_lexicon_arcs<Features>(lexicon->get_unknown(),
+                                                 mutator_i_s.index,
+                                                 mutator_i_s.weight);
                 }
                 if (lexicon->get_identity() != NO_SYMBOL &&
                     lexicon->has_transitions(next_node.lexicon_state + 1,
                                              lexicon->get_identity())) {
-                    queue_lexicon_arcs(lexicon->get_identity(),
-                                       mutator_i_s.index, mutator_i_s.weight);
+                    queue_lexicon_arcs<Features>(lexicon->get_identity(),
+                                                 mutator_i_s.index,
+                                                 mutator_i_s.weight);
                 }
             }
             ++next_m;
             mutator_i_s = mutator->take_epsilons(next_m);
             continue;
         }
-        queue_lexicon_arcs(alphabet_translator[mutator_i_s.symbol],
-                           mutator_i_s.index, mutator_i_s.weight);
+        queue_lexicon_arcs<Features>(alphabet_translator[mutator_i_s.symbol],
+                                     mutator_i_s.index, mutator_i_s.weight);
         ++next_m;
         mutator_i_s = mutator->take_epsilons(next_m);
     }
@@ -371,12 +1723,64 @@ void Speller::mutator_epsilons(void)
 
 bool Speller::is_under_weight_limit(Weight w) const
 {
-    if (limiting == Nbest) {
-        return w < limit;
-    }
+    // even with only n best wanted, the ones tying with the nth are kept,
+    // so that the order of the strings decides which ones make it and not
+    // the order they were found in
     return w <= limit;
 }
 
+Weight Speller::lower_bound(Weight w, unsigned int input_state,
+                            TransitionTableIndex mutator_state,
+                            TransitionTableIndex lexicon_state) const
+{
+    Weight to_final = lexicon->distance_to_final(lexicon_state);
+    if (mode == Correct) {
+        if (mutator->has_negative_weights() ||
+            lexicon->has_negative_weights()) {
+            // either automaton could make up for the other one
+            return w;
+        }
+        to_final += model->mutator_bounds.bound(mutator_bounds, input_state,
+                                                mutator_state);
+    }
+    if (to_final == 0.0) {
+        return w;
+    }
+    Weight bound = w + to_final;
+    if (std::isinf(bound)) {
+        // nothing can be found, and there is no room to leave
+        return bound;
+    }
+    // the distances are summed in another order than the weights of the
+    // paths, so leave some room for rounding
+    return std::max(w, bound - std::fabs(bound) * 1e-5f);
+}
+
+template <class Features>
+Weight Speller::lower_bound(Weight w, unsigned int input_state,
+                            TransitionTableIndex mutator_state,
+                            TransitionTableIndex lexicon_state) const
+{
+    if (Features::correct && !Features::bounded) {
+        // either automaton could make up for the other one
+        return w;
+    }
+    Weight to_final = lexicon->distance_to_final(lexicon_state);
+    if (Features::correct) {
+        to_final += model->mutator_bounds.bound(mutator_bounds, input_state,
+                                                mutator_state);
+    }
+    if (to_final == 0.0) {
+        return w;
+    }
+    Weight bound = w + to_final;
+    if (std::isinf(bound)) {
+        return bound;
+    }
+    return std::max(w, bound - std::fabs(bound) * 1e-5f);
+}
+
+template <class Features>
 void Speller::consume_input()
 {
     if (next_node.input_state >= input.size()) {
@@ -386,72 +1790,83 @@ void Speller::consume_input()
     if (!mutator->has_transitions(next_node.mutator_state + 1,
                                   input_sym)) {
         // we have no regular transitions for this
-        if (input_sym >= mutator->get_alphabet()->get_orig_symbol_count()) {
+        if (Features::unknowns &&
+            input_sym >= mutator->get_alphabet()->get_orig_symbol_count()) {
             // this input was not originally in the alphabet, so unknown or identity
             // may apply
             if (mutator->get_identity() != NO_SYMBOL &&
                 mutator->has_transitions(next_node.mutator_state + 1,
                                          mutator->get_identity())) {
-                queue_mutator_arcs(mutator->get_identity());
+                queue_mutator_arcs<Features>(mutator->get_identity());
             }
             if (mutator->get_unknown() != NO_SYMBOL &&
                 mutator->has_transitions(next_node.mutator_state + 1,
                                          mutator->get_unknown())) {
-                queue_mutator_arcs(mutator->get_unknown());
+                queue_mutator_arcs<Features>(mutator->get_unknown());
             }
         }
     } else {
-        queue_mutator_arcs(input_sym);
+        queue_mutator_arcs<Features>(input_sym);
     }
 }
 
+template <class Features>
 void Speller::queue_mutator_arcs(SymbolNumber input_sym)
 {
     TransitionTableIndex next_m = mutator->next(next_node.mutator_state,
                                                 input_sym);
-    STransition mutator_i_s = mutator->take_non_epsilons(next_m,
-                                                         input_sym);
+    STransition mutator_i_s = mutator->take_found_non_epsilons(next_m,
+                                                               input_sym);
     while (mutator_i_s.symbol != NO_SYMBOL) {
         if (mutator_i_s.symbol == 0) {
             if (is_under_weight_limit(
-                    next_node.weight + mutator_i_s.weight)) {
-                queue.push_back(next_node.update(0, next_node.input_state + 1,
+                    lower_bound<Features>(next_node.weight + mutator_i_s.weight,
+                                          next_node.input_state + 1,
+                                          mutator_i_s.index,
+                                          next_node.lexicon_state))) {
+                queue.push_back(next_node.update(paths,
+                                                 0, next_node.input_state + 1,
                                                  mutator_i_s.index,
                                                  next_node.lexicon_state,
                                                  mutator_i_s.weight));
             }
             ++next_m;
-            mutator_i_s = mutator->take_non_epsilons(next_m, input_sym);
+            mutator_i_s = mutator->take_found_non_epsilons(next_m,
+                                                           input_sym);
             continue;
         } else if (!lexicon->has_transitions(
                     next_node.lexicon_state + 1,
                     alphabet_translator[mutator_i_s.symbol])) {
                 // we have no regular transitions for this
-                if (alphabet_translator[mutator_i_s.symbol] >= lexicon->get_alphabet()->get_orig_symbol_count()) {
+                if (Features::unknowns &&
+                    alphabet_translator[mutator_i_s.symbol] >= lexicon->get_alphabet()->get_orig_symbol_count()) {
                     // this input was not originally in the alphabet, so unknown or identity
                     // may apply
                     if (lexicon->get_unknown() != NO_SYMBOL &&
                         lexicon->has_transitions(next_node.lexicon_state + 1,
                                                  lexicon->get_unknown())) {
-                        queue_lexicon_arcs(lexicon->get_unknown(),
-                                           mutator_i_s.index, mutator_i_s.weight, 1);
+                        queue_lexicon_arcs<Features>(lexicon->get_unknown(),
+                                                     mutator_i_s.index,
+                                                     mutator_i_s.weight, 1);
                     }
                     if (lexicon->get_identity() != NO_SYMBOL &&
                         lexicon->has_transitions(next_node.lexicon_state + 1,
                                                  lexicon->get_identity())) {
-                        queue_lexicon_arcs(lexicon->get_identity(),
-                                           mutator_i_s.index, mutator_i_s.weight, 1);
+                        queue_lexicon_arcs<Features>(lexicon->get_identity(),
+                                                     mutator_i_s.index,
+                                                     mutator_i_s.weight, 1);
                     }
                 }
                 ++next_m;
-                mutator_i_s = mutator->take_non_epsilons(next_m, input_sym);
+                mutator_i_s = mutator->take_found_non_epsilons(next_m,
+                                                               input_sym);
                 continue;
         }
-        queue_lexicon_arcs(alphabet_translator[mutator_i_s.symbol],
-                           mutator_i_s.index, mutator_i_s.weight, 1);
+        queue_lexicon_arcs<Features>(alphabet_translator[mutator_i_s.symbol],
+                                     mutator_i_s.index, mutator_i_s.weight, 1);
         ++next_m;
-        mutator_i_s = mutator->take_non_epsilons(next_m,
-                                                 input_sym);
+        mutator_i_s = mutator->take_found_non_epsilons(next_m,
+                                                       input_sym);
     }
 }
 
@@ -482,10 +1897,13 @@ AnalysisQueue Transducer::lookup(char * line)
     AnalysisQueue analyses;
     SymbolVector input;
     TreeNodeQueue queue;
+    OutputArena paths;
+    FlagStatePool flags;
     if (!initialize_input_vector(input, &encoder, line)) {
         return analyses;
     }
-    TreeNode start_node(FlagDiacriticState(get_state_size(), 0));
+    flags.reset(get_state_size());
+    TreeNode start_node(UNSET_FLAGS);
     queue.assign(1, start_node);
 
     while (queue.size() > 0) {
@@ -497,8 +1915,8 @@ AnalysisQueue Transducer::lookup(char * line)
             is_final(next_node.lexicon_state)) {
             Weight weight = next_node.weight +
                 final_weight(next_node.lexicon_state);
-            std::string output = stringify(get_key_table(),
-                                           next_node.string);
+            std::string output = stringify(get_key_table(), paths,
+                                           next_node.output);
             /* if the result is novel or lower weighted than before, insert it */
             if (outputs.count(output) == 0 ||
                 outputs[output] > weight) {
@@ -513,16 +1931,18 @@ AnalysisQueue Transducer::lookup(char * line)
             STransition i_s = take_epsilons_and_flags(next_index);
             while (i_s.symbol != NO_SYMBOL) {
                 if (transitions.input_symbol(next_index) == 0) {
-                    queue.push_back(next_node.update_lexicon(i_s.symbol,
+                    queue.push_back(next_node.update_lexicon(paths,
+                                                             i_s.symbol,
                                                              i_s.index,
                                                              i_s.weight));
                     // Not a true epsilon but a flag diacritic
                 } else {
-                    FlagDiacriticState old_flags = next_node.flag_state;
+                    FlagStateIndex old_flags = next_node.flag_state;
                     if (next_node.try_compatible_with(
-                            get_operations()->operator[](
-                                transitions.input_symbol(next_index)))) {
-                        queue.push_back(next_node.update_lexicon(i_s.symbol,
+                            flags, transitions.input_symbol(next_index),
+                            get_operation_vector())) {
+                        queue.push_back(next_node.update_lexicon(paths,
+                                                                 i_s.symbol,
                                                                  i_s.index,
                                                                  i_s.weight));
                         next_node.flag_state = old_flags;
@@ -545,7 +1965,7 @@ AnalysisQueue Transducer::lookup(char * line)
                                                 input[input_state]);
             
             while (i_s.symbol != NO_SYMBOL) {
-                queue.push_back(next_node.update(
+                queue.push_back(next_node.update(paths,
                                     i_s.symbol,
                                     input_state + 1,
                                     next_node.mutator_state,
@@ -602,6 +2022,24 @@ Transducer::get_state_size()
     return alphabet.get_state_size();
 }
 
+SymbolNumber
+Transducer::input_symbol_count()
+{
+    return header.input_symbol_count();
+}
+
+TransitionTableIndex
+Transducer::index_table_size() const
+{
+    return header.index_table_size();
+}
+
+TransitionTableIndex
+Transducer::transition_table_size() const
+{
+    return header.target_table_size();
+}
+
 SymbolNumber
 Transducer::get_unknown() const
 {
@@ -620,6 +2058,12 @@ Transducer::get_alphabet()
     return &alphabet;
 }
 
+const OperationVector*
+Transducer::get_operation_vector() const
+{
+    return alphabet.get_operations();
+}
+
 OperationMap*
 Transducer::get_operations()
 {
@@ -643,30 +2087,23 @@ bool Transducer::has_transitions(const TransitionTableIndex i,
         return false;
     }
     if (i >= TARGET_TABLE) {
-        return (transitions.input_symbol(i - TARGET_TABLE) == symbol);
-    } else {
-        return (indices.input_symbol(i+symbol) == symbol);
-    }
-}
-
-bool Transducer::has_epsilons_or_flags(const TransitionTableIndex i)
-{
-    if (i >= TARGET_TABLE) {
-        return(transitions.input_symbol(i - TARGET_TABLE) == 0||
-               is_flag(transitions.input_symbol(i - TARGET_TABLE)));
+        return (transitions.input_symbol(i - TARGET_TABLE) == symbol);
     } else {
-        return (indices.input_symbol(i) == 0);
+        return (indices.input_symbol(i+symbol) == symbol);
     }
 }
 
-bool Transducer::has_non_epsilons_or_flags(const TransitionTableIndex i)
+bool Transducer::has_non_epsilons_or_flags(const TransitionTableIndex i) const
 {
+    if (properties_ready.load(std::memory_order_acquire)) {
+        return state_has(StateHasNonEpsilons, i);
+    }
     if (i >= TARGET_TABLE) {
         SymbolNumber this_input = transitions.input_symbol(i - TARGET_TABLE);
         return((this_input != 0 && this_input != NO_SYMBOL) &&
                !is_flag(this_input));
     } else {
-        SymbolNumber max_symbol = static_cast<SymbolNumber>(get_key_table()->size());
+        SymbolNumber max_symbol = static_cast<SymbolNumber>(keys->size());
         for (SymbolNumber sym = 1; sym < max_symbol; ++sym) {
             if (indices.input_symbol(i + sym) == sym) {
                 return true;
@@ -688,8 +2125,7 @@ STransition Transducer::take_epsilons(const TransitionTableIndex i) const
 
 STransition Transducer::take_epsilons_and_flags(const TransitionTableIndex i)
 {
-    if (transitions.input_symbol(i) != 0 &&
-        !is_flag(transitions.input_symbol(i))) {
+    if (!has_epsilons_or_flags(i + TARGET_TABLE)) {
         return STransition(0, NO_SYMBOL);
     }
     return STransition(transitions.target(i),
@@ -708,17 +2144,11 @@ STransition Transducer::take_non_epsilons(const TransitionTableIndex i,
                        transitions.weight(i));
 }
 
-bool Transducer::is_final(const TransitionTableIndex i)
-{
-    if (i >= TARGET_TABLE) {
-        return final_transition(i - TARGET_TABLE);
-    } else {
-        return final_index(i);
-    }
-}
-
 Weight Transducer::final_weight(const TransitionTableIndex i) const
 {
+    if (properties_ready.load(std::memory_order_acquire)) {
+        return final_weights[state_position(i)];
+    }
     if (i >= TARGET_TABLE) {
         return transitions.weight(i - TARGET_TABLE);
     } else {
@@ -727,7 +2157,7 @@ Weight Transducer::final_weight(const TransitionTableIndex i) const
 }
 
 bool
-Transducer::is_flag(const SymbolNumber symbol)
+Transducer::is_flag(const SymbolNumber symbol) const
 {
     return alphabet.is_flag(symbol); 
 }
@@ -738,40 +2168,88 @@ Transducer::is_weighted(void)
     return header.probe_flag(Weighted);
 }
 
-
-AnalysisQueue Speller::analyse(char * line, int nbest)
+uint64_t
+Transducer::get_checksum(void) const
 {
-    (void)nbest;
-    mode = Lookup;
-    if (!init_input(line)) {
-        return AnalysisQueue();
+    if (header.get_checksum() != 0) {
+        return header.get_checksum();
     }
-    std::map<std::string, Weight> outputs;
-    AnalysisQueue analyses;
-    TreeNode start_node(FlagDiacriticState(get_state_size(), 0));
-    queue.assign(1, start_node);
+    std::call_once(checksum_computed, &Transducer::compute_checksum, this);
+    return checksum;
+}
+
+void
+Transducer::compute_checksum(void) const
+{
+    checksum = transducer_checksum(alphabet, indices, transitions);
+}
+
+bool
+Transducer::has_negative_weights(void) const
+{
+    std::call_once(tables_scanned, &Transducer::scan_tables, this);
+    return negative_weights;
+}
+
+bool
+Transducer::is_input_deterministic(void) const
+{
+    std::call_once(tables_scanned, &Transducer::scan_tables, this);
+    return input_deterministic;
+}
+
+
+bool Speller::lookup_queue(bool first_only)
+{
+    return (this->*kernels->lookup_queue)(first_only);
+}
+
+template <class Features>
+bool Speller::lookup_queue(bool first_only)
+{
+    bool found = false;
     while (queue.size() > 0) {
         next_node = queue.back();
         queue.pop_back();
         // Final states
         if (next_node.input_state == input.size() &&
             lexicon->is_final(next_node.lexicon_state)) {
+            if (first_only) {
+                return true;
+            }
             Weight weight = next_node.weight +
                 lexicon->final_weight(next_node.lexicon_state);
-            std::string output = stringify(lexicon->get_key_table(),
-                                           next_node.string);
             /* if the result is novel or lower weighted than before, insert it */
-            if (outputs.count(output) == 0 ||
-                outputs[output] > weight) {
-                outputs[output] = weight;
-            }
+            results.insert(next_node.output, weight);
+            found = true;
         }
-        lexicon_epsilons();
-        lexicon_consume();
+        lexicon_epsilons<Features>();
+        lexicon_consume<Features>();
+    }
+    return found;
+}
+
+AnalysisQueue Speller::analyse(char * line, int nbest)
+{
+    (void)nbest;
+    mode = Lookup;
+    limit = std::numeric_limits<Weight>::max();
+    if (!init_input(line)) {
+        return AnalysisQueue();
     }
+    AnalysisQueue analyses;
+    TreeNode start_node(UNSET_FLAGS);
+    paths.reset();
+    flags.reset(get_state_size());
+    results.reset(&paths, &output_keys);
+    queue.assign(1, start_node);
+    lookup_queue(false);
 
+    // in the order of the strings, which decides between equal weights
+    StringWeightVector outputs;
+    results.stringify(outputs);
     for (auto& it : outputs) {
-        analyses.push(StringWeightPair(it.first, it.second));
+        analyses.push(it);
     }
     return analyses;
 }
@@ -781,87 +2259,231 @@ AnalysisSymbolsQueue Speller::analyseSymbols(char * line, int nbest)
 {
     (void)nbest;
     mode = Lookup;
+    limit = std::numeric_limits<Weight>::max();
     if (!init_input(line)) {
         return AnalysisSymbolsQueue();
     }
-    std::map<std::vector<std::string>, Weight> outputs;
     AnalysisSymbolsQueue analyses;
-    TreeNode start_node(FlagDiacriticState(get_state_size(), 0));
+    TreeNode start_node(UNSET_FLAGS);
+    paths.reset();
+    flags.reset(get_state_size());
+    results.reset(&paths, &output_keys, true);
     queue.assign(1, start_node);
-    while (queue.size() > 0) {
-        next_node = queue.back();
-        queue.pop_back();
-        // Final states
-        if (next_node.input_state == input.size() &&
-            lexicon->is_final(next_node.lexicon_state)) {
-            Weight weight = next_node.weight +
-                lexicon->final_weight(next_node.lexicon_state);
-            std::vector<std::string> output = symbolify(lexicon->get_key_table(),
-                                                        next_node.string);
-            /* if the result is novel or lower weighted than before, insert it */
-            if (outputs.count(output) == 0 ||
-                outputs[output] > weight) {
-                outputs[output] = weight;
-            }
-        }
-        lexicon_epsilons();
-        lexicon_consume();
+    lookup_queue(false);
+
+    // in the order of the symbols, which decides between equal weights
+    std::vector<SymbolsWeightPair> outputs;
+    for (size_t i = 0; i < results.size(); ++i) {
+        outputs.push_back(SymbolsWeightPair(
+                              symbolify(&output_keys, paths,
+                                        results[i].path),
+                              results[i].weight));
     }
-
+    std::sort(outputs.begin(), outputs.end());
     for (auto& it : outputs) {
-        analyses.push(SymbolsWeightPair(it.first, it.second));
+        analyses.push(it);
     }
     return analyses;
 }
 
 
 
-void Speller::build_cache(SymbolNumber first_sym)
+void Speller::build_cache(SymbolNumber first_sym, CacheContainer & entry)
 {
-    TreeNode start_node(FlagDiacriticState(get_state_size(), 0));
+    (this->*kernels->build_cache)(first_sym, entry);
+}
+
+template <class Features>
+void Speller::build_cache(SymbolNumber first_sym, CacheContainer & entry)
+{
+    TreeNode start_node(UNSET_FLAGS);
+    paths.reset();
+    flags.reset(get_state_size());
     queue.assign(1, start_node);
     limit = std::numeric_limits<Weight>::max();
-    // A placeholding map, only one weight per correction
-    StringWeightMap corrections_len_0;
-    StringWeightMap corrections_len_1;
+    // only one weight per correction
+    ResultTable corrections_len_0;
+    ResultTable corrections_len_1;
+    corrections_len_0.reset(&paths, &output_keys);
+    corrections_len_1.reset(&paths, &output_keys);
     while (queue.size() > 0) {
         next_node = queue.back();
         queue.pop_back();
-        lexicon_epsilons();
-        mutator_epsilons();
+        lexicon_epsilons<Features>();
+        mutator_epsilons<Features>();
         if (mutator->is_final(next_node.mutator_state) &&
             lexicon->is_final(next_node.lexicon_state)) {
             // complete result of length 0 or 1
             Weight weight = next_node.weight +
                 lexicon->final_weight(next_node.lexicon_state) +
                 mutator->final_weight(next_node.mutator_state);
-            std::string string = stringify(lexicon->get_key_table(), next_node.string);
             /* if the correction is novel or better than before, insert it
              */
             if (next_node.input_state == 0) {
-                if (corrections_len_0.count(string) == 0 ||
-                    corrections_len_0[string] > weight) {
-                    corrections_len_0[string] = weight;
-                }
+                corrections_len_0.insert(next_node.output, weight);
             } else {
-                if (corrections_len_1.count(string) == 0 ||
-                    corrections_len_1[string] > weight) {
-                    corrections_len_1[string] = weight;
-                }
+                corrections_len_1.insert(next_node.output, weight);
             }
         }
         if (next_node.input_state == 1) {
-            cache[first_sym].nodes.push_back(next_node);
+            entry.nodes.push_back(next_node);
         } else {
 //            std::cerr << "discarded node\n";
         }
         if (first_sym > 0 && next_node.input_state == 0) {
-            consume_input();
+            consume_input<Features>();
+        }
+    }
+    corrections_len_0.stringify(entry.results_len_0);
+    corrections_len_1.stringify(entry.results_len_1);
+    // the cached nodes keep their output paths and flag states with them
+    std::swap(entry.paths, paths);
+    std::swap(entry.flags, flags);
+    entry.empty = false;
+}
+
+// orders nodes by their lower bound, heaviest first, so that the lightest
+// one is on top of a heap or at the back of a sorted stack
+struct HeavierNode
+{
+    bool operator()(const BoundedNode & lhs, const BoundedNode & rhs) const
+    {
+        return lhs.bound > rhs.bound;
+    }
+};
+
+bool Speller::extend_cache(const CacheContainer & shorter,
+                           CacheContainer & entry, bool budgeted)
+{
+    return (this->*kernels->extend_cache)(shorter, entry, budgeted);
+}
+
+template <class Features>
+bool Speller::extend_cache(const CacheContainer & shorter,
+                           CacheContainer & entry, bool budgeted)
+{
+    // continue from copies of the paths and flag states, so that every
+    // entry stands on its own and can be dropped whenever. Only what is
+    // over the limit set by the caller is left out, and what the budgets
+    // don't leave time for if they count.
+    paths = shorter.paths;
+    flags = shorter.flags;
+    queue.clear();
+    bool whole = true;
+    for (auto& it : shorter.nodes) {
+        if (budgeted && out_of_budget(queue.size())) {
+            whole = false;
+            break;
+        }
+        // as the search would skip it
+        if (lower_bound<Features>(it) > limit) {
+            continue;
+        }
+        next_node = it;
+        consume_input<Features>();
+    }
+    while (queue.size() > 0) {
+        if (budgeted && out_of_budget(queue.size())) {
+            // the nodes kept so far have their epsilons taken, so a
+            // search can still go on from the entry, but not the rest
+            whole = false;
+            queue.clear();
+            break;
+        }
+        next_node = queue.back();
+        queue.pop_back();
+        lexicon_epsilons<Features>();
+        mutator_epsilons<Features>();
+        entry.nodes.push_back(next_node);
+    }
+    // The depth first search takes the nodes from the back, so it starts
+    // with the lightest ones, which tightens the limits the soonest. Unlike
+    // the search after one symbol, which is pruned as it goes, these nodes
+    // haven't been pruned at all, so that matters.
+    BoundedNodeQueue sorted;
+    sorted.reserve(entry.nodes.size());
+    for (auto& it : entry.nodes) {
+        sorted.push_back(BoundedNode(lower_bound<Features>(it), it));
+    }
+    std::sort(sorted.begin(), sorted.end(), HeavierNode());
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        entry.nodes[i] = sorted[i].node;
+    }
+    std::swap(entry.paths, paths);
+    std::swap(entry.flags, flags);
+    entry.empty = false;
+    return whole;
+}
+
+std::shared_ptr<const CacheContainer> Speller::cached_search(void)
+{
+    // the empty input has an entry of its own, like a first symbol
+    SymbolVector prefix(1, (input.size() == 0) ? 0 : input[0]);
+    if (prefix[0] >= model->alphabet_translator.size()) {
+        // the symbol is only known for this input, so is its search
+        std::shared_ptr<CacheContainer> entry(new CacheContainer);
+        Weight input_limit = limit;
+        build_cache(prefix[0], *entry);
+        limit = input_limit;
+        resumed_state = 1;
+        return entry;
+    }
+    // the longest prefix that can be cached, which stops before any other
+    // symbol only this input knows
+    size_t length = 1;
+    size_t max_length = model->prefix_cache.get_max_length();
+    while (length < input.size() && length < max_length &&
+           input[length] < model->alphabet_translator.size()) {
+        ++length;
+    }
+    prefix.insert(prefix.end(), input.begin() + 1, input.begin() + length);
+    // start from the longest one that is cached
+    std::shared_ptr<const CacheContainer> entry;
+    while (true) {
+        entry = model->prefix_cache.find(prefix);
+        if (entry || prefix.size() == 1) {
+            break;
         }
+        prefix.pop_back();
+    }
+    // Build the missing ones without holding any lock, so that other
+    // spellers can use the cache meanwhile. If one of them builds the
+    // same entry, the first one to finish is kept; they are the same
+    // anyway. An entry is never changed after it is built, so it can be
+    // read without the lock. They are built without limits, so the ones
+    // of this input are put back afterwards.
+    Weight input_limit = limit;
+    if (!entry) {
+        std::shared_ptr<CacheContainer> built(new CacheContainer);
+        build_cache(prefix[0], *built);
+        entry = model->prefix_cache.insert(prefix, built);
+    }
+    limit = std::numeric_limits<Weight>::max();
+    while (prefix.size() < length) {
+        std::shared_ptr<CacheContainer> built(new CacheContainer);
+        prefix.push_back(input[prefix.size()]);
+        extend_cache(*entry, *built);
+        entry = model->prefix_cache.insert(prefix, built);
+    }
+    limit = input_limit;
+    resumed_state = static_cast<unsigned int>(prefix.size());
+    return entry;
+}
+
+void Speller::warm_up_cache(SymbolNumber first_sym)
+{
+    SymbolVector prefix(1, first_sym);
+    if (model->prefix_cache.contains(prefix)) {
+        return;
     }
-    cache[first_sym].results_len_0.assign(corrections_len_0.begin(), corrections_len_0.end());
-    cache[first_sym].results_len_1.assign(corrections_len_1.begin(), corrections_len_1.end());
-    cache[first_sym].empty = false;
+    // as if correcting an input of just the symbol
+    mode = Correct;
+    forget_unknown_symbols();
+    input.assign((first_sym == 0) ? 0 : 1, first_sym);
+    mutator_bounds.clear();
+    std::shared_ptr<CacheContainer> built(new CacheContainer);
+    build_cache(first_sym, *built);
+    model->prefix_cache.insert(prefix, built);
 }
 
 CorrectionQueue Speller::correct(char * line, int nbest,
@@ -869,76 +2491,605 @@ CorrectionQueue Speller::correct(char * line, int nbest,
                                  float time_cutoff)
 {
     mode = Correct;
+    // the time runs from the start, so that it covers the cache too
+    start_budget(time_cutoff);
     // if input initialization fails, return empty correction queue
     if (!init_input(line)) {
         return CorrectionQueue();
     }
+    set_limiting_behaviour(nbest, maxweight, beam);
+    // the cache is shared by all inputs, so it mustn't be pruned by the
+    // rest of this one
+    mutator_bounds.clear();
+    return correct_from(cached_search(), nbest, beam);
+}
+
+// a line of a batch as init_input() read it: its symbols, and the ones
+// only it has, which are numbered after the symbols of the model
+struct BatchInput
+{
+    SymbolVector symbols;
+    StringSymbolMap unknown_symbols;
+    SymbolVector translations; // alphabet_translator after the model's
+    KeyTable keys; // output_keys after the language model's
+};
+
+// orders the inputs of a batch by their symbols
+struct InputOrder
+{
+    const std::vector<BatchInput> * inputs;
+
+    bool operator()(size_t lhs, size_t rhs) const
+    {
+        return (*inputs)[lhs].symbols < (*inputs)[rhs].symbols;
+    }
+};
+
+// how many symbols @a lhs and @a rhs start with in common, up to the first
+// one that is only known for its input
+static size_t shared_prefix_length(const SymbolVector & lhs,
+                                   const SymbolVector & rhs,
+                                   size_t known_symbols)
+{
+    size_t length = 0;
+    while (length < lhs.size() && length < rhs.size() &&
+           lhs[length] == rhs[length] && lhs[length] < known_symbols) {
+        ++length;
+    }
+    return length;
+}
+
+std::vector<CorrectionQueue> Speller::correct_batch(
+    const std::vector<std::string> & lines, int nbest, Weight maxweight,
+    Weight beam, float time_cutoff, std::vector<bool> * truncated)
+{
+    mode = Correct;
+    std::vector<CorrectionQueue> corrections(lines.size());
+    if (truncated != NULL) {
+        truncated->assign(lines.size(), false);
+    }
+    // Each line is read once, to sort the lines by their symbols and to
+    // search it later. The symbols not in the alphabet are numbered anew
+    // for each line, so they are kept with it, and no prefix is shared
+    // past one of them.
+    size_t known_symbols = model->alphabet_translator.size();
+    size_t known_keys = lexicon->get_key_table()->size();
+    std::vector<BatchInput> inputs(lines.size());
+    std::vector<size_t> order;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        std::vector<char> buffer(lines[i].begin(), lines[i].end());
+        buffer.push_back('\0');
+        if (init_input(&buffer[0])) {
+            inputs[i].symbols = input;
+            inputs[i].unknown_symbols = unknown_symbols;
+            inputs[i].translations.assign(
+                alphabet_translator.begin() + known_symbols,
+                alphabet_translator.end());
+            inputs[i].keys.assign(output_keys.begin() + known_keys,
+                                  output_keys.end());
+            order.push_back(i);
+        }
+    }
+    InputOrder input_order = {&inputs};
+    std::sort(order.begin(), order.end(), input_order);
+    size_t cached_length = model->prefix_cache.get_max_length();
+    // The search up to the end of each prefix of the current line longer
+    // than the cached ones, as long as it is shared with another line.
+    // These are pruned by maxweight only, which is the same for every
+    // line. Without it nothing is pruned, and the search grows faster
+    // with the length of the prefix than the lines sharing it save, so
+    // then they only share the cached prefixes.
+    std::vector<std::shared_ptr<const CacheContainer> > shared;
+    // whether each of them is whole, which it isn't if the budgets of the
+    // line it was searched for ran out in it or in a shorter one
+    std::vector<bool> shared_whole;
+    for (size_t j = 0; j < order.size(); ++j) {
+        size_t i = order[j];
+        size_t from_previous = (j == 0) ? 0 :
+            shared_prefix_length(inputs[order[j - 1]].symbols,
+                                 inputs[i].symbols, known_symbols);
+        size_t to_next = (j + 1 == order.size()) ? 0 :
+            shared_prefix_length(inputs[i].symbols,
+                                 inputs[order[j + 1]].symbols, known_symbols);
+        // what the previous line went on with is no use for this one
+        while (shared.size() > 0 &&
+               cached_length + shared.size() > from_previous) {
+            shared.pop_back();
+            shared_whole.pop_back();
+        }
+        start_budget(time_cutoff);
+        // the line as it was read, with its own unknown symbols
+        forget_unknown_symbols();
+        input = inputs[i].symbols;
+        unknown_symbols = inputs[i].unknown_symbols;
+        alphabet_translator.insert(alphabet_translator.end(),
+                                   inputs[i].translations.begin(),
+                                   inputs[i].translations.end());
+        output_keys.insert(output_keys.end(), inputs[i].keys.begin(),
+                           inputs[i].keys.end());
+        set_limiting_behaviour(nbest, maxweight, beam);
+        mutator_bounds.clear();
+        std::shared_ptr<const CacheContainer> first = cached_search();
+        size_t length = std::max(from_previous, to_next);
+        bool whole = true;
+        if (maxweight >= 0.0 && length > resumed_state) {
+            Weight input_limit = limit;
+            limit = maxweight;
+            if (shared.size() > 0) {
+                first = shared.back();
+                whole = shared_whole.back();
+            }
+            while (cached_length + shared.size() < length) {
+                std::shared_ptr<CacheContainer> built(new CacheContainer);
+                whole = extend_cache(*first, *built, true) && whole;
+                shared.push_back(built);
+                shared_whole.push_back(whole);
+                first = built;
+            }
+            limit = input_limit;
+            resumed_state = static_cast<unsigned int>(length);
+        }
+        corrections[i] = correct_from(first, nbest, beam);
+        if (truncated != NULL) {
+            (*truncated)[i] = limit_reached || !whole;
+        }
+    }
+    return corrections;
+}
+
+void Speller::start_budget(float time_cutoff)
+{
     max_time = 0.0;
     if (time_cutoff > 0.0) {
         max_time = time_cutoff;
-        start_clock = clock();
-        call_counter = 0;
-        limit_reached = false;
+        deadline = std::chrono::steady_clock::now() +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(max_time));
+    }
+    expanded = 0;
+    limit_reached = false;
+}
+
+CorrectionQueue Speller::correct_from(
+    const std::shared_ptr<const CacheContainer> & first,
+    int nbest, Weight beam)
+{
+    nbest_queue.clear();
+    // one more, as a weight is added before the biggest is deleted
+    nbest_queue.reserve(nbest + 1);
+    // The queue for our suggestions
+    CorrectionQueue correction_queue;
+    if (input.size() <= 1) {
+        // get the cached results and we're done
+        const StringWeightVector * cached;
+        if (input.size() == 0) {
+            cached = &first->results_len_0;
+        } else {
+            cached = &first->results_len_1;
+        }
+        if (search == BestFirst) {
+            // give out the lightest ones in order, like correct_best_first
+            CorrectionQueue lightest_first(cached->begin(), cached->end());
+            while (lightest_first.size() > 0 &&
+                   (nbest == 0 ||
+                    correction_queue.size() < static_cast<size_t>(nbest))) {
+                best_suggestion = std::min(best_suggestion,
+                                           lightest_first.top().second);
+                adjust_weight_limits(nbest, beam);
+                if (lightest_first.top().second > limit) {
+                    break;
+                }
+                correction_queue.push(lightest_first.top());
+                lightest_first.pop();
+            }
+            return correction_queue;
+        }
+        for(auto& it : *cached) {
+              // First get the correct weight limit
+                best_suggestion = std::min(best_suggestion, it.second);
+                if (nbest > 0) {
+                    nbest_queue.push(it.second);
+                    if (nbest_queue.size() > nbest) {
+                        nbest_queue.pop();
+                    }
+                }
+            }
+        adjust_weight_limits(nbest, beam);
+        // Then collect the results
+        StringWeightVector corrections(*cached);
+        select_corrections(corrections, nbest, correction_queue);
+        return correction_queue;
+    } else {
+        // populate the tree node queue, continuing from the cached paths
+        paths.reset(&first->paths);
+        flags.reset(get_state_size(), &first->flags);
+        queue.assign(first->nodes.begin(), first->nodes.end());
+        results.reset(&paths, &output_keys);
+        model->mutator_bounds.compute(input, mutator_bounds);
+        if (prune_visited) {
+            visited.reset();
+        }
+    }
+    // TreeNode start_node(UNSET_FLAGS);
+    // queue.assign(1, start_node);
+
+    if (search == BestFirst && !mutator->has_negative_weights() &&
+        !lexicon->has_negative_weights()) {
+        // the corrections come out best first, so no filtering is needed,
+        // and the distances tell which nodes come first
+        lexicon->compute_distances_to_final();
+        correct_best_first(correction_queue, nbest, beam);
+        return correction_queue;
+    }
+    splitting = (threads > 1);
+    correct_depth_first(nbest, beam);
+    splitting = false;
+
+    // only the ones under the limit can make it, and the order of the
+    // strings decides between equal weights
+    StringWeightVector corrections;
+    if (queue.size() > 0 && !limit_reached) {
+        // it stopped to be split
+        correct_in_parallel(corrections, nbest, beam);
+    } else {
+        adjust_weight_limits(nbest, beam);
+        results.stringify(corrections, limit);
+    }
+    select_corrections(corrections, nbest, correction_queue);
+    return correction_queue;
+}
+
+// a node handed from one helper of a split search to another, with what
+// its output path and flag state add to the ones in the base both helpers
+// search on from
+struct SharedNode
+{
+    TreeNode node; // with the output and flag state in the base
+    SymbolVector output; // symbols after node.output, last one first
+    std::vector<ValueNumber> flag_values; // unless node.flag_state is kept
+
+    SharedNode(const TreeNode & tree_node):
+        node(tree_node)
+        {}
+};
+
+// what the helpers of a split search share
+struct ParallelSearch
+{
+    Speller * owner; // the speller whose search is split
+    int nbest;
+    Weight beam;
+    unsigned int workers; // number of helpers
+    // guards the rest, and the limits of owner, which are shared by all
+    std::mutex mutex;
+    std::condition_variable work_given;
+    std::vector<std::vector<SharedNode> > given; // nodes not yet taken
+    unsigned int idle; // helpers waiting for nodes
+    bool done; // whether the helpers are to stop waiting
+    StringWeightMap corrections; // least weight of each output found
+    // these are also read without the lock
+    std::atomic<unsigned int> hungry; // idle helpers no nodes are given for
+    std::atomic<Weight> limit; // limit of owner
+    std::atomic<unsigned long> expanded; // nodes taken by all helpers
+    std::atomic<bool> stopped; // whether a budget ran out
+};
+
+void Speller::correct_in_parallel(StringWeightVector & corrections,
+                                  int nbest, Weight beam)
+{
+    ParallelSearch shared;
+    shared.owner = this;
+    shared.nbest = nbest;
+    shared.beam = beam;
+    shared.workers = threads;
+    shared.idle = 0;
+    shared.done = false;
+    shared.hungry = 0;
+    shared.limit = limit;
+    shared.expanded = expanded;
+    shared.stopped = false;
+    StringWeightVector found;
+    results.stringify(found);
+    shared.corrections.insert(found.begin(), found.end());
+    while (helpers.size() < threads) {
+        helpers.push_back(std::unique_ptr<Speller>(new Speller(model)));
+    }
+    for (unsigned int i = 0; i < threads; ++i) {
+        helpers[i]->join_search(*this, shared);
+    }
+    // dealt in turn, so that each one starts with some of the lightest
+    for (size_t i = 0; i < queue.size(); ++i) {
+        helpers[i % threads]->queue.push_back(queue[i]);
+    }
+    queue.clear();
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < threads; ++i) {
+        workers.push_back(std::thread(&Speller::search_shared,
+                                      helpers[i].get(), nbest, beam));
+    }
+    helpers[0]->search_shared(nbest, beam);
+    for (auto& it : workers) {
+        it.join();
+    }
+    for (unsigned int i = 0; i < threads; ++i) {
+        helpers[i]->parallel = NULL;
+    }
+    expanded = shared.expanded;
+    limit_reached = shared.stopped;
+    adjust_weight_limits(nbest, beam);
+    corrections.clear();
+    for (auto& it : shared.corrections) {
+        if (it.second <= limit) {
+            corrections.push_back(it);
+        }
+    }
+}
+
+void Speller::join_search(Speller & owner, ParallelSearch & shared)
+{
+    parallel = &shared;
+    mode = Correct;
+    // the same input, with its unknown symbols numbered the same
+    forget_unknown_symbols();
+    input = owner.input;
+    unknown_symbols = owner.unknown_symbols;
+    alphabet_translator.insert(alphabet_translator.end(),
+                               owner.alphabet_translator.begin() +
+                               alphabet_translator.size(),
+                               owner.alphabet_translator.end());
+    output_keys.insert(output_keys.end(),
+                       owner.output_keys.begin() + output_keys.size(),
+                       owner.output_keys.end());
+    mutator_bounds = owner.mutator_bounds;
+    resumed_state = owner.resumed_state;
+    limiting = owner.limiting;
+    limit = owner.limit;
+    max_expanded = owner.max_expanded;
+    max_frontier = owner.max_frontier;
+    max_time = owner.max_time;
+    deadline = owner.deadline;
+    // each helper prunes what it reaches itself
+    prune_visited = owner.prune_visited;
+    if (prune_visited) {
+        visited.reset();
+    }
+    expanded = 0;
+    limit_reached = false;
+    splitting = false;
+    // The paths and flag states of the owner stay as they are until the
+    // helpers are done, so they go on from them like from a cache entry
+    paths.reset(&owner.paths);
+    flags.reset(get_state_size(), &owner.flags);
+    results.reset(&paths, &output_keys);
+    queue.clear();
+}
+
+void Speller::search_shared(int nbest, Weight beam)
+{
+    while (take_work()) {
+        correct_depth_first(nbest, beam);
+    }
+    parallel->expanded += expanded % DEADLINE_CHECK_INTERVAL;
+}
+
+bool Speller::take_work(void)
+{
+    std::vector<SharedNode> nodes;
+    {
+        std::unique_lock<std::mutex> lock(parallel->mutex);
+        if (queue.size() > 0 && !parallel->stopped) {
+            return true;
+        }
+        ++parallel->idle;
+        parallel->hungry = parallel->idle - std::min(
+            parallel->idle, static_cast<unsigned int>(parallel->given.size()));
+        while (parallel->given.empty() && !parallel->done) {
+            if (parallel->stopped || parallel->idle == parallel->workers) {
+                // no one has any nodes left to give
+                parallel->done = true;
+                parallel->work_given.notify_all();
+            } else {
+                parallel->work_given.wait(lock);
+            }
+        }
+        --parallel->idle;
+        if (parallel->given.empty() || parallel->stopped) {
+            parallel->done = true;
+            parallel->work_given.notify_all();
+            return false;
+        }
+        nodes.swap(parallel->given.back());
+        parallel->given.pop_back();
+        parallel->hungry = parallel->idle - std::min(
+            parallel->idle, static_cast<unsigned int>(parallel->given.size()));
+    }
+    queue.clear();
+    for (auto& it : nodes) {
+        TreeNode node = it.node;
+        for (size_t i = it.output.size(); i > 0; --i) {
+            node.output = paths.extend(node.output, it.output[i - 1]);
+        }
+        if (it.flag_values.size() > 0) {
+            node.flag_state = flags.intern(&it.flag_values[0]);
+        }
+        queue.push_back(node);
+    }
+    return true;
+}
+
+void Speller::give_work(void)
+{
+    if (queue.size() < 2) {
+        return;
+    }
+    // the oldest ones are the nearest to the start, with the most to search
+    // under them
+    size_t count = queue.size() / 2;
+    PathIndex path_base = paths.get_base_size();
+    FlagStateIndex flag_base = flags.get_base_size();
+    std::vector<SharedNode> nodes;
+    nodes.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        nodes.push_back(SharedNode(queue[i]));
+        SharedNode & shared = nodes.back();
+        while (shared.node.output != EMPTY_PATH &&
+               shared.node.output >= path_base) {
+            shared.output.push_back(paths.symbol(shared.node.output));
+            shared.node.output = paths.parent(shared.node.output);
+        }
+        if (shared.node.flag_state >= flag_base) {
+            const ValueNumber * values =
+                flags.get_values(shared.node.flag_state);
+            shared.flag_values.assign(values, values + get_state_size());
+        }
+    }
+    queue.erase(queue.begin(), queue.begin() + count);
+    std::lock_guard<std::mutex> lock(parallel->mutex);
+    parallel->given.push_back(std::vector<SharedNode>());
+    parallel->given.back().swap(nodes);
+    parallel->hungry = parallel->idle - std::min(
+        parallel->idle, static_cast<unsigned int>(parallel->given.size()));
+    parallel->work_given.notify_one();
+}
+
+void Speller::share_correction(PathIndex path, Weight weight)
+{
+    std::string correction = stringify(&output_keys, paths, path);
+    std::lock_guard<std::mutex> lock(parallel->mutex);
+    StringWeightMap::iterator found = parallel->corrections.find(correction);
+    Weight previous = std::numeric_limits<Weight>::max();
+    if (found != parallel->corrections.end()) {
+        if (found->second <= weight) {
+            return;
+        }
+        previous = found->second;
+        found->second = weight;
+    } else {
+        parallel->corrections[correction] = weight;
+    }
+    Speller * owner = parallel->owner;
+    owner->count_correction(weight, previous, parallel->nbest);
+    owner->adjust_weight_limits(parallel->nbest, parallel->beam);
+    parallel->limit = owner->limit;
+}
+
+bool Speller::out_of_shared_budget(size_t waiting)
+{
+    // the nodes are added up every DEADLINE_CHECK_INTERVAL, which is when
+    // the clock is looked at too
+    ++expanded;
+    if (expanded % DEADLINE_CHECK_INTERVAL == 0) {
+        unsigned long total = (parallel->expanded += DEADLINE_CHECK_INTERVAL);
+        if ((max_expanded > 0 && total > max_expanded) ||
+            (max_time > 0.0 &&
+             std::chrono::steady_clock::now() >= deadline)) {
+            parallel->stopped = true;
+        }
+    }
+    if (max_frontier > 0 && waiting > max_frontier) {
+        parallel->stopped = true;
+    }
+    if (parallel->hungry > 0) {
+        give_work();
+    }
+    return parallel->stopped;
+}
+
+bool Speller::out_of_budget(size_t waiting)
+{
+    if (parallel != NULL) {
+        return out_of_shared_budget(waiting);
+    }
+    if (limit_reached) {
+        return true;
+    }
+    ++expanded;
+    // the first node looks at the clock too, in case the cache took long
+    if ((max_expanded > 0 && expanded > max_expanded) ||
+        (max_frontier > 0 && waiting > max_frontier) ||
+        (max_time > 0.0 && expanded % DEADLINE_CHECK_INTERVAL == 1 &&
+         std::chrono::steady_clock::now() >= deadline)) {
+        limit_reached = true;
+    } else if (splitting && expanded > split_after) {
+        // not out of budget, but the rest is to be split among threads
+        return true;
+    }
+    return limit_reached;
+}
+
+bool Speller::add_correction(PathIndex path, Weight weight, int nbest)
+{
+    /* if the correction is novel or better than before, insert it
+     */
+    Weight previous;
+    if (!results.insert(path, weight, &previous)) {
+        return false;
+    }
+    if (parallel != NULL) {
+        share_correction(path, weight);
+        return true;
+    }
+    count_correction(weight, previous, nbest);
+    return true;
+}
+
+void Speller::count_correction(Weight weight, Weight previous, int nbest)
+{
+    best_suggestion = std::min(best_suggestion, weight);
+    if (nbest > 0) {
+        // The queue holds the n best weights of different corrections, so
+        // that the limit doesn't depend on the order they were found in.
+        // A correction that got better is only counted again if its old
+        // weight wasn't among them.
+        if (previous < std::numeric_limits<Weight>::max() &&
+            previous <= nbest_queue.get_highest()) {
+            nbest_queue.replace(previous, weight);
+        } else {
+            nbest_queue.push(weight);
+        }
+        if (nbest_queue.size() > static_cast<size_t>(nbest)) {
+            nbest_queue.pop();
+        }
     }
-    set_limiting_behaviour(nbest, maxweight, beam);
-    nbest_queue = WeightQueue();
-    // The queue for our suggestions
-    CorrectionQueue correction_queue;
-    // A placeholding map, only one weight per correction
-    std::map<std::string, Weight> corrections;
-    SymbolNumber first_input = (input.size() == 0) ? 0 : input[0];
-    if (cache[first_input].empty) {
-        build_cache(first_input);
+}
+
+// orders corrections by weight, and equal weights by string
+static bool
+lighter_correction(const StringWeightPair & lhs, const StringWeightPair & rhs)
+{
+    if (lhs.second != rhs.second) {
+        return lhs.second < rhs.second;
     }
-    if (input.size() <= 1) {
-        // get the cached results and we're done
-        StringWeightVector * results;
-        if (input.size() == 0) {
-            results = &cache[first_input].results_len_0;
-        } else {
-            results = &cache[first_input].results_len_1;
+    return lhs.first < rhs.first;
+}
+
+void Speller::select_corrections(StringWeightVector & corrections, int nbest,
+                                 CorrectionQueue & correction_queue)
+{
+    std::sort(corrections.begin(), corrections.end(), lighter_correction);
+    for (auto& it : corrections) {
+        if (nbest > 0 &&
+            correction_queue.size() >= static_cast<size_t>(nbest)) {
+            break;
         }
-        for(auto& it : *results) {
-              // First get the correct weight limit
-                best_suggestion = std::min(best_suggestion, it.second);
-                if (nbest > 0) {
-                    nbest_queue.push(it.second);
-                    if (nbest_queue.size() > nbest) {
-                        nbest_queue.pop();
-                    }
-                }
-            }
-        adjust_weight_limits(nbest, beam);
-        for(auto& it : *results) {
-              // Then collect the results
-            if (it.second <= limit && (nbest == 0 || // we either don't have an nbest condition or
-                                        (it.second <= nbest_queue.get_highest() && // we're below the worst nbest weight and
-                                         correction_queue.size() < nbest &&
-                                         nbest_queue.size() > 0))) { // number of results
-                correction_queue.push(StringWeightPair(it.first, it.second));
-                if (nbest != 0) {
-                    nbest_queue.pop();
-                }
-            }
+        if (it.second <= limit) {
+            correction_queue.push(it);
         }
-        return correction_queue;
-    } else {
-        // populate the tree node queue
-        queue.assign(cache[first_input].nodes.begin(), cache[first_input].nodes.end());
     }
-    // TreeNode start_node(FlagDiacriticState(get_state_size(), 0));
-    // queue.assign(1, start_node);
+}
+
+void Speller::correct_depth_first(int nbest, Weight beam)
+{
+    (this->*kernels->correct_depth_first)(nbest, beam);
+}
 
+template <class Features>
+void Speller::correct_depth_first(int nbest, Weight beam)
+{
     while (queue.size() > 0) {
-        // Have we spent too much time?
-        if (max_time > 0.0) {
-            ++call_counter;
-            if (limit_reached ||
-                (call_counter % 1000000 == 0 &&
-                 (((double)(clock() - start_clock)) / CLOCKS_PER_SEC) > max_time)) {
-                limit_reached = true;
-                break;
-            }
+        // Have we spent too much?
+        if (out_of_budget(queue.size())) {
+            break;
         }
         /*
           For depth-first searching, we save the back node now, remove it
@@ -948,22 +3099,22 @@ CorrectionQueue Speller::correct(char * line, int nbest,
         queue.pop_back();
         adjust_weight_limits(nbest, beam);
         // if we can't get an acceptable result, never mind
-        if (next_node.weight > limit) {
+        if (lower_bound<Features>(next_node) > limit) {
+            continue;
+        }
+        // nor if we've been here before for less
+        if (prune_visited && !visited.visit(next_node)) {
             continue;
         }
-        if (next_node.input_state > 1) {
+        if (next_node.input_state > resumed_state) {
             // Early epsilons were handled during the caching stage
-            lexicon_epsilons();
-            mutator_epsilons();
+            lexicon_epsilons<Features>();
+            mutator_epsilons<Features>();
         }
         if (next_node.input_state == input.size()) {
             /* if our transducers are in final states
              * we generate the correction
              */
-            if (!mutator->is_final(next_node.mutator_state)) {
-            }
-            if (!lexicon->is_final(next_node.lexicon_state)) {
-            }
             if (mutator->is_final(next_node.mutator_state) &&
                 lexicon->is_final(next_node.lexicon_state)) {
                 Weight weight = next_node.weight +
@@ -972,40 +3123,101 @@ CorrectionQueue Speller::correct(char * line, int nbest,
                 if (weight > limit) {
                     continue;
                 }
-                std::string string = stringify(lexicon->get_key_table(), next_node.string);
-                /* if the correction is novel or better than before, insert it
-                 */
-                if (corrections.count(string) == 0 ||
-                    corrections[string] > weight) {
-                    corrections[string] = weight;
-                    best_suggestion = std::min(best_suggestion, weight);
-                    if (nbest > 0) {
-                        nbest_queue.push(weight);
-                        if (nbest_queue.size() > nbest) {
-                            nbest_queue.pop();
-                        }
-                    }
-                }
+                add_correction(next_node.output, weight, nbest);
             }
         } else {
-            consume_input();
+            consume_input<Features>();
         }
     }
-    adjust_weight_limits(nbest, beam);
+}
 
-    for (auto& it : corrections) {
-        if (it.second <= limit && // we're not over our weight limit and
-            (nbest == 0 || // we either don't have an nbest condition or
-             (it.second <= nbest_queue.get_highest() && // we're below the worst nbest weight and
-              correction_queue.size() < nbest &&
-              nbest_queue.size() > 0))) { // number of results
-            correction_queue.push(StringWeightPair(it.first, it.second));
-            if (nbest != 0) {
-                nbest_queue.pop();
+void Speller::correct_best_first(CorrectionQueue & correction_queue,
+                                 int nbest, Weight beam)
+{
+    (this->*kernels->correct_best_first)(correction_queue, nbest, beam);
+}
+
+template <class Features>
+void Speller::correct_best_first(CorrectionQueue & correction_queue,
+                                 int nbest, Weight beam)
+{
+    /*
+      Without negative weights, nothing reachable from a node weighs less
+      than its lower bound. So when the least lower bound in the frontier
+      is w, every correction found so far that weighs at most w is the
+      best one for its string and can be given out in order of weight. We
+      are done when we have nbest of them or w is over the limit.
+    */
+    HeavierNode heavier_node;
+    frontier.clear();
+    for (auto& it : queue) {
+        frontier.push_back(BoundedNode(lower_bound<Features>(it), it));
+    }
+    std::make_heap(frontier.begin(), frontier.end(), heavier_node);
+    queue.clear();
+    // corrections found but not yet known to be the best ones, as their
+    // weights and paths, lightest on top
+    typedef std::pair<Weight, PathIndex> FoundCorrection;
+    std::priority_queue<FoundCorrection, std::vector<FoundCorrection>,
+                        std::greater<FoundCorrection> > found;
+    while (true) {
+        Weight lightest = frontier.empty() ?
+            std::numeric_limits<Weight>::max() : frontier.front().bound;
+        while (found.size() > 0 && found.top().first <= lightest &&
+               (nbest == 0 ||
+                correction_queue.size() < static_cast<size_t>(nbest))) {
+            adjust_weight_limits(nbest, beam);
+            // the first one found for a string is the best one
+            if (found.top().first <= limit &&
+                add_correction(found.top().second, found.top().first,
+                               nbest)) {
+                correction_queue.push(StringWeightPair(
+                                          stringify(&output_keys, paths,
+                                                    found.top().second),
+                                          found.top().first));
+            }
+            found.pop();
+        }
+        adjust_weight_limits(nbest, beam);
+        if (frontier.empty() || !is_under_weight_limit(lightest) ||
+            (nbest > 0 &&
+             correction_queue.size() >= static_cast<size_t>(nbest)) ||
+            out_of_budget(frontier.size())) {
+            break;
+        }
+        std::pop_heap(frontier.begin(), frontier.end(), heavier_node);
+        next_node = frontier.back().node;
+        frontier.pop_back();
+        // the first time a configuration is taken is the cheapest, as the
+        // bound only adds what depends on the configuration
+        if (prune_visited && !visited.visit(next_node)) {
+            continue;
+        }
+        if (next_node.input_state > resumed_state) {
+            // Early epsilons were handled during the caching stage
+            lexicon_epsilons<Features>();
+            mutator_epsilons<Features>();
+        }
+        if (next_node.input_state == input.size()) {
+            if (mutator->is_final(next_node.mutator_state) &&
+                lexicon->is_final(next_node.lexicon_state)) {
+                Weight weight = next_node.weight +
+                    lexicon->final_weight(next_node.lexicon_state) +
+                    mutator->final_weight(next_node.mutator_state);
+                if (weight <= limit) {
+                    found.push(FoundCorrection(weight, next_node.output));
+                }
             }
+        } else {
+            consume_input<Features>();
         }
+        // the traversal helpers add the new nodes to queue
+        for (auto& it : queue) {
+            frontier.push_back(BoundedNode(lower_bound<Features>(it), it));
+            std::push_heap(frontier.begin(), frontier.end(), heavier_node);
+        }
+        queue.clear();
     }
-    return correction_queue;
 }
 
 void Speller::set_limiting_behaviour(int nbest, Weight maxweight, Weight beam)
@@ -1036,6 +3248,11 @@ void Speller::set_limiting_behaviour(int nbest, Weight maxweight, Weight beam)
 
 void Speller::adjust_weight_limits(int nbest, Weight beam)
 {
+    if (parallel != NULL) {
+        // the owner of the split search keeps the limit
+        limit = parallel->limit;
+        return;
+    }
     if (limiting == Nbest && nbest_queue.size() >= nbest) {
         limit = nbest_queue.get_highest();
     } else if (limiting == MaxWeightNbest && nbest_queue.size() >= nbest) {
@@ -1064,29 +3281,348 @@ void Speller::adjust_weight_limits(int nbest, Weight beam)
     }
 }
 
+// a state of the language model and the input position it was reached at
+struct LexiconStep
+{
+    TransitionTableIndex state;
+    unsigned int input_state;
+};
+
+// how many steps Speller::walk_lexicon() can have yet to try
+static const size_t LEXICON_STACK_SIZE = 64;
+
+// push the targets of the transitions of @a lexicon with @a symbol from
+// @a state onto @a stack, and tell whether there was room for them
+static bool push_lexicon_arcs(const Transducer * lexicon,
+                              LexiconStep * stack, size_t & depth,
+                              TransitionTableIndex state, SymbolNumber symbol,
+                              unsigned int input_state)
+{
+    for (TransitionTableIndex next = lexicon->next(state, symbol);
+         lexicon->transitions.input_symbol(next) == symbol; ++next) {
+        if (depth == LEXICON_STACK_SIZE) {
+            return false;
+        }
+        stack[depth].state = lexicon->transitions.target(next);
+        stack[depth].input_state = input_state;
+        ++depth;
+    }
+    return true;
+}
+
+bool Speller::walk_lexicon(bool & accepted)
+{
+    SymbolNumber unknown = lexicon->get_unknown();
+    SymbolNumber identity = lexicon->get_identity();
+    SymbolNumber orig_symbol_count =
+        lexicon->get_alphabet()->get_orig_symbol_count();
+    if (model->check_walk == SpellerModel::DirectWalk) {
+        TransitionTableIndex state = 0;
+        for (unsigned int i = 0; i < input.size(); ++i) {
+            SymbolNumber symbol = (mutator != NULL) ?
+                alphabet_translator[input[i]] : input[i];
+            if (!lexicon->has_transitions(state + 1, symbol)) {
+                bool by_unknown = symbol >= orig_symbol_count &&
+                    lexicon->has_transitions(state + 1, unknown);
+                bool by_identity = symbol >= orig_symbol_count &&
+                    lexicon->has_transitions(state + 1, identity);
+                if (by_unknown && by_identity) {
+                    return false;
+                }
+                if (!by_unknown && !by_identity) {
+                    accepted = false;
+                    return true;
+                }
+                symbol = by_unknown ? unknown : identity;
+            }
+            state = lexicon->transitions.target(lexicon->next(state, symbol));
+        }
+        accepted = lexicon->is_final(state);
+        return true;
+    }
+    LexiconStep stack[LEXICON_STACK_SIZE];
+    size_t depth = 1;
+    stack[0].state = 0;
+    stack[0].input_state = 0;
+    while (depth > 0) {
+        LexiconStep step = stack[--depth];
+        if (step.input_state == input.size() &&
+            lexicon->is_final(step.state)) {
+            accepted = true;
+            return true;
+        }
+        if (lexicon->has_epsilons(step.state + 1) &&
+            !push_lexicon_arcs(lexicon, stack, depth, step.state, 0,
+                               step.input_state)) {
+            return false;
+        }
+        if (step.input_state >= input.size()) {
+            continue;
+        }
+        SymbolNumber symbol = (mutator != NULL) ?
+            alphabet_translator[input[step.input_state]] :
+            input[step.input_state];
+        if (lexicon->has_transitions(step.state + 1, symbol)) {
+            if (!push_lexicon_arcs(lexicon, stack, depth, step.state, symbol,
+                                   step.input_state + 1)) {
+                return false;
+            }
+            continue;
+        }
+        if (symbol < orig_symbol_count) {
+            continue;
+        }
+        if ((lexicon->has_transitions(step.state + 1, unknown) &&
+             !push_lexicon_arcs(lexicon, stack, depth, step.state, unknown,
+                                step.input_state + 1)) ||
+            (lexicon->has_transitions(step.state + 1, identity) &&
+             !push_lexicon_arcs(lexicon, stack, depth, step.state, identity,
+                                step.input_state + 1))) {
+            return false;
+        }
+    }
+    accepted = false;
+    return true;
+}
+
 bool Speller::check(char * line)
 {
     mode = Check;
     if (!init_input(line)) {
         return false;
     }
-    TreeNode start_node(FlagDiacriticState(get_state_size(), 0));
+    bool accepted;
+    if (model->check_walk != SpellerModel::GeneralWalk &&
+        walk_lexicon(accepted)) {
+        return accepted;
+    }
+    TreeNode start_node(UNSET_FLAGS);
+    paths.reset();
+    flags.reset(get_state_size());
     queue.assign(1, start_node);
     limit = std::numeric_limits<Weight>::max();
+    return lookup_queue(true);
+}
 
-    while (queue.size() > 0) {
-        next_node = queue.back();
-        queue.pop_back();
-        if (next_node.input_state == input.size() &&
-            lexicon->is_final(next_node.lexicon_state)) {
+CheckSession::CheckSession(SpellerModel * model_ptr):
+    model(model_ptr),
+    lexicon(model_ptr->lexicon),
+    encoder((model_ptr->mutator != NULL) ?
+            model_ptr->mutator->get_encoder() :
+            model_ptr->lexicon->get_encoder()),
+    lookahead(4)
+{
+    // the distances to final states tell which configurations are dead ends
+    lexicon->compute_distances_to_final();
+    // An input symbol is the longest one matching where it starts, or
+    // else one character of at most four bytes.
+    Transducer * tokenizer = (model->mutator != NULL) ?
+        model->mutator : lexicon;
+    KeyTable * keys = tokenizer->get_key_table();
+    for (SymbolNumber i = 0;
+         i < tokenizer->input_symbol_count() && i < keys->size(); ++i) {
+        lookahead = std::max(lookahead, (*keys)[i].size());
+    }
+    reset();
+}
+
+void CheckSession::reach(TransitionTableIndex state,
+                         FlagStateIndex flag_state)
+{
+    if (!(lexicon->distance_to_final(state) <
+          std::numeric_limits<Weight>::infinity())) {
+        return;
+    }
+    if (!reached.insert((static_cast<uint64_t>(state) << 32) |
+                        flag_state).second) {
+        return;
+    }
+    Configuration configuration = {state, flag_state};
+    configurations.push_back(configuration);
+}
+
+void CheckSession::follow_epsilons(size_t begin)
+{
+    for (size_t i = begin; i < configurations.size(); ++i) {
+        // reach() may move the configurations
+        Configuration from = configurations[i];
+        if (!lexicon->has_epsilons_or_flags(from.state + 1)) {
+            continue;
+        }
+        TransitionTableIndex next = lexicon->next(from.state, 0);
+        STransition i_s = lexicon->take_epsilons_and_flags(next);
+        while (i_s.symbol != NO_SYMBOL) {
+            SymbolNumber input_symbol = lexicon->transitions.input_symbol(next);
+            if (input_symbol == 0) {
+                reach(i_s.index, from.flag_state);
+            } else {
+                FlagStateIndex flag_state = flags.apply(
+                    from.flag_state, input_symbol, lexicon->get_operation_vector());
+                if (flag_state != NO_FLAG_STATE) {
+                    reach(i_s.index, flag_state);
+                }
+            }
+            ++next;
+            i_s = lexicon->take_epsilons_and_flags(next);
+        }
+    }
+}
+
+void CheckSession::advance(SymbolNumber symbol, size_t text_end)
+{
+    size_t begin = (checkpoints.size() > 1) ?
+        checkpoints[checkpoints.size() - 2].configurations_end : 0;
+    size_t end = checkpoints.back().configurations_end;
+    SymbolNumber unknown = lexicon->get_unknown();
+    SymbolNumber identity = lexicon->get_identity();
+    bool maybe_unknown =
+        symbol >= lexicon->get_alphabet()->get_orig_symbol_count();
+    reached.clear();
+    for (size_t i = begin; i < end; ++i) {
+        Configuration from = configurations[i];
+        SymbolNumber taken[3] = {symbol, NO_SYMBOL, NO_SYMBOL};
+        if (!lexicon->has_transitions(from.state + 1, symbol)) {
+            taken[0] = NO_SYMBOL;
+            if (maybe_unknown) {
+                // this input was not originally in the alphabet, so
+                // unknown or identity may apply
+                taken[1] = unknown;
+                taken[2] = identity;
+            }
+        }
+        for (int k = 0; k < 3; ++k) {
+            if (!lexicon->has_transitions(from.state + 1, taken[k])) {
+                continue;
+            }
+            for (TransitionTableIndex next = lexicon->next(from.state,
+                                                           taken[k]);
+                 lexicon->transitions.input_symbol(next) == taken[k];
+                 ++next) {
+                reach(lexicon->transitions.target(next), from.flag_state);
+            }
+        }
+    }
+    follow_epsilons(end);
+    Checkpoint checkpoint = {text_end, configurations.size()};
+    checkpoints.push_back(checkpoint);
+}
+
+void CheckSession::tokenize(void)
+{
+    // as Speller::init_input() does, but going on after what it can't
+    // tokenize, so that the checkpoints cover all of the input
+    size_t start = checkpoints.back().text_end;
+    while (start < text.size()) {
+        char * pointer = const_cast<char *>(text.c_str()) + start;
+        SymbolNumber k = encoder->find_key(&pointer);
+        size_t end = pointer - text.c_str();
+        if (k != NO_SYMBOL) {
+            advance((model->mutator != NULL) ?
+                    model->alphabet_translator[k] : k, end);
+        } else {
+            size_t bytes = nByte_utf8(static_cast<unsigned char>(text[start]));
+            if (bytes == 0 || start + bytes > text.size()) {
+                // not a character, or not yet, so nothing from here on is
+                // accepted
+                Checkpoint checkpoint = {text.size(), configurations.size()};
+                checkpoints.push_back(checkpoint);
+                return;
+            }
+            // a character the encoder doesn't know may still be a symbol of
+            // the lexicon, as in Speller::add_unknown_symbol()
+            StringSymbolMap * lexicon_symbols =
+                lexicon->get_alphabet()->get_string_to_symbol();
+            StringSymbolMap::const_iterator in_lexicon =
+                lexicon_symbols->find(text.substr(start, bytes));
+            advance((in_lexicon != lexicon_symbols->end()) ?
+                    in_lexicon->second : NO_SYMBOL, start + bytes);
+        }
+        start = checkpoints.back().text_end;
+    }
+}
+
+void CheckSession::rewind(size_t common)
+{
+    while (checkpoints.size() > 1 &&
+           checkpoints[checkpoints.size() - 2].text_end + lookahead >
+           common) {
+        checkpoints.pop_back();
+        configurations.resize(checkpoints.back().configurations_end);
+    }
+}
+
+void CheckSession::reset(void)
+{
+    text.clear();
+    configurations.clear();
+    checkpoints.clear();
+    flags.reset(lexicon->get_state_size());
+    reached.clear();
+    reach(0, UNSET_FLAGS);
+    follow_epsilons(0);
+    Checkpoint checkpoint = {0, configurations.size()};
+    checkpoints.push_back(checkpoint);
+}
+
+void CheckSession::set_text(const std::string & new_text)
+{
+    size_t common = 0;
+    while (common < text.size() && common < new_text.size() &&
+           text[common] == new_text[common]) {
+        ++common;
+    }
+    rewind(common);
+    text = new_text;
+    tokenize();
+}
+
+void CheckSession::append(const std::string & more)
+{
+    rewind(text.size());
+    text.append(more);
+    tokenize();
+}
+
+void CheckSession::backspace(void)
+{
+    if (text.empty()) {
+        return;
+    }
+    // back over the continuation bytes to where the character starts
+    size_t length = text.size() - 1;
+    while (length > 0 && (static_cast<unsigned char>(text[length]) & 0xC0) ==
+           0x80) {
+        --length;
+    }
+    rewind(length);
+    text.resize(length);
+    tokenize();
+}
+
+const std::string & CheckSession::get_text(void) const
+{
+    return text;
+}
+
+bool CheckSession::check(void) const
+{
+    size_t begin = (checkpoints.size() > 1) ?
+        checkpoints[checkpoints.size() - 2].configurations_end : 0;
+    for (size_t i = begin; i < checkpoints.back().configurations_end; ++i) {
+        if (lexicon->is_final(configurations[i].state)) {
             return true;
         }
-        lexicon_epsilons();
-        lexicon_consume();
     }
     return false;
 }
 
+bool CheckSession::viable(void) const
+{
+    size_t begin = (checkpoints.size() > 1) ?
+        checkpoints[checkpoints.size() - 2].configurations_end : 0;
+    return checkpoints.back().configurations_end > begin;
+}
+
 std::string stringify(KeyTable * key_table,
                       SymbolVector & symbol_vector)
 {
@@ -1111,7 +3647,25 @@ std::vector<std::string> symbolify(KeyTable * key_table,
     return s;
 }
 
-void Speller::build_alphabet_translator(void)
+std::string stringify(KeyTable * key_table,
+                      const OutputArena & paths,
+                      PathIndex path)
+{
+    SymbolVector symbol_vector;
+    paths.materialize(path, symbol_vector);
+    return stringify(key_table, symbol_vector);
+}
+
+std::vector<std::string> symbolify(KeyTable * key_table,
+                                   const OutputArena & paths,
+                                   PathIndex path)
+{
+    SymbolVector symbol_vector;
+    paths.materialize(path, symbol_vector);
+    return symbolify(key_table, symbol_vector);
+}
+
+void SpellerModel::build_alphabet_translator(void)
 {
     TransducerAlphabet * from = mutator->get_alphabet();
     TransducerAlphabet * to = lexicon->get_alphabet();
@@ -1137,64 +3691,244 @@ void Speller::build_alphabet_translator(void)
     }
 }
 
+// builds the entries for the first symbols taken from @a next until
+// there are none left
+static void
+warm_up_worker(SpellerModel * model,
+               const std::vector<SymbolNumber> * first_symbols,
+               std::atomic<size_t> * next)
+{
+    Speller speller(model);
+    for (size_t i = (*next)++; i < first_symbols->size(); i = (*next)++) {
+        speller.warm_up_cache((*first_symbols)[i]);
+    }
+}
+
+void SpellerModel::warm_up_cache(unsigned int threads)
+{
+    if (mutator == NULL) {
+        return;
+    }
+    // the empty input, and then the symbols the input is made of
+    std::vector<SymbolNumber> first_symbols(1, 0);
+    for (SymbolNumber i = 1; i < mutator->input_symbol_count(); ++i) {
+        if (!mutator->get_alphabet()->is_flag(i)) {
+            first_symbols.push_back(i);
+        }
+    }
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threads = static_cast<unsigned int>(
+        std::min(static_cast<size_t>(threads), first_symbols.size()));
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (unsigned int i = 1; i < threads; ++i) {
+        workers.push_back(std::thread(warm_up_worker, this, &first_symbols,
+                                      &next));
+    }
+    warm_up_worker(this, &first_symbols, &next);
+    for (auto& it : workers) {
+        it.join();
+    }
+}
+
+// what comes first in a cache file
+struct CacheFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; // CACHE_FILE_BYTE_ORDER as written
+    uint64_t fingerprint; // cache_fingerprint() of the automata
+    uint64_t size; // bytes of entries following
+    uint64_t checksum; // hash_bytes() of the entries
+};
+
+static const char CACHE_FILE_MAGIC[8] = {'O', 'S', 'P', 'C', 'A', 'C', 'H', 'E'};
+static const uint32_t CACHE_FILE_VERSION = 2;
+static const uint32_t CACHE_FILE_BYTE_ORDER = 0x01020304;
+
+// tells the automata of @a model apart by their sizes and checksums, and
+// the layout of the entries by the sizes of what they are made of
+static uint64_t
+cache_fingerprint(const SpellerModel & model)
+{
+    size_t layout[] = {sizeof(TreeNode), sizeof(SymbolNumber),
+                       sizeof(PathIndex), sizeof(FlagStateIndex),
+                       sizeof(ValueNumber), sizeof(Weight)};
+    uint64_t hash = hash_bytes(HASH_BASIS, layout, sizeof(layout));
+    Transducer * automata[] = {model.mutator, model.lexicon};
+    for (auto& it : automata) {
+        uint64_t checksum = it->get_checksum();
+        hash = hash_word(hash, it->index_table_size());
+        hash = hash_word(hash, it->transition_table_size());
+        hash = hash_bytes(hash, &checksum, sizeof(checksum));
+    }
+    return hash_bytes(hash, model.alphabet_translator.data(),
+                      model.alphabet_translator.size() * sizeof(SymbolNumber));
+}
+
+bool SpellerModel::save_cache(const std::string & filename) const
+{
+    if (mutator == NULL) {
+        return false;
+    }
+    std::vector<char> entries;
+    prefix_cache.write(entries);
+    CacheFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_FILE_VERSION;
+    header.byte_order = CACHE_FILE_BYTE_ORDER;
+    header.fingerprint = cache_fingerprint(*this);
+    header.size = entries.size();
+    header.checksum = hash_bytes(HASH_BASIS, entries.data(), entries.size());
+    // written under a name of its own and renamed into place, so that a
+    // speller starting meanwhile never reads half a file and two savers
+    // don't write into the same one
+#if HAVE_MKSTEMP
+    std::string temporary = filename + ".XXXXXX";
+    int fd = mkstemp(&temporary[0]);
+    if (fd < 0) {
+        return false;
+    }
+    fchmod(fd, 0644);
+    FILE * f = fdopen(fd, "wb");
+    if (f == NULL) {
+        close(fd);
+        remove(temporary.c_str());
+        return false;
+    }
+#else
+    std::string temporary = filename + ".tmp";
+    FILE * f = fopen(temporary.c_str(), "wb");
+    if (f == NULL) {
+        return false;
+    }
+#endif
+    bool written = (fwrite(&header, sizeof(header), 1, f) == 1) &&
+        (fwrite(entries.data(), 1, entries.size(), f) == entries.size());
+    if ((fclose(f) != 0) || !written ||
+        (rename(temporary.c_str(), filename.c_str()) != 0)) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SpellerModel::load_cache(const std::string & filename)
+{
+    if (mutator == NULL) {
+        return false;
+    }
+    try {
+        MappedFile file(filename);
+        char * raw = file.get_data();
+        const char * end = raw + file.get_size();
+        CacheFileHeader header;
+        if (!read_value(&raw, end, header) ||
+            (memcmp(header.magic, CACHE_FILE_MAGIC,
+                    sizeof(header.magic)) != 0) ||
+            (header.version != CACHE_FILE_VERSION) ||
+            (header.byte_order != CACHE_FILE_BYTE_ORDER) ||
+            (header.fingerprint != cache_fingerprint(*this)) ||
+            (header.size != static_cast<size_t>(end - raw)) ||
+            (header.checksum != hash_bytes(HASH_BASIS, raw, header.size))) {
+            return false;
+        }
+        return prefix_cache.read(&raw, end);
+    }
+    catch (const FileMappingException &) {
+        return false;
+    }
+}
+
 bool Speller::init_input(char * line)
 {
     // Initialize the symbol vector to the tokenization given by encoder.
     // In the case of tokenization failure, valid utf-8 characters
     // are tokenized as unknown and tokenization is reattempted from
     // such a character onwards. The empty string is tokenized as an
-    // empty vector; there is no end marker.
+    // empty vector; there is no end marker. The unknown characters are
+    // only known for the length of this input, so the tables stay as
+    // big as the longest input needs.
     input.clear();
+    forget_unknown_symbols();
     SymbolNumber k = NO_SYMBOL;
     char ** inpointer = &line;
     char * oldpointer;
+    Encoder * encoder = (mutator != NULL) ? mutator->get_encoder() :
+                                            lexicon->get_encoder();
 
     while (**inpointer != '\0') {
         oldpointer = *inpointer;
-        if (mutator != NULL) {
-            k = mutator->get_encoder()->find_key(inpointer);
-        } else {
-            k = lexicon->get_encoder()->find_key(inpointer);
-        }
+        k = encoder->find_key(inpointer);
         if (k == NO_SYMBOL) { // no tokenization from alphabet
             int bytes_to_tokenize = nByte_utf8(static_cast<unsigned char>(*oldpointer));
             if (bytes_to_tokenize == 0) {
                 return false; // can't parse utf-8 character, admit failure
-            } else {
-                char new_symbol[5]; // max size plus NUL
-                memcpy(new_symbol, oldpointer, bytes_to_tokenize);
-                new_symbol[bytes_to_tokenize] = '\0';
-                std::string new_symbol_string(new_symbol);
-                oldpointer += bytes_to_tokenize;
-                *inpointer = oldpointer;
-                cache.push_back(CacheContainer());
-                if (!lexicon->get_alphabet()->has_string(new_symbol_string)) {
-                    lexicon->get_alphabet()->add_symbol(new_symbol_string);
-                }
-                SymbolNumber k_lexicon = lexicon->get_alphabet()->get_string_to_symbol()
-                    ->operator[](new_symbol_string);
-                lexicon->get_encoder()->read_input_symbol(new_symbol, k_lexicon);
-                if (mutator != NULL) {
-                    if (!mutator->get_alphabet()->has_string(new_symbol_string)) {
-                        mutator->get_alphabet()->add_symbol(new_symbol_string);
-                    }
-                    k = mutator->get_alphabet()->get_string_to_symbol()->
-                        operator[](new_symbol_string);
-                    mutator->get_encoder()->read_input_symbol(new_symbol, k);
-                    if (k >= alphabet_translator.size()) {
-                        add_symbol_to_alphabet_translator(k_lexicon);
-                    }
-                }
-                input.push_back(k);
-                continue;
             }
-        } else {
-            input.push_back(k);
+            std::string new_symbol_string(oldpointer, bytes_to_tokenize);
+            *inpointer = oldpointer + bytes_to_tokenize;
+            k = add_unknown_symbol(new_symbol_string);
+            if (k == NO_SYMBOL) {
+                return false; // too many different ones to number
+            }
         }
+        input.push_back(k);
     }
     return true;
 }
 
+SymbolNumber Speller::add_unknown_symbol(const std::string & symbol)
+{
+    // The model is shared, so the symbol is only added to our copies of
+    // its tables, after the symbols of the model
+    StringSymbolMap::const_iterator known = unknown_symbols.find(symbol);
+    if (known != unknown_symbols.end()) {
+        return known->second;
+    }
+    if (output_keys.size() >= NO_SYMBOL ||
+        alphabet_translator.size() >= NO_SYMBOL) {
+        return NO_SYMBOL;
+    }
+    StringSymbolMap * lexicon_symbols =
+        lexicon->get_alphabet()->get_string_to_symbol();
+    StringSymbolMap::const_iterator in_lexicon = lexicon_symbols->find(symbol);
+    SymbolNumber k_lexicon;
+    if (in_lexicon != lexicon_symbols->end()) {
+        k_lexicon = in_lexicon->second;
+    } else {
+        k_lexicon = static_cast<SymbolNumber>(output_keys.size());
+        output_keys.push_back(symbol);
+    }
+    SymbolNumber k = k_lexicon;
+    if (mutator != NULL) {
+        StringSymbolMap * mutator_symbols =
+            mutator->get_alphabet()->get_string_to_symbol();
+        StringSymbolMap::const_iterator in_mutator =
+            mutator_symbols->find(symbol);
+        if (in_mutator != mutator_symbols->end()) {
+            k = in_mutator->second;
+        } else {
+            k = static_cast<SymbolNumber>(alphabet_translator.size());
+            add_symbol_to_alphabet_translator(k_lexicon);
+        }
+    }
+    unknown_symbols[symbol] = k;
+    return k;
+}
+
+void Speller::forget_unknown_symbols(void)
+{
+    if (unknown_symbols.empty()) {
+        return;
+    }
+    unknown_symbols.clear();
+    alphabet_translator.resize(model->alphabet_translator.size());
+    output_keys.resize(lexicon->get_key_table()->size());
+}
+
 void Speller::add_symbol_to_alphabet_translator(SymbolNumber to_sym)
 {
     alphabet_translator.push_back(to_sym);
@@ -20,10 +20,15 @@
 #include <string>
 #include <deque>
 #include <queue>
-#include <list>
 #include <stdexcept>
 #include <limits>
-#include <ctime>
+#include <chrono>
+#include <list>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include "hfst-ol.h"
 
 namespace hfst_ol {
@@ -40,6 +45,15 @@ typedef std::pair<std::pair<std::string, std::string>, Weight>
                                                         StringPairWeightPair;
 typedef std::vector<TreeNode> TreeNodeVector;
 typedef std::map<std::string, Weight> StringWeightMap;
+typedef uint32_t PathIndex;
+typedef uint32_t FlagStateIndex;
+
+//! the output path with no symbols
+const PathIndex EMPTY_PATH = UINT_MAX;
+//! the flag state with every feature unset, first in every pool
+const FlagStateIndex UNSET_FLAGS = 0;
+//! the result of a flag operation that fails
+const FlagStateIndex NO_FLAG_STATE = UINT_MAX;
 
 //! Contains low-level processing stuff.
 struct STransition{
@@ -173,14 +187,48 @@ typedef std::priority_queue<SymbolsWeightPair,
                             std::vector<SymbolsWeightPair>,
                             SymbolsWeightComparison> AnalysisSymbolsQueue;
 
-struct WeightQueue: public std::list<Weight>
+//! @brief weights of the n best results, for the limits.
+
+//! Kept as a max-heap in a vector, so that the biggest weight is at hand
+//! and adding and deleting take logarithmic time without allocating once
+//! the vector has grown to size. The lowest weight is tracked on the side.
+class WeightQueue
 {
+private:
+    std::vector<Weight> heap; //!< the weights, biggest first
+    Weight lowest; //!< the lowest weight
+public:
+    WeightQueue(void):
+        lowest(std::numeric_limits<Weight>::max())
+        {}
     void push(Weight w); // add a new weight
     void pop(void); // delete the biggest weight
-    Weight get_lowest(void) const;
-    Weight get_highest(void) const;
+    void replace(Weight old_w, Weight new_w); // make one old_w into new_w
+    void clear(void); // delete all weights, keeping the memory
+    void reserve(size_t capacity); // make room for capacity weights
+    size_t size(void) const
+    {
+        return heap.size();
+    }
+    Weight get_lowest(void) const
+    {
+        return lowest;
+    }
+    Weight get_highest(void) const
+    {
+        if (heap.empty()) {
+            return std::numeric_limits<Weight>::max();
+        }
+        return heap.front();
+    }
 };
 
+//! Properties of a position in the index or transition table, as seen by
+//! a state starting there, each kept as a bitset over the positions once
+//! compute_state_properties() has been called.
+enum StateProperty {StateIsFinal, StateHasEpsilons, StateHasFlags,
+                    StateHasNonEpsilons, STATE_PROPERTY_COUNT};
+
 //! Internal class for Transducer processing.
 
 //! Contains low-level processing stuff.
@@ -191,8 +239,83 @@ protected:
     TransducerAlphabet alphabet; //!< alphabet data
     KeyTable * keys; //!< key symbol mappings
     Encoder encoder; //!< encoder to convert the strings
+    MappedFile * mapping; //!< memory the tables are borrowed from, if owned
+    //! the tables are scanned for the next two the first time either is
+    //! asked for
+    mutable std::once_flag tables_scanned;
+    mutable bool negative_weights; //!< whether any weight is below zero
+    //! whether every input symbol has at most one transition from each
+    //! state, and no state has epsilon transitions
+    mutable bool input_deterministic;
+    //! least weight from each index table position to a final state
+    mutable std::vector<Weight> index_distances;
+    //! least weight from each transition table position to a final state
+    mutable std::vector<Weight> transition_distances;
+    mutable std::once_flag distances_computed;
+    //! whether the distances above can be read
+    mutable std::atomic<bool> distances_ready;
+    //! transducer_checksum() of the tables, found the first time it is
+    //! asked for unless the header has it
+    mutable std::once_flag checksum_computed;
+    mutable uint64_t checksum;
+    //! a bitset for each StateProperty, over the positions numbered as in
+    //! state_position()
+    mutable std::vector<uint64_t> state_bits[STATE_PROPERTY_COUNT];
+    //! final weight of each position, infinite where it isn't final
+    mutable std::vector<Weight> final_weights;
+    mutable std::once_flag properties_computed;
+    //! whether the bitsets and final weights above can be read
+    mutable std::atomic<bool> properties_ready;
+    //! whether take_found_non_epsilons() can read the transition table as
+    //! arrays without bounds checks, see check_arrays()
+    bool unchecked_arrays;
 
     static const TransitionTableIndex START_INDEX = 0; //!< position of first
+    //!
+    //! find out whether there are negative weights and whether the
+    //! transducer is input deterministic
+    void scan_tables(void) const;
+    //!
+    //! fill in the least weight to a final state for every table position
+    void find_distances_to_final(void) const;
+    //!
+    //! fill in the state bitsets and the final weights
+    void find_state_properties(void) const;
+    //!
+    //! index into the state bitsets and final weights of table position
+    //! @a i, which are index table positions as they are, then transition
+    //! table positions, each table with the entry past its end, and then
+    //! one for any position outside the tables
+    size_t state_position(const TransitionTableIndex i) const
+    {
+        size_t outside = final_weights.size() - 1;
+        if (i >= TARGET_TABLE) {
+            size_t k = i - TARGET_TABLE;
+            return (k <= transitions.get_size()) ?
+                indices.get_size() + 1 + k : outside;
+        }
+        return (i <= indices.get_size()) ? i : outside;
+    }
+    //!
+    //! whether table position @a i has @a property, once the bitsets are
+    //! ready
+    bool state_has(StateProperty property, const TransitionTableIndex i) const
+    {
+        size_t position = state_position(i);
+        return (state_bits[property][position >> 6] >> (position & 63)) & 1;
+    }
+    //!
+    //! fill in the checksum of the tables
+    void compute_checksum(void) const;
+    //!
+    //! whether both tables are native arrays with their entries past the
+    //! end in place, and every transition on a symbol that goes to the
+    //! transition table goes to a position within it
+    bool check_arrays(void) const;
+    //!
+    //! read transducer from raw data @a raw, with the tables ending before
+    //! @a end unless it is NULL
+    Transducer(char * raw, bool borrow_tables, const char * end);
   
 public:
     //! 
@@ -201,6 +324,17 @@ public:
     //!
     //! read transducer from raw dara @a data
     Transducer(char * raw);
+    //!
+    //! read transducer from raw data @a raw, using tables in host byte
+    //! order in place without copying if @a borrow_tables is set. The
+    //! caller keeps ownership of @a raw, which must outlive the transducer.
+    Transducer(char * raw, bool borrow_tables);
+    //!
+    //! read transducer from @a file, borrowing tables in host byte order
+    //! from it without copying. The tables must fit in @a file. The
+    //! transducer takes ownership of @a file.
+    Transducer(MappedFile * file);
+    ~Transducer(void);
     IndexTable indices; //!< index table
     TransitionTable transitions; //!< transition table
     //!
@@ -229,6 +363,19 @@ public:
     //! get size of a state
     unsigned int get_state_size(void);
     //!
+    //! number of symbols an input can be made of, which come first
+    SymbolNumber input_symbol_count(void);
+    //!
+    //! number of positions in the index table
+    TransitionTableIndex index_table_size(void) const;
+    //!
+    //! number of positions in the transition table
+    TransitionTableIndex transition_table_size(void) const;
+    //!
+    //! transducer_checksum() of the automaton, as stored when it was
+    //! converted to the native format, or else found once from the tables
+    uint64_t get_checksum(void) const;
+    //!
     //! get position of the ? symbols
     SymbolNumber get_unknown(void) const;
     SymbolNumber get_identity(void) const;
@@ -236,7 +383,11 @@ public:
     //! get alphabet of automaton
     TransducerAlphabet * get_alphabet(void);
     //!
-    //! get flag stuff of automaton
+    //! get flag stuff of automaton, indexed by symbol
+    const OperationVector * get_operation_vector(void) const;
+    //!
+    //! get flag stuff of automaton. Deprecated, get_operation_vector() gives
+    //! the same without a map
     OperationMap * get_operations(void);
     //!
     //! follow epsilon transitions from index
@@ -249,6 +400,24 @@ public:
     STransition take_non_epsilons(const TransitionTableIndex i,
                                   const SymbolNumber symbol) const;
     //!
+    //! take_non_epsilons() for @a i reached from next() on a @a symbol that
+    //! has_transitions() found, and the positions after it up to the
+    //! first one with another symbol. Native tables checked at load are
+    //! read straight from their arrays, the others as take_non_epsilons().
+    STransition take_found_non_epsilons(const TransitionTableIndex i,
+                                        const SymbolNumber symbol) const
+    {
+        if (!unchecked_arrays) {
+            return take_non_epsilons(i, symbol);
+        }
+        if (transitions.array_input_symbol(i) != symbol) {
+            return STransition(0, NO_SYMBOL);
+        }
+        return STransition(transitions.array_target(i),
+                           transitions.array_output_symbol(i),
+                           transitions.array_weight(i));
+    }
+    //!
     //! get next index
     TransitionTableIndex next(const TransitionTableIndex i,
                               const SymbolNumber symbol) const;
@@ -260,48 +429,450 @@ public:
     bool has_transitions(const TransitionTableIndex i,
                          const SymbolNumber symbol) const;
     //!
+    //! whether state has epsilons
+    bool has_epsilons(const TransitionTableIndex i) const
+    {
+        if (properties_ready.load(std::memory_order_acquire)) {
+            return state_has(StateHasEpsilons, i);
+        }
+        if (i >= TARGET_TABLE) {
+            return transitions.input_symbol(i - TARGET_TABLE) == 0;
+        } else {
+            return indices.input_symbol(i) == 0;
+        }
+    }
+    //!
     //! whether state has epsilon s or flag s
-    bool has_epsilons_or_flags(const TransitionTableIndex i);
+    bool has_epsilons_or_flags(const TransitionTableIndex i) const
+    {
+        if (properties_ready.load(std::memory_order_acquire)) {
+            return state_has(StateHasEpsilons, i) ||
+                state_has(StateHasFlags, i);
+        }
+        if (i >= TARGET_TABLE) {
+            SymbolNumber symbol = transitions.input_symbol(i - TARGET_TABLE);
+            return symbol == 0 || alphabet.is_flag(symbol);
+        } else {
+            // flags are indexed as epsilons
+            return indices.input_symbol(i) == 0;
+        }
+    }
     //!
     //! whether state has non-epsilons or non-flags
-    bool has_non_epsilons_or_flags(const TransitionTableIndex i);
+    bool has_non_epsilons_or_flags(const TransitionTableIndex i) const;
     //! 
     //! whether it's final
-    bool is_final(const TransitionTableIndex i);
+    bool is_final(const TransitionTableIndex i) const
+    {
+        if (properties_ready.load(std::memory_order_acquire)) {
+            return state_has(StateIsFinal, i);
+        }
+        if (i >= TARGET_TABLE) {
+            return transitions.final(i - TARGET_TABLE);
+        } else {
+            return indices.final(i);
+        }
+    }
     //! 
     //! get final weight
     Weight final_weight(const TransitionTableIndex i) const;
     //!
+    //! fill in the bitsets and final weights that is_final(),
+    //! final_weight() and the has_ functions read, unless done already.
+    //! Until then they read the tables, so only the searches, which ask
+    //! for them over and over, wait for this pass over the tables.
+    void compute_state_properties(void) const;
+    //!
+    //! work out the distances for distance_to_final(), unless done already.
+    //! This takes a pass of Dijkstra's algorithm over the whole transducer,
+    //! so only the searches that gain from it ask for it.
+    void compute_distances_to_final(void) const;
+    //!
+    //! least weight of any path from state @a i to a final state, including
+    //! the final weight, or infinity if there is none. Flags are assumed
+    //! to always succeed. Always 0.0 if the transducer has negative weights
+    //! or compute_distances_to_final() hasn't been called.
+    Weight distance_to_final(const TransitionTableIndex i) const
+    {
+        if (!distances_ready.load(std::memory_order_acquire)) {
+            return 0.0;
+        }
+        if (i >= TARGET_TABLE) {
+            return (i - TARGET_TABLE < transition_distances.size()) ?
+                transition_distances[i - TARGET_TABLE] :
+                std::numeric_limits<Weight>::infinity();
+        } else {
+            return (i < index_distances.size()) ? index_distances[i] :
+                std::numeric_limits<Weight>::infinity();
+        }
+    }
+    //!
     //! whether it's a flag
-    bool is_flag(const SymbolNumber symbol);
+    bool is_flag(const SymbolNumber symbol) const;
     //!
     //! whether it's weighedc
     bool is_weighted(void);
+    //!
+    //! whether any transition or final weight is below zero
+    bool has_negative_weights(void) const;
+    //!
+    //! whether a walk along any input has at most one way to go, not
+    //! counting the unknown and identity symbols
+    bool is_input_deterministic(void) const;
 
 };
 
+//! Internal class for output string processing.
+
+//! Keeps the output strings of a search as a tree of paths, where each path
+//! stores only its last symbol and the path it extends, so extending a
+//! string is one append instead of a copy. Paths numbered below the base
+//! are read from another arena, which lets a search continue from paths
+//! kept in the cache without copying them.
+class OutputArena
+{
+private:
+    const OutputArena * base; //!< arena of the paths below base_size
+    PathIndex base_size; //!< number of paths in base
+    SymbolVector symbols; //!< last symbol of each path
+    std::vector<PathIndex> parents; //!< path each path extends
+public:
+    OutputArena(void):
+        base(NULL),
+        base_size(0)
+        {}
+    //!
+    //! forget all paths, continuing from the ones in @a base_arena if given
+    void reset(const OutputArena * base_arena = NULL);
+    //!
+    //! number of paths, including the ones in the base
+    PathIndex size(void) const
+    {
+        return base_size + static_cast<PathIndex>(symbols.size());
+    }
+    //!
+    //! number of paths in the base
+    PathIndex get_base_size(void) const
+    {
+        return base_size;
+    }
+    //!
+    //! path @a parent followed by @a symbol
+    PathIndex extend(PathIndex parent, SymbolNumber symbol)
+    {
+        symbols.push_back(symbol);
+        parents.push_back(parent);
+        return size() - 1;
+    }
+    //!
+    //! last symbol of @a path
+    SymbolNumber symbol(PathIndex path) const
+    {
+        return (path < base_size) ?
+            base->symbol(path) : symbols[path - base_size];
+    }
+    //!
+    //! path that @a path extends
+    PathIndex parent(PathIndex path) const
+    {
+        return (path < base_size) ?
+            base->parent(path) : parents[path - base_size];
+    }
+    //!
+    //! write the symbols of @a path into @a result
+    void materialize(PathIndex path, SymbolVector & result) const;
+    //!
+    //! bytes taken by the paths, not counting the base
+    size_t memory_size(void) const;
+    //!
+    //! append the paths, which must have no base, to @a out
+    void write(std::vector<char> & out) const;
+    //!
+    //! replace the paths with ones written by write(), read from @a raw up
+    //! to @a end, and tell whether they could be read
+    bool read(char ** raw, const char * end);
+};
+
+//! Internal class for collecting results.
+
+//! Keeps the least weight of each distinct output of a search in a hash
+//! table by open addressing. The outputs are paths of an OutputArena, and
+//! they are hashed and compared by the strings they spell without building
+//! the strings, so only the results that are given out are converted.
+class ResultTable
+{
+public:
+    //! an output and its least weight
+    struct Result
+    {
+        PathIndex path;
+        Weight weight;
+        size_t hash;
+    };
+private:
+    const OutputArena * paths; //!< arena of the outputs
+    KeyTable * keys; //!< strings of the symbols
+    //! whether the symbols are told apart, like symbolify() does
+    bool separate;
+    std::vector<Result> results; //!< the results, in the order found
+    //! position in results for each slot, or UINT_MAX if free
+    std::vector<uint32_t> slots;
+
+    size_t hash_output(PathIndex path) const;
+    bool same_output(PathIndex lhs, PathIndex rhs) const;
+    void grow(void);
+public:
+    ResultTable(void):
+        paths(NULL),
+        keys(NULL),
+        separate(false)
+        {}
+    //!
+    //! forget all results, and collect outputs of @a output_paths spelled
+    //! with @a key_table from now on, as strings, or as separate symbols
+    //! if @a separate_symbols
+    void reset(const OutputArena * output_paths, KeyTable * key_table,
+               bool separate_symbols = false);
+    //!
+    //! record @a path with @a weight, if its output is novel or the
+    //! weight is less than before, and tell whether it was. If
+    //! @a previous is given, it gets the weight the output had before, or
+    //! the maximum weight if it is novel.
+    bool insert(PathIndex path, Weight weight, Weight * previous = NULL);
+    //!
+    //! write the results weighing at most @a limit into @a strings as
+    //! strings, in the order of the strings
+    void stringify(StringWeightVector & strings,
+                   Weight limit = std::numeric_limits<Weight>::max()) const;
+    //!
+    //! number of distinct outputs
+    size_t size(void) const
+    {
+        return results.size();
+    }
+    const Result & operator[](size_t i) const
+    {
+        return results[i];
+    }
+};
+
+//! Internal class for pruning the correction search.
+
+//! Keeps the least weight a search has reached each configuration of input
+//! position, error model state, language model state and flag state with,
+//! in a hash table by open addressing. What follows a configuration
+//! doesn't depend on how it was reached, so a node reaching one again at
+//! no less weight only leads to the same corrections weighing more, or to
+//! other outputs weighing no less than the ones the cheapest node leads to.
+class VisitedTable
+{
+private:
+    struct Entry
+    {
+        unsigned int input_state;
+        TransitionTableIndex mutator_state;
+        TransitionTableIndex lexicon_state;
+        FlagStateIndex flag_state;
+        Weight weight;
+    };
+    //! the table, where entries with input_state UINT_MAX are free
+    std::vector<Entry> entries;
+    size_t count; //!< number of entries in use
+
+    size_t slot(const Entry & entry) const;
+    void grow(void);
+public:
+    VisitedTable(void):
+        count(0)
+        {}
+    //!
+    //! forget all configurations
+    void reset(void);
+    //!
+    //! record the configuration of @a node, unless it was reached before
+    //! at no greater weight, and tell whether it was recorded
+    bool visit(const TreeNode & node);
+};
+
+//! Internal class for flag diacritic processing.
+
+//! Keeps the flag states of a search in one flat array, @a state_size
+//! values per state. States are interned: each distinct state is stored
+//! once and never changed, so nodes carry a state id and equal ids mean
+//! equal states. The result of applying a flag symbol to a state is
+//! memoised, so after the first time a flag check is one table lookup.
+//! Like in OutputArena, states numbered below the base are read from
+//! another pool.
+class FlagStatePool
+{
+private:
+    //! result of applying the operation of @a symbol to @a state
+    struct MemoEntry
+    {
+        FlagStateIndex state;
+        SymbolNumber symbol;
+        FlagStateIndex result;
+    };
+    const FlagStatePool * base; //!< pool of the states below base_size
+    FlagStateIndex base_size; //!< number of states in base
+    FlagStateIndex state_count; //!< number of states in values
+    size_t state_size; //!< number of values in a state
+    std::vector<ValueNumber> values; //!< values of the states
+    //! hash table of the states in values, by open addressing
+    std::vector<FlagStateIndex> interned;
+    //! hash table of applied operations, by open addressing
+    std::vector<MemoEntry> memo;
+    size_t memo_count; //!< number of entries in memo
+
+    const ValueNumber * state_values(FlagStateIndex state) const;
+    size_t hash_values(const ValueNumber * state_values) const;
+    FlagStateIndex find(const ValueNumber * state_values, size_t hash) const;
+    void insert_interned(FlagStateIndex own_index);
+    FlagStateIndex intern_last(void);
+    void insert_memo(const MemoEntry & entry);
+    FlagStateIndex set_value(FlagStateIndex state, SymbolNumber feature,
+                             ValueNumber value);
+    FlagStateIndex compute(FlagStateIndex state,
+                           const FlagDiacriticOperation & op);
+public:
+    FlagStatePool(void):
+        base(NULL),
+        base_size(0),
+        state_count(0),
+        state_size(0),
+        memo_count(0)
+        {}
+    //!
+    //! forget all states, continuing from the ones in @a base_pool if
+    //! given, or else from UNSET_FLAGS for @a size features
+    void reset(size_t size, const FlagStatePool * base_pool = NULL);
+    //!
+    //! number of states, including the ones in the base
+    FlagStateIndex size(void) const
+    {
+        return base_size + state_count;
+    }
+    //!
+    //! number of states in the base
+    FlagStateIndex get_base_size(void) const
+    {
+        return base_size;
+    }
+    //!
+    //! values of the features in @a state, which stay where they are
+    //! until a state is added
+    const ValueNumber * get_values(FlagStateIndex state) const
+    {
+        return state_values(state);
+    }
+    //!
+    //! the state with the values @a state_values, added if there isn't
+    //! one
+    FlagStateIndex intern(const ValueNumber * state_values);
+    //!
+    //! value of @a feature in @a state
+    ValueNumber value(FlagStateIndex state, SymbolNumber feature) const
+    {
+        return state_values(state)[feature];
+    }
+    //!
+    //! state after the flag operation of @a symbol in @a operations is
+    //! applied to @a state, or NO_FLAG_STATE if they are not compatible
+    FlagStateIndex apply(FlagStateIndex state, SymbolNumber symbol,
+                         const OperationVector * operations);
+    //!
+    //! bytes taken by the states, not counting the base
+    size_t memory_size(void) const;
+    //!
+    //! append the states, which must have no base, to @a out
+    void write(std::vector<char> & out) const;
+    //!
+    //! replace the states with ones written by write(), read from @a raw
+    //! up to @a end, and tell whether they could be read
+    bool read(char ** raw, const char * end);
+};
+
+//! Internal class for bounding the cost of the rest of the input.
+
+//! For every input position and error model state, keeps a lower bound of
+//! the error model weight still needed to consume the rest of the input
+//! and end in a final state. The reachable states of the error model are
+//! numbered once, when it is set, and the bounds are computed for each
+//! input by going backwards over it, into a table kept by the caller, so
+//! that one numbering serves any number of searches. Without bounds, or
+//! if the error model has negative weights, every bound is 0.0.
+class MutatorBounds
+{
+private:
+    Transducer * mutator; //!< error model, or NULL
+    TransitionTableIndex index_count; //!< positions in its index table
+    //! number of the state at each table position, transitions after
+    //! indices, or NO_TABLE_INDEX if there is none
+    std::vector<TransitionTableIndex> numbers;
+    std::vector<TransitionTableIndex> states; //!< each numbered state
+    //! epsilon arcs grouped by their target state, by offsets into the
+    //! sources and weights
+    std::vector<TransitionTableIndex> first_incoming;
+    std::vector<TransitionTableIndex> incoming_sources;
+    std::vector<Weight> incoming_weights;
+
+    TransitionTableIndex number(TransitionTableIndex state) const
+    {
+        return (state >= TARGET_TABLE) ?
+            numbers[index_count + 1 + (state - TARGET_TABLE)] :
+            numbers[state];
+    }
+    Weight consume_bound(TransitionTableIndex state, SymbolNumber symbol,
+                         const Weight * next_bounds) const;
+public:
+    MutatorBounds(void):
+        mutator(NULL),
+        index_count(0)
+        {}
+    //!
+    //! number the states of @a mutator_ptr, which bounds are computed for
+    void set_mutator(Transducer * mutator_ptr);
+    //!
+    //! compute the bounds for @a input into @a bounds, or leave it empty
+    //! if there are none
+    void compute(const SymbolVector & input,
+                 std::vector<Weight> & bounds) const;
+    //!
+    //! bound at @a input_state in @a mutator_state in @a bounds, or 0.0 if
+    //! it is empty
+    Weight bound(const std::vector<Weight> & bounds,
+                 unsigned int input_state,
+                 TransitionTableIndex mutator_state) const
+    {
+        if (bounds.empty()) {
+            return 0.0;
+        }
+        return bounds[input_state * states.size() + number(mutator_state)];
+    }
+};
+
 //! Internal class for alphabet processing.
 
 //! Contains low-level processing stuff.
 struct TreeNode
 {
 //    SymbolVector input_string; //<! the current input vector
-    SymbolVector string; //!< the current output vector
+    PathIndex output; //!< the current output path
     unsigned int input_state; //!< its input state
     TransitionTableIndex mutator_state; //!< state in error model
     TransitionTableIndex lexicon_state; //!< state in language model
-    FlagDiacriticState flag_state; //!< state of flags
+    FlagStateIndex flag_state; //!< state of flags
     Weight weight; //!< weight
 
     //!
     //! construct a node in trie from all that stuff
-    TreeNode(SymbolVector prev_string,
+    TreeNode(PathIndex prev_output,
              unsigned int i,
              TransitionTableIndex mutator,
              TransitionTableIndex lexicon,
-             FlagDiacriticState state,
+             FlagStateIndex state,
              Weight w):
-        string(prev_string),
+        output(prev_output),
         input_state(i),
         mutator_state(mutator),
         lexicon_state(lexicon),
@@ -311,8 +882,8 @@ struct TreeNode
 
     //! 
     //! construct empty node with a starting state for flags
-    TreeNode(FlagDiacriticState start_state): // starting state node
-    string(SymbolVector()),
+    TreeNode(FlagStateIndex start_state): // starting state node
+    output(EMPTY_PATH),
     input_state(0),
     mutator_state(0),
     lexicon_state(0),
@@ -321,12 +892,16 @@ struct TreeNode
         { }
 
     //!
-    //! check if tree node is compatible with flag diacritc
-    bool try_compatible_with(FlagDiacriticOperation op);
+    //! check if tree node is compatible with flag diacritic @a symbol,
+    //! moving to the resulting state in @a flags if it is
+    bool try_compatible_with(FlagStatePool & flags,
+                             SymbolNumber symbol,
+                             const OperationVector * operations);
 
     //!
-    //! traverse some node in lexicon
-    TreeNode update_lexicon(SymbolNumber next_symbol,
+    //! traverse some node in lexicon, adding output symbols to @a paths
+    TreeNode update_lexicon(OutputArena & paths,
+                            SymbolNumber next_symbol,
                             TransitionTableIndex next_lexicon,
                             Weight weight);
 
@@ -337,13 +912,15 @@ struct TreeNode
 
     //!
     //! The update functions return updated copies of this state
-     TreeNode update(SymbolNumber output_symbol,
+     TreeNode update(OutputArena & paths,
+                     SymbolNumber output_symbol,
                      unsigned int next_input,
                      TransitionTableIndex next_mutator,
                      TransitionTableIndex next_lexicon,
                      Weight weight);
 
-    TreeNode update(SymbolNumber output_symbol,
+    TreeNode update(OutputArena & paths,
+                    SymbolNumber output_symbol,
                     TransitionTableIndex next_mutator,
                     TransitionTableIndex next_lexicon,
                     Weight weight);
@@ -353,6 +930,21 @@ struct TreeNode
 
 typedef std::vector<TreeNode> TreeNodeQueue;
 
+//! A node waiting in the best-first search, with its lower bound worked
+//! out once as it is added.
+struct BoundedNode
+{
+    Weight bound; //!< least weight of any correction the node can lead to
+    TreeNode node; //!< the node
+
+    BoundedNode(Weight b, const TreeNode & n):
+        bound(b),
+        node(n)
+        { }
+};
+
+typedef std::vector<BoundedNode> BoundedNodeQueue;
+
 int nByte_utf8(unsigned char c);
 
 //! Exception when speller cannot map characters of error model to language
@@ -371,79 +963,390 @@ public:
         { }
 };
 
+struct CacheContainer
+{
+    // All the nodes that ultimately result from searching up to the input
+    // depth of the prefix of the entry
+    TreeNodeVector nodes;
+    // The output paths and flag states of the nodes
+    OutputArena paths;
+    FlagStatePool flags;
+    // The results are for length max one inputs only, so they are only
+    // kept for prefixes of one symbol
+    StringWeightVector results_len_0;
+    StringWeightVector results_len_1;
+    bool empty;
+
+    CacheContainer(void): empty(true) {}
+    
+    void clear(void)
+        {
+            nodes.clear();
+            paths.reset();
+            flags.reset(0);
+            results_len_0.clear();
+            results_len_1.clear();
+        }
+
+    //!
+    //! bytes taken by the entry
+    size_t memory_size(void) const;
+    //!
+    //! append the entry to @a out
+    void write(std::vector<char> & out) const;
+    //!
+    //! replace the entry with one written by write(), read from @a raw up
+    //! to @a end, and tell whether it could be read
+    bool read(char ** raw, const char * end);
+};
+
+//! Internal class for caching the search by input prefix.
+
+//! Keeps the search up to the end of each cached prefix of the input, for
+//! prefixes of up to max_length symbols, keyed by their symbols. If the
+//! entries take more than the memory budget, the least recently used ones
+//! are dropped. An entry is shared with the searches using it, so it can
+//! be dropped while in use. The cache is guarded by a mutex of its own.
+class PrefixCache
+{
+public:
+    //! how much an entry takes and has been used
+    struct EntryStatistics
+    {
+        SymbolVector prefix; //!< input prefix of the entry
+        size_t memory; //!< bytes taken by the entry
+        unsigned long hits; //!< times the entry has been found
+    };
+    //! how the cache is doing
+    struct Statistics
+    {
+        size_t memory; //!< bytes taken by the entries
+        unsigned long hits; //!< times an entry has been found
+        unsigned long misses; //!< times an entry has been built
+        unsigned long evictions; //!< entries dropped for the budget
+        std::vector<EntryStatistics> entries; //!< most recently used first
+    };
+private:
+    struct Entry
+    {
+        std::shared_ptr<const CacheContainer> search;
+        size_t memory;
+        unsigned long hits;
+        //! position in recency
+        std::list<SymbolVector>::iterator use;
+    };
+    struct PrefixHash
+    {
+        size_t operator()(const SymbolVector & prefix) const;
+    };
+    typedef std::unordered_map<SymbolVector, Entry, PrefixHash> EntryMap;
+
+    mutable std::mutex mutex; //!< guards the rest
+    EntryMap entries; //!< the entries by prefix
+    std::list<SymbolVector> recency; //!< prefixes, most recently used first
+    size_t max_length; //!< symbols in the longest cached prefixes
+    size_t budget; //!< bytes the entries may take, or 0 for no limit
+    size_t memory; //!< bytes taken by the entries
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+
+    void keep(const SymbolVector & prefix,
+              const std::shared_ptr<const CacheContainer> & search,
+              size_t search_memory);
+    void evict(void);
+public:
+    PrefixCache(void):
+        max_length(1),
+        budget(0),
+        memory(0),
+        hits(0),
+        misses(0),
+        evictions(0)
+        {}
+    //!
+    //! keep prefixes of up to @a length symbols, taking up to
+    //! @a memory_budget bytes, or any amount if it is 0. Entries that no
+    //! longer fit are dropped, least recently used first.
+    void configure(size_t length, size_t memory_budget);
+    //!
+    //! symbols in the longest cached prefixes
+    size_t get_max_length(void) const;
+    //!
+    //! whether there is an entry for @a prefix, without using it
+    bool contains(const SymbolVector & prefix) const;
+    //!
+    //! the entry for @a prefix, or an empty pointer if there isn't one
+    std::shared_ptr<const CacheContainer> find(const SymbolVector & prefix);
+    //!
+    //! keep @a search as the entry for @a prefix, unless there is one
+    //! already, and give the one kept
+    std::shared_ptr<const CacheContainer> insert(
+        const SymbolVector & prefix,
+        const std::shared_ptr<const CacheContainer> & search);
+    //!
+    //! drop all entries
+    void clear(void);
+    //!
+    //! how the cache is doing
+    Statistics get_statistics(void) const;
+    //!
+    //! append the entries to @a out
+    void write(std::vector<char> & out) const;
+    //!
+    //! add the entries written by write(), read from @a raw up to @a end,
+    //! and tell whether they could be read. Entries for prefixes longer
+    //! than max_length are skipped.
+    bool read(char ** raw, const char * end);
+};
+
+//! @brief The automata of a speller, which any number of Spellers share.
+
+//! Holds what stays the same from one input to the next: the automata,
+//! the translation between their alphabets, the numbering of the error
+//! model states and the cache of the search by input prefix. Apart from
+//! the cache, which guards itself, a model isn't changed after it is
+//! constructed, so Spellers in different threads can search it at the
+//! same time.
+class SpellerModel
+{
+public:
+    Transducer * mutator; //!< error model
+    Transducer * lexicon; //!< languag model
+    //! lexicon symbol for each symbol of the error model
+    SymbolVector alphabet_translator;
+    //! numbering of the error model states for bounding its weights
+    MutatorBounds mutator_bounds;
+    //! the search for the input prefixes that have been cached
+    PrefixCache prefix_cache;
+    //! @brief how Speller::check() walks the language model.
+    //
+    //! GeneralWalk uses the queue of the correction search, which is the
+    //! only one that knows flag diacritics. StackWalk keeps the states it
+    //! has yet to try on a small fixed stack, and DirectWalk follows the
+    //! one transition each input symbol has.
+    enum CheckWalk { GeneralWalk, StackWalk, DirectWalk } check_walk;
+
+    //!
+    //! Create a model from error model and language automata. Symbols of
+    //! the error model missing from the language model are added to it.
+    SpellerModel(Transducer * mutator_ptr, Transducer * lexicon_ptr);
+    //!
+    //! initialise string conversions
+    void build_alphabet_translator(void);
+    //!
+    //! build the cache entries for the empty input and for every symbol an
+    //! input can start with, in @a threads threads, or in as many as there
+    //! are processors if it is 0
+    void warm_up_cache(unsigned int threads);
+    //!
+    //! write the cache entries to the file @a filename, under a temporary
+    //! name first, and tell whether it could be written
+    bool save_cache(const std::string & filename) const;
+    //!
+    //! add the cache entries in the file @a filename written by
+    //! save_cache(), and tell whether they could be read. The file must
+    //! have been written for the same automata.
+    bool load_cache(const std::string & filename);
+};
+
+//! @brief Features of the automata that a search of a Speller is
+//! compiled for.
+
+//! The traversal of Speller is a template on these, so that the checks for
+//! what the automata don't have are left out of its innermost loops.
+template <bool CORRECT, bool FLAGS, bool UNKNOWNS, bool BOUNDED>
+struct SearchFeatures
+{
+    //! whether it searches corrections rather than analyses
+    static const bool correct = CORRECT;
+    //! whether the language model has flag diacritics
+    static const bool flags = FLAGS;
+    //! whether either automaton has the unknown or the identity symbol
+    static const bool unknowns = UNKNOWNS;
+    //! whether the distances to the final states bound the weights, which
+    //! they don't if either automaton has negative weights
+    static const bool bounded = BOUNDED;
+};
+
+class Speller;
+struct ParallelSearch;
+
+//! @brief The searches of a Speller compiled for some SearchFeatures.
+
+//! A Speller picks the ones for its automata when it is created, so that
+//! which features they have is decided once instead of on every arc.
+struct SearchKernels
+{
+    bool (Speller::*lookup_queue)(bool first_only);
+    void (Speller::*correct_depth_first)(int nbest, Weight beam);
+    void (Speller::*correct_best_first)(CorrectionQueue & correction_queue,
+                                        int nbest, Weight beam);
+    void (Speller::*build_cache)(SymbolNumber first_sym,
+                                 CacheContainer & entry);
+    bool (Speller::*extend_cache)(const CacheContainer & shorter,
+                                  CacheContainer & entry, bool budgeted);
+};
+
 //! @brief Basic spell-checking automata pair unit.
 
 //! Speller consists of two automata, one for language modeling and one for
 //! error modeling. The speller object has low-level access to the automata
 //! and convenience functions for checking, analysing and correction.
+//! The automata are kept in a SpellerModel, which can be shared, and the
+//! speller keeps the state of the current search, so one speller can be
+//! used by one thread at a time.
 //! @see ZHfstOspeller for high level access.
 class Speller
 {
 public:
-    Transducer * mutator; //!< error model
-    Transducer * lexicon; //!< languag model
+    SpellerModel * model; //!< automata, maybe shared with other spellers
+    bool owns_model; //!< whether model is deleted with this speller
+    //! searches compiled for the features of the automata of model
+    const SearchKernels * kernels;
+    Transducer * mutator; //!< error model of model
+    Transducer * lexicon; //!< languag model of model
     SymbolVector input; //!< current input
     TreeNodeQueue queue; //!< current traversal fifo stack
     TreeNode next_node;  //!< current next node
+    OutputArena paths; //!< output strings of the current search
+    FlagStatePool flags; //!< flag states of the current search
+    ResultTable results; //!< outputs found by the current search
+    //! whether correct() drops the nodes reaching a configuration the
+    //! current search has reached before for less, keeping only the
+    //! cheapest of the outputs that share the rest of their search
+    bool prune_visited;
+    VisitedTable visited; //!< configurations reached by the current search
+    //! error model weight needed for the rest of the current input, by
+    //! input position and error model state
+    std::vector<Weight> mutator_bounds;
     Weight limit; //!< current limit for weights
     Weight best_suggestion; //!< best suggestion so far
     WeightQueue nbest_queue; //!< queue to keep track of current n best results
-    SymbolVector alphabet_translator; //!< alphabets in automata
-    OperationMap * operations; //!< flags in it
-    //!< A cache for the result of first symbols
-    std::vector<CacheContainer> cache;
+    //! alphabets in automata, with the unknown symbols of the current
+    //! input after the ones of model
+    SymbolVector alphabet_translator;
+    //! symbols of the language model, with the unknown symbols of the
+    //! current input after them
+    KeyTable output_keys;
+    //! symbols of the current input that model can't tokenize, by their
+    //! strings
+    StringSymbolMap unknown_symbols;
+    const OperationVector * operations; //!< flags in it
     //!< what kind of limiting behaviour we have
     enum LimitingBehaviour { None, MaxWeight, Nbest, Beam, MaxWeightNbest,
                              MaxWeightBeam, NbestBeam, MaxWeightNbestBeam } limiting;
     //! what mode we're in
     enum Mode { Check, Correct, Lookup } mode;
+    //! @brief how correct() searches.
+    //
+    //! DepthFirst explores the whole space allowed by the limits.
+    //! BestFirst expands the node with the least lower_bound() first and
+    //! stops as soon as the limits rule out everything left. BestFirst is
+    //! only used if neither automaton has negative weights.
+    enum SearchStrategy { DepthFirst, BestFirst } search;
+    //! nodes waiting to be expanded in BestFirst search, as a heap
+    BoundedNodeQueue frontier;
+    //! input state of the cached nodes the current search started from
+    unsigned int resumed_state;
+    //! how many nodes correct() takes from the queue between looking at
+    //! the clock, which costs about as much as taking a node
+    static const unsigned long DEADLINE_CHECK_INTERVAL = 64;
 
+    //! most nodes correct() takes from the queue, or 0 for no limit
+    unsigned long max_expanded;
+    //! most nodes correct() lets wait in the queue, or 0 for no limit
+    size_t max_frontier;
     //! the maximum amount of time to take
     double max_time;
-    //! when we started work
-    clock_t start_clock;
-    // A counter to avoid checking the clock too often
-    unsigned long call_counter;
-    // A flag to set for when time has been overstepped
+    //! when the current search has to stop if max_time is set
+    std::chrono::steady_clock::time_point deadline;
+    //! nodes taken from the queue by the current search
+    unsigned long expanded;
+    //! whether the current search was stopped by max_expanded,
+    //! max_frontier or max_time before it was done, so that better
+    //! corrections may have been left out
     bool limit_reached;
+    //! threads the depth first search of correct() is split among once it
+    //! has taken split_after nodes by itself, or 1 for no splitting
+    unsigned int threads;
+    //! nodes correct() takes by itself before it splits the search, so
+    //! that the inputs that are quick to correct don't wait for threads
+    unsigned long split_after;
+    //! whether the current search stops after split_after nodes to be
+    //! split
+    bool splitting;
+    //! the split search this speller is helping with, or NULL
+    ParallelSearch * parallel;
+    //! spellers searching the parts of a split search, kept for the next
+    //! ones
+    std::vector<std::unique_ptr<Speller> > helpers;
     
     //!
     //! Create a speller object form error model and language automata.
     Speller(Transducer * mutator_ptr, Transducer * lexicon_ptr);
     //!
+    //! Create a speller object for searching @a model_ptr, which the caller
+    //! keeps and may share with other spellers.
+    Speller(SpellerModel * model_ptr);
+    ~Speller(void);
+    Speller(const Speller &) = delete;
+    Speller & operator=(const Speller &) = delete;
+    //!
     //! size of states
     SymbolNumber get_state_size(void);
     //!
     //! initialise string conversions
-    void build_alphabet_translator(void);
     void add_symbol_to_alphabet_translator(SymbolNumber to_sym);
     //!
     //! initialize input string
     bool init_input(char * line);
     //!
+    //! input symbol for a character the model can't tokenize, numbered
+    //! after the symbols of the model, or NO_SYMBOL if there is no number
+    //! left for it
+    SymbolNumber add_unknown_symbol(const std::string & symbol);
+    //!
+    //! forget the unknown symbols of the previous input
+    void forget_unknown_symbols(void);
+    //!
     //! travers epsilons in language model
-    void lexicon_epsilons(void);
+    template <class Features> void lexicon_epsilons(void);
     bool has_lexicon_epsilons(void) const
         {
             return lexicon->has_epsilons_or_flags(next_node.lexicon_state + 1);
         }
     //!
     //! traverse epsilons in error modle
-    void mutator_epsilons(void);
+    template <class Features> void mutator_epsilons(void);
     bool has_mutator_epsilons(void) const
         {
-            return mutator->has_transitions(next_node.mutator_state + 1, 0);
+            return mutator->has_epsilons(next_node.mutator_state + 1);
         }
     //!
     //! traverse along input
-    void consume_input();
+    template <class Features> void consume_input();
     //! helper functions for traversal
-    void queue_mutator_arcs(SymbolNumber input);
-    void lexicon_consume(void);
+    template <class Features> void queue_mutator_arcs(SymbolNumber input);
+    template <class Features> void lexicon_consume(void);
+    template <class Features>
     void queue_lexicon_arcs(SymbolNumber input,
                             unsigned int mutator_state,
                             Weight mutator_weight = 0.0,
                             int input_increment = 0);
+    //!
+    //! take the nodes from queue until there are none left, adding the
+    //! ones at the end of the input in a final state of the language model
+    //! to results, or, if @a first_only, until there is one, and tell
+    //! whether there was one
+    bool lookup_queue(bool first_only);
+    template <class Features> bool lookup_queue(bool first_only);
+    //!
+    //! walk the language model along the input without the queue, as
+    //! model->check_walk allows, and set @a accepted to whether it ends in
+    //! a final state. Tells whether the walk could decide that, which it
+    //! can't if the input has more ways to go than it can keep track of.
+    bool walk_lexicon(bool & accepted);
     //! @brief Check if the given string is accepted by the speller
     //
     //! foo
@@ -456,8 +1359,86 @@ public:
                             Weight maxweight = -1.0,
                             Weight beam = -1.0,
                             float time_cutoff = 0.0);
+    //! @brief suggest corrections for each of @a lines, as correct()
+    //! would one by one.
+    //
+    //! The lines are taken in the order of their symbols, so that the ones
+    //! with a prefix in common follow each other, and the search up to the
+    //! end of a prefix that several of them have is made once for all of
+    //! them and forks where they diverge. Prefixes longer than the ones in
+    //! the prefix cache are only shared if @a maxweight is set, as nothing
+    //! else can be left out of their search before the lines diverge. The
+    //! search finds the corrections in another order then, but the ones
+    //! that make it under @a nbest are chosen by weight and string alone,
+    //! so they are the same.
+    //! The time cutoff and the budgets are for each line on its own. The
+    //! nodes of a shared part count to the line it is searched for, and
+    //! if they run out there, every line going on from that part is
+    //! stopped too. If @a truncated is given, it is set to whether the
+    //! search of each line was stopped.
+    std::vector<CorrectionQueue> correct_batch(
+        const std::vector<std::string> & lines, int nbest = 0,
+        Weight maxweight = -1.0, Weight beam = -1.0,
+        float time_cutoff = 0.0, std::vector<bool> * truncated = NULL);
 
     bool is_under_weight_limit(Weight w) const;
+    //!
+    //! least weight of anything found from a node at @a input_state,
+    //! @a mutator_state and @a lexicon_state once @a w has been spent
+    Weight lower_bound(Weight w, unsigned int input_state,
+                       TransitionTableIndex mutator_state,
+                       TransitionTableIndex lexicon_state) const;
+    Weight lower_bound(const TreeNode & node) const
+    {
+        return lower_bound(node.weight, node.input_state,
+                           node.mutator_state, node.lexicon_state);
+    }
+    //!
+    //! lower_bound() for a search specialised for @a Features
+    template <class Features>
+    Weight lower_bound(Weight w, unsigned int input_state,
+                       TransitionTableIndex mutator_state,
+                       TransitionTableIndex lexicon_state) const;
+    template <class Features>
+    Weight lower_bound(const TreeNode & node) const
+    {
+        return lower_bound<Features>(node.weight, node.input_state,
+                                     node.mutator_state, node.lexicon_state);
+    }
+    //!
+    //! whether the current search is to stop with @a waiting nodes in the
+    //! queue, counting the one about to be taken from it, or to be split
+    //! among threads. The clock is looked at every DEADLINE_CHECK_INTERVAL
+    //! nodes.
+    bool out_of_budget(size_t waiting);
+    //!
+    //! record the correction @a path found with @a weight in results if it
+    //! is novel or better than before, keeping track of the weight limits,
+    //! and tell whether it was
+    bool add_correction(PathIndex path, Weight weight, int nbest);
+    //!
+    //! take the @a weight of a novel correction, or of one that weighed
+    //! @a previous before, into best_suggestion and nbest_queue
+    void count_correction(Weight weight, Weight previous, int nbest);
+    //!
+    //! put the @a corrections under the limit into @a correction_queue,
+    //! only the first @a nbest of them by weight and then string if
+    //! @a nbest is set
+    void select_corrections(StringWeightVector & corrections, int nbest,
+                            CorrectionQueue & correction_queue);
+    //!
+    //! search corrections from the nodes in queue into results, depth first
+    void correct_depth_first(int nbest, Weight beam);
+    template <class Features>
+    void correct_depth_first(int nbest, Weight beam);
+    //!
+    //! search corrections from the nodes in queue, lightest first, and
+    //! give out the best ones in @a correction_queue
+    void correct_best_first(CorrectionQueue & correction_queue,
+                            int nbest, Weight beam);
+    template <class Features>
+    void correct_best_first(CorrectionQueue & correction_queue,
+                            int nbest, Weight beam);
     void set_limiting_behaviour(int nbest, Weight maxweight, Weight beam);
     void adjust_weight_limits(int nbest, Weight beam);
     
@@ -475,37 +1456,166 @@ public:
     AnalysisSymbolsQueue analyseSymbols(char * line, int nbest = 0);
 
 
-    void build_cache(SymbolNumber first_sym);
-    //! @brief Construct a cache entry for @a first_sym..
-
+    //! @brief Construct a cache entry for @a first_sym in @a entry.
+    void build_cache(SymbolNumber first_sym, CacheContainer & entry);
+    template <class Features>
+    void build_cache(SymbolNumber first_sym, CacheContainer & entry);
+    //!
+    //! construct the cache entry for the prefix of the input one symbol
+    //! longer than the one of @a shorter in @a entry, and tell whether it
+    //! is whole. If @a budgeted, its nodes count to the budgets of the
+    //! current search, and it is left unfinished when they run out.
+    bool extend_cache(const CacheContainer & shorter, CacheContainer & entry,
+                      bool budgeted = false);
+    template <class Features>
+    bool extend_cache(const CacheContainer & shorter, CacheContainer & entry,
+                      bool budgeted);
+    //!
+    //! the cache entry for the longest prefix of the input that is cached,
+    //! built first along with the ones for its prefixes if there isn't one
+    std::shared_ptr<const CacheContainer> cached_search(void);
+    //!
+    //! start counting the nodes and the time of a search, which may take
+    //! @a time_cutoff seconds if it is over 0
+    void start_budget(float time_cutoff);
+    //!
+    //! finish the correction of the input from the nodes of @a first,
+    //! whose input prefix is resumed_state symbols long, within the limits
+    //! set for it
+    CorrectionQueue correct_from(
+        const std::shared_ptr<const CacheContainer> & first,
+        int nbest, Weight beam);
+    //!
+    //! split the nodes left in queue among threads helpers, and collect
+    //! what all of them find under the limit into @a corrections
+    void correct_in_parallel(StringWeightVector & corrections,
+                             int nbest, Weight beam);
+    //!
+    //! get ready to search a part of the split search of @a owner
+    void join_search(Speller & owner, ParallelSearch & shared);
+    //!
+    //! search the nodes handed to this helper until none are left
+    void search_shared(int nbest, Weight beam);
+    //!
+    //! wait for nodes from the other helpers once queue is empty, and
+    //! tell whether there were any before they all ran out
+    bool take_work(void);
+    //!
+    //! hand the oldest half of queue to a helper waiting for nodes
+    void give_work(void);
+    //!
+    //! add the correction of @a path with @a weight to what the helpers
+    //! have found together, tightening their limit
+    void share_correction(PathIndex path, Weight weight);
+    //!
+    //! count the nodes of a helper towards the budgets of the split
+    //! search, give some to a helper waiting for them, and tell whether
+    //! it has to stop
+    bool out_of_shared_budget(size_t waiting);
+    //!
+    //! build the cache entry for inputs starting with @a first_sym, or for
+    //! the empty input if it is 0, unless there is one already
+    void warm_up_cache(SymbolNumber first_sym);
 };
 
-struct CacheContainer
+//! @brief Checking of a word while it is typed.
+
+//! Keeps the states of the language model that the input reaches, with a
+//! checkpoint after each input symbol, so that typing or deleting at the
+//! end of the input costs time in proportion to the change rather than to
+//! the whole word. A session only reads its SpellerModel, which must
+//! outlive it, so sessions of one model can be used in different threads.
+class CheckSession
 {
-    // All the nodes that ultimately result from searching at input depth 1
-    TreeNodeVector nodes;
-    // The results are for length max one inputs only
-    StringWeightVector results_len_0;
-    StringWeightVector results_len_1;
-    bool empty;
+private:
+    //! a state of the language model and the flag state it is reached in
+    struct Configuration
+    {
+        TransitionTableIndex state;
+        FlagStateIndex flag_state;
+    };
+    //! where an input symbol and the configurations it reaches end
+    struct Checkpoint
+    {
+        size_t text_end;
+        size_t configurations_end;
+    };
+    SpellerModel * model; //!< automata the input is checked with
+    Transducer * lexicon; //!< language model of model
+    Encoder * encoder; //!< tokenizer of the input
+    std::string text; //!< the input so far
+    //! the configurations reached at each checkpoint, one after another
+    std::vector<Configuration> configurations;
+    //! one for the empty input and one for each input symbol after it
+    std::vector<Checkpoint> checkpoints;
+    FlagStatePool flags; //!< flag states of the configurations
+    //! configurations already reached at the last checkpoint
+    std::unordered_set<uint64_t> reached;
+    //! bytes from where an input symbol starts that decide what it is
+    size_t lookahead;
 
-    CacheContainer(void): empty(true) {}
-    
-    void clear(void)
-        {
-            nodes.clear();
-            results_len_0.clear();
-            results_len_1.clear();
-        }
-    
+    //!
+    //! add the configuration of @a state and @a flag_state to the last
+    //! checkpoint, unless it is there or can't get to a final state
+    void reach(TransitionTableIndex state, FlagStateIndex flag_state);
+    //!
+    //! add what the epsilon and flag transitions reach from the
+    //! configurations from @a begin on, including the ones they add
+    void follow_epsilons(size_t begin);
+    //!
+    //! add a checkpoint for the input symbol of the language model
+    //! @a symbol, or NO_SYMBOL if it has none, ending at @a text_end
+    void advance(SymbolNumber symbol, size_t text_end);
+    //!
+    //! add checkpoints for the input after the last checkpoint
+    void tokenize(void);
+    //!
+    //! remove the checkpoints of the input symbols that could change if
+    //! the input after its first @a common bytes changes
+    void rewind(size_t common);
+public:
+    //!
+    //! start with the empty input for @a model_ptr
+    CheckSession(SpellerModel * model_ptr);
+    //!
+    //! go back to the empty input
+    void reset(void);
+    //!
+    //! change the input to @a new_text, redoing the symbols after the part
+    //! it has in common with the input so far
+    void set_text(const std::string & new_text);
+    //!
+    //! add @a more at the end of the input
+    void append(const std::string & more);
+    //!
+    //! remove the last character of the input, if there is one
+    void backspace(void);
+    //!
+    //! the input so far
+    const std::string & get_text(void) const;
+    //!
+    //! whether the input is accepted, as Speller::check() would tell
+    bool check(void) const;
+    //!
+    //! whether the input can still be continued to one that is accepted,
+    //! as far as can be told without trying the flags further on
+    bool viable(void) const;
 };
 
 std::string stringify(KeyTable * key_table,
                       SymbolVector & symbol_vector);
 
+std::string stringify(KeyTable * key_table,
+                      const OutputArena & paths,
+                      PathIndex path);
+
 std::vector<std::string> symbolify(KeyTable * key_table,
                                    SymbolVector & symbol_vector);
 
+std::vector<std::string> symbolify(KeyTable * key_table,
+                                   const OutputArena & paths,
+                                   PathIndex path);
+
 } // namespace hfst_ol
 
 // Some platforms lack strndup
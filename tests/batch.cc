@@ -0,0 +1,135 @@
+// Copyright 2010 University of Helsinki
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*
+  Checks that correcting a batch of words with long prefixes in common
+  gives each word the corrections it gets on its own, with any limits and
+  prefix cache, and that a word is said to be stopped whenever the budget
+  runs out in its own search or in the search of a prefix it shares.
+
+  Usage: batch ERRMODEL LEXICON
+
+  The words are written for the lexicon of acceptor.threads.txt.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ospell.h"
+#include "test-support.h"
+#include "ZHfstOspeller.h"
+
+using hfst_ol::CorrectionQueue;
+using hfst_ol::Speller;
+using hfst_ol::Transducer;
+using hfst_ol::Weight;
+using hfst_ol::ZHfstOspeller;
+
+// words sharing "kala", "kall" and "tal", with some of them twice, ties
+// in weight under the limits, ones sharing nothing, and ones with
+// characters the lexicon doesn't have
+static const char * words[] = {
+    "kalatq", "kqlle", "kalaxs", "kalasq", "kallex", "talqt", "kalleq",
+    "kalq", "taloq", "kalatq", "talit", "kalat", "qq", "", "äkala",
+    "kalä€", "kalä", "€kala"
+};
+static const size_t WORD_COUNT = sizeof(words) / sizeof(words[0]);
+
+// check that the batch of @a speller gives every word what it gets on its
+// own, with the prefix cache of @a speller as it is
+static void
+check_batches(Speller & speller, const std::string & cache)
+{
+    std::vector<std::string> lines(words, words + WORD_COUNT);
+    const Weight maxweights[] = {-1.0, 0.5, 1.0, 2.0};
+    for (int nbest = 0; nbest <= 3; ++nbest) {
+        for (Weight maxweight : maxweights) {
+            std::vector<CorrectionQueue> batch =
+                speller.correct_batch(lines, nbest, maxweight);
+            expect(batch.size() == WORD_COUNT, "a queue for every word");
+            for (size_t w = 0; w < WORD_COUNT && w < batch.size(); ++w) {
+                expect(listed(batch[w]) ==
+                       corrections(speller, words[w], nbest, maxweight),
+                       std::string("the same corrections of \"") + words[w] +
+                       "\" with nbest " + std::to_string(nbest) +
+                       " and maxweight " + std::to_string(maxweight) +
+                       " with " + cache);
+            }
+        }
+    }
+
+    // The nodes of a shared prefix count to the line it is searched for,
+    // and every line going on from it is stopped with it, so a line that
+    // isn't stopped has all of its corrections, whatever the budget.
+    std::vector<Corrections> whole;
+    unsigned long most = 0;
+    for (size_t w = 0; w < WORD_COUNT; ++w) {
+        whole.push_back(corrections(speller, words[w], 0, 2.0));
+        most = std::max(most, speller.expanded);
+    }
+    for (unsigned long budget = 1; budget <= most; ++budget) {
+        speller.max_expanded = budget;
+        std::vector<bool> truncated;
+        std::vector<CorrectionQueue> batch =
+            speller.correct_batch(lines, 0, 2.0, -1.0, 0.0, &truncated);
+        for (size_t w = 0; w < WORD_COUNT && w < batch.size(); ++w) {
+            expect(truncated[w] || listed(batch[w]) == whole[w],
+                   std::string("\"") + words[w] + "\" stopped or whole in " +
+                   std::to_string(budget) + " nodes with " + cache);
+        }
+    }
+    speller.max_expanded = 0;
+}
+
+int
+main(int argc, char ** argv)
+{
+    if (argc != 3) {
+        std::cerr << "Usage: batch ERRMODEL LEXICON" << std::endl;
+        return 1;
+    }
+    Transducer * mutator = load(argv[1]);
+    Transducer * lexicon = load(argv[2]);
+    Transducer * ospeller_mutator = load(argv[1]);
+    Transducer * ospeller_lexicon = load(argv[2]);
+    if (mutator == NULL || lexicon == NULL ||
+        ospeller_mutator == NULL || ospeller_lexicon == NULL) {
+        return 1;
+    }
+    Speller speller(mutator, lexicon);
+    check_batches(speller, "the first symbols cached");
+    speller.model->prefix_cache.configure(3, 0);
+    check_batches(speller, "three symbols cached");
+
+    // the same through ZHfstOspeller, whose batch only searches the words
+    // it hasn't got corrections of
+    ZHfstOspeller ospeller;
+    ospeller.inject_speller(new Speller(ospeller_mutator, ospeller_lexicon));
+    ospeller.set_queue_limit(2);
+    ospeller.set_weight_limit(2.0);
+    std::vector<std::string> lines(words, words + WORD_COUNT);
+    std::vector<CorrectionQueue> batch = ospeller.suggest_batch(lines);
+    expect(batch.size() == WORD_COUNT, "a queue for every word suggested");
+    for (size_t w = 0; w < WORD_COUNT && w < batch.size(); ++w) {
+        expect(listed(batch[w]) == corrections(speller, words[w], 2, 2.0),
+               std::string("the same suggestions of \"") + words[w] + "\"");
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,10 @@
+#!/bin/bash
+
+if test -x ./tests/batch ; then
+    if ! ./tests/batch $srcdir/tests/errmodel.edit1.hfst $srcdir/tests/acceptor.threads.hfst ; then
+        exit 1
+    fi
+else
+    echo ./tests/batch not built
+    exit 77
+fi
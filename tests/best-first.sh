@@ -0,0 +1,13 @@
+#!/bin/bash
+
+if test -x ./hfst-ospell ; then
+    cat $srcdir/tests/test.strings | ./hfst-ospell -S $srcdir/tests/speller_edit1.zhfst | sort > depth_first_edit1.out
+    cat $srcdir/tests/test.strings | ./hfst-ospell -S -B $srcdir/tests/speller_edit1.zhfst | sort > best_first_edit1.out
+    if ! cmp depth_first_edit1.out best_first_edit1.out ; then
+        exit 1
+    fi
+    rm -f depth_first_edit1.out best_first_edit1.out
+else
+    echo ./hfst-ospell not built
+    exit 77
+fi
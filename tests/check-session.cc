@@ -0,0 +1,172 @@
+// Copyright 2010 University of Helsinki
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*
+  Checks that a CheckSession typed into with append(), backspace() and
+  set_text() accepts its input whenever Speller::check() does, through
+  flag diacritics and characters the language model only matches with
+  its identity symbol, and tells which inputs can still be continued.
+
+  Usage: check-session ERRMODEL LEXICON
+
+  The words are written for the lexicon of acceptor.flags.txt.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ospell.h"
+#include "test-support.h"
+#include "ZHfstOspeller.h"
+
+using hfst_ol::CheckSession;
+using hfst_ol::Speller;
+using hfst_ol::Transducer;
+using hfst_ol::ZHfstOspeller;
+
+// what a session can tell of whether its input can be continued
+enum Viability { Viable, Dead, EitherWay };
+
+static ZHfstOspeller ospeller;
+static Speller * speller = NULL;
+
+// whether @a session has the input @a text, accepts it as the speller
+// does and as @a accepted says, and can continue it as @a viability says
+static void
+expect_session(CheckSession * session, const std::string & text,
+               bool accepted, Viability viability)
+{
+    std::string name = "\"" + text + "\"";
+    expect(session->get_text() == text,
+           "the input " + name + ", not \"" + session->get_text() + "\"");
+    expect(session->check() == accepted,
+           name + (accepted ? " accepted" : " rejected"));
+    expect(check(*speller, text) == accepted,
+           name + (accepted ? " accepted" : " rejected") + " by the speller");
+    if (viability != EitherWay) {
+        expect(session->viable() == (viability == Viable),
+               name + (viability == Viable ? " viable" : " a dead end"));
+    }
+    // a session given the whole input at once agrees
+    CheckSession * fresh = ospeller.start_session();
+    fresh->set_text(text);
+    expect(fresh->check() == session->check() &&
+           fresh->viable() == session->viable(),
+           name + " the same typed at once");
+    delete fresh;
+}
+
+int
+main(int argc, char ** argv)
+{
+    if (argc != 3) {
+        std::cerr << "Usage: check-session ERRMODEL LEXICON" << std::endl;
+        return 1;
+    }
+    Transducer * mutator = load(argv[1]);
+    Transducer * lexicon = load(argv[2]);
+    Transducer * own_mutator = load(argv[1]);
+    Transducer * own_lexicon = load(argv[2]);
+    if (mutator == NULL || lexicon == NULL ||
+        own_mutator == NULL || own_lexicon == NULL) {
+        return 1;
+    }
+    ospeller.inject_speller(new Speller(mutator, lexicon));
+    speller = new Speller(own_mutator, own_lexicon);
+    CheckSession * session = ospeller.start_session();
+    expect(session != NULL, "a session started");
+    if (session == NULL) {
+        return 1;
+    }
+    expect_session(session, "", false, Viable);
+
+    // the plural and the particle after it are allowed by flags
+    session->append("k");
+    expect_session(session, "k", false, Viable);
+    session->append("ala");
+    expect_session(session, "kala", true, Viable);
+    session->append("t");
+    expect_session(session, "kalat", true, Viable);
+    session->append("kin");
+    expect_session(session, "kalatkin", true, Viable);
+    session->append("k");
+    expect_session(session, "kalatkink", false, Dead);
+    session->backspace();
+    session->backspace();
+    session->backspace();
+    session->backspace();
+    expect_session(session, "kalat", true, Viable);
+    session->append("t");
+    expect_session(session, "kalatt", false, Dead);
+    session->backspace();
+    session->backspace();
+    session->backspace();
+    expect_session(session, "kal", false, Viable);
+    session->append("a");
+    expect_session(session, "kala", true, Viable);
+    session->append("kin");
+    expect_session(session, "kalakin", false, EitherWay);
+
+    // a compound, where the flags set on the first part decide the plural
+    // of the second
+    session->set_text("vesit");
+    expect_session(session, "vesit", false, EitherWay);
+    session->set_text("vesi");
+    expect_session(session, "vesi", true, Viable);
+    session->append("kalat");
+    expect_session(session, "vesikalat", true, Viable);
+    session->set_text("kalavesit");
+    expect_session(session, "kalavesit", false, EitherWay);
+    session->set_text("kalavesi");
+    expect_session(session, "kalavesi", true, Viable);
+    session->append("ä");
+    expect_session(session, "kalavesiä", false, Dead);
+
+    // characters the language model doesn't have, typed and deleted a
+    // character of several bytes at a time
+    session->set_text("#äö");
+    expect_session(session, "#äö", true, Viable);
+    session->backspace();
+    expect_session(session, "#ä", true, Viable);
+    session->append("€");
+    expect_session(session, "#ä€", true, Viable);
+    session->backspace();
+    session->backspace();
+    expect_session(session, "#", true, Viable);
+    session->append("a");
+    expect_session(session, "#a", false, Dead);
+    // the same first byte as "ä", so the text in common ends inside it
+    session->set_text("#äö");
+    session->set_text("#öö");
+    expect_session(session, "#öö", true, Viable);
+    session->set_text("#öa");
+    expect_session(session, "#öa", false, Dead);
+
+    session->set_text("talot");
+    expect_session(session, "talot", true, Viable);
+    session->set_text("");
+    expect_session(session, "", false, Viable);
+    session->backspace();
+    expect_session(session, "", false, Viable);
+    session->append("ta");
+    session->reset();
+    expect_session(session, "", false, Viable);
+    delete session;
+    return failed ? 1 : 0;
+}
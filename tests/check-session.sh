@@ -0,0 +1,10 @@
+#!/bin/bash
+
+if test -x ./tests/check-session ; then
+    if ! ./tests/check-session $srcdir/tests/errmodel.edit1.hfst $srcdir/tests/acceptor.flags.hfst ; then
+        exit 1
+    fi
+else
+    echo ./tests/check-session not built
+    exit 77
+fi
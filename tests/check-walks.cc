@@ -0,0 +1,147 @@
+// Copyright 2010 University of Helsinki
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*
+  Checks which walk SpellerModel chooses for Speller::check() on language
+  models with and without flag diacritics and transitions sharing an input
+  symbol, and that every walk a model allows accepts the same words, with
+  and without an error model translating the symbols.
+
+  Usage: check-walks ERRMODEL WALKS WIDE ANALYSER FLAGS
+
+  WALKS, WIDE, ANALYSER and FLAGS are the language models of
+  acceptor.walks.txt, acceptor.wide.txt, analyser.default.txt and
+  acceptor.flags.txt.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ospell.h"
+#include "test-support.h"
+
+using hfst_ol::Speller;
+using hfst_ol::SpellerModel;
+using hfst_ol::Transducer;
+
+// a word and whether the language model accepts it
+struct Checked
+{
+    const char * word;
+    bool accepted;
+};
+
+static const char *
+walk_name(SpellerModel::CheckWalk walk)
+{
+    switch (walk) {
+    case SpellerModel::DirectWalk:
+        return "direct";
+    case SpellerModel::StackWalk:
+        return "stack";
+    default:
+        return "general";
+    }
+}
+
+// check @a words with the language model in @a lexicon_file, with and
+// without the error model in @a mutator_file, expecting the model to
+// choose @a chosen, and with every walk down from it
+static void
+check_walks(const char * mutator_file, const char * lexicon_file,
+            SpellerModel::CheckWalk chosen, const Checked * words,
+            size_t word_count)
+{
+    for (int with_mutator = 0; with_mutator < 2; ++with_mutator) {
+        Transducer * mutator = with_mutator ? load(mutator_file) : NULL;
+        Transducer * lexicon = load(lexicon_file);
+        if ((with_mutator && mutator == NULL) || lexicon == NULL) {
+            failed = true;
+            return;
+        }
+        std::string model_name = std::string(lexicon_file) +
+            (with_mutator ? " with the error model" : "");
+        SpellerModel model(mutator, lexicon);
+        expect(model.check_walk == chosen,
+               model_name + " walked " + walk_name(chosen) + ", not " +
+               walk_name(model.check_walk));
+        Speller speller(&model);
+        for (int walk = chosen; walk >= SpellerModel::GeneralWalk; --walk) {
+            model.check_walk = static_cast<SpellerModel::CheckWalk>(walk);
+            for (size_t w = 0; w < word_count; ++w) {
+                expect(check(speller, words[w].word) == words[w].accepted,
+                       std::string(words[w].word) +
+                       (words[w].accepted ? " accepted" : " rejected") +
+                       " by the " + walk_name(model.check_walk) +
+                       " walk of " + model_name);
+            }
+        }
+    }
+}
+
+// one transition for each input symbol, and characters the model doesn't
+// have matched by the unknown or the identity symbol, or both after "x"
+static const Checked walks_words[] = {
+    {"ab", true}, {"a", false}, {"abb", false}, {"", false},
+    {"#", true}, {"#ä€", true}, {"#k", true}, {"#a", false},
+    {"äa", true}, {"ka", true}, {"äb", false}, {"ä", false},
+    {"xä", true}, {"xäb", true}, {"xb", false}, {"xäa", false}
+};
+
+// more transitions with "a" than the stack of the walk has room for
+static const Checked wide_words[] = {
+    {"ab", true}, {"a", false}, {"b", false}, {"abb", false}, {"", false}
+};
+
+// epsilons before the final state
+static const Checked analyser_words[] = {
+    {"olu", true}, {"olut", true}, {"vesi", true}, {"ves", false},
+    {"olutt", false}, {"", false}, {"ä", false}
+};
+
+// the plural and compounds allowed by flag diacritics
+static const Checked flags_words[] = {
+    {"kala", true}, {"talo", true}, {"vesi", true}, {"kalat", true},
+    {"talot", true}, {"kalatalo", true}, {"vesikalat", true},
+    {"kalavesi", true}, {"kalatkin", true}, {"#ä", true},
+    {"vesit", false}, {"kalavesit", false}, {"kalakin", false},
+    {"kal", false}, {"#a", false}, {"ä", false}, {"kalä", false},
+    {"kalatt", false}
+};
+
+#define COUNT(words) (sizeof(words) / sizeof(words[0]))
+
+int
+main(int argc, char ** argv)
+{
+    if (argc != 6) {
+        std::cerr << "Usage: check-walks ERRMODEL WALKS WIDE ANALYSER FLAGS"
+                  << std::endl;
+        return 1;
+    }
+    check_walks(argv[1], argv[2], SpellerModel::DirectWalk,
+                walks_words, COUNT(walks_words));
+    check_walks(argv[1], argv[3], SpellerModel::StackWalk,
+                wide_words, COUNT(wide_words));
+    check_walks(argv[1], argv[4], SpellerModel::StackWalk,
+                analyser_words, COUNT(analyser_words));
+    check_walks(argv[1], argv[5], SpellerModel::GeneralWalk,
+                flags_words, COUNT(flags_words));
+    return failed ? 1 : 0;
+}
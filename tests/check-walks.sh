@@ -0,0 +1,10 @@
+#!/bin/bash
+
+if test -x ./tests/check-walks ; then
+    if ! ./tests/check-walks $srcdir/tests/errmodel.edit1.hfst $srcdir/tests/acceptor.walks.hfst $srcdir/tests/acceptor.wide.hfst $srcdir/tests/analyser.default.hfst $srcdir/tests/acceptor.flags.hfst ; then
+        exit 1
+    fi
+else
+    echo ./tests/check-walks not built
+    exit 77
+fi
@@ -0,0 +1,119 @@
+// Copyright 2010 University of Helsinki
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*
+  Checks the bounds MutatorBounds computes for the rest of the input with
+  an error model of one edit, and that correcting with them finds the
+  same corrections as without them from fewer search nodes.
+
+  Usage: mutator-bounds ERRMODEL LEXICON
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "ospell.h"
+#include "test-support.h"
+
+using hfst_ol::MutatorBounds;
+using hfst_ol::Speller;
+using hfst_ol::SpellerModel;
+using hfst_ol::Transducer;
+using hfst_ol::Weight;
+
+static Weight
+bound_after(Speller & speller, const std::string & word, unsigned int consumed)
+{
+    std::vector<char> line(word.begin(), word.end());
+    line.push_back('\0');
+    expect(speller.init_input(&line[0]), "tokenizing " + word);
+    std::vector<Weight> bounds;
+    speller.model->mutator_bounds.compute(speller.input, bounds);
+    expect(bounds.size() % (speller.input.size() + 1) == 0,
+           "one bound for each position and state of " + word);
+    return speller.model->mutator_bounds.bound(bounds, consumed, 0);
+}
+
+int
+main(int argc, char ** argv)
+{
+    if (argc != 3) {
+        std::cerr << "Usage: mutator-bounds ERRMODEL LEXICON" << std::endl;
+        return 1;
+    }
+    Transducer * mutator = load(argv[1]);
+    Transducer * lexicon = load(argv[2]);
+    Transducer * plain_mutator = load(argv[1]);
+    Transducer * plain_lexicon = load(argv[2]);
+    if (mutator == NULL || lexicon == NULL ||
+        plain_mutator == NULL || plain_lexicon == NULL) {
+        return 1;
+    }
+    SpellerModel model(mutator, lexicon);
+    Speller bounded(&model);
+    // the same automata with no bounds for the rest of the input
+    SpellerModel plain_model(plain_mutator, plain_lexicon);
+    plain_model.mutator_bounds = MutatorBounds();
+    Speller plain(&plain_model);
+    const Weight infinity = std::numeric_limits<Weight>::infinity();
+
+    // "kala" needs no edits, and "ä" is not in the error model, so it
+    // takes the one edit there is, and "äiä" can't be corrected at all
+    expect(bound_after(bounded, "kala", 0) == 0.0, "bound of kala");
+    expect(bound_after(bounded, "kala", 4) == 0.0, "bound at the end of kala");
+    expect(bound_after(bounded, "käla", 0) == 1.0, "bound of käla");
+    expect(bound_after(bounded, "käla", 1) == 1.0, "bound of käla after k");
+    expect(bound_after(bounded, "käla", 2) == 0.0, "bound of käla after kä");
+    expect(bound_after(bounded, "äiä", 0) == infinity, "bound of äiä");
+    expect(bound_after(bounded, "", 0) == 0.0, "bound of the empty input");
+    expect(bound_after(plain, "käla", 0) == 0.0, "no bounds without them");
+
+    const char * words[] = {"kala", "käla", "kalä", "äiä", "kqla", "tqlo",
+                            "kaxat", "sqli", "kolla", "kalatt", "qqqq"};
+    unsigned long bounded_nodes = 0;
+    unsigned long plain_nodes = 0;
+    for (const char * word : words) {
+        for (int nbest = 0; nbest <= 2; ++nbest) {
+            Corrections with_bounds =
+                corrections(bounded, word, nbest, 3.0);
+            bounded_nodes += bounded.expanded;
+            Corrections without_bounds =
+                corrections(plain, word, nbest, 3.0);
+            plain_nodes += plain.expanded;
+            expect(with_bounds == without_bounds,
+                   std::string("same corrections of ") + word);
+            for (auto & correction : with_bounds) {
+                expect(correction.second >= bound_after(bounded, word, 0),
+                       std::string("corrections of ") + word +
+                       " within the bound");
+            }
+        }
+        expect(bound_after(bounded, word, 0) < infinity ||
+               corrections(bounded, word, 0, -1.0).empty(),
+               std::string("no corrections of ") + word + " past the bound");
+    }
+    // an edit before the "ä" of "kalä" leaves none for it, so the search
+    // doesn't go on from one
+    corrections(bounded, "kalä", 0, 3.0);
+    corrections(plain, "kalä", 0, 3.0);
+    expect(bounded.expanded < plain.expanded, "kalä pruned by the bounds");
+    expect(bounded_nodes < plain_nodes, "fewer nodes with the bounds");
+    return failed ? 1 : 0;
+}
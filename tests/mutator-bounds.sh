@@ -0,0 +1,10 @@
+#!/bin/bash
+
+if test -x ./tests/mutator-bounds ; then
+    if ! ./tests/mutator-bounds $srcdir/tests/errmodel.edit1.hfst $srcdir/tests/acceptor.threads.hfst ; then
+        exit 1
+    fi
+else
+    echo ./tests/mutator-bounds not built
+    exit 77
+fi
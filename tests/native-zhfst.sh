@@ -0,0 +1,47 @@
+#!/bin/bash
+
+if test -x ./hfst-ospell -a -x ./hfst-ospell-convert ; then
+    for speller in speller_edit1 speller_basic speller_analyser ; do
+        if ! ./hfst-ospell-convert $srcdir/tests/$speller.zhfst native_$speller.zhfst ; then
+            exit 1
+        fi
+        # the automata have to be converted, and converting them again
+        # must give the same bytes back
+        if cmp -s $srcdir/tests/$speller.zhfst native_$speller.zhfst ; then
+            exit 1
+        fi
+        if ! ./hfst-ospell-convert native_$speller.zhfst native_again_$speller.zhfst ; then
+            exit 1
+        fi
+        if ! cmp native_$speller.zhfst native_again_$speller.zhfst ; then
+            exit 1
+        fi
+        # the metadata, suggestions and analyses stay the same
+        for options in "-v" "-S -n 100" "-a" ; do
+            ./hfst-ospell $options $srcdir/tests/$speller.zhfst < $srcdir/tests/test.strings > native_classic.out
+            ./hfst-ospell $options native_$speller.zhfst < $srcdir/tests/test.strings > native_native.out
+            if ! cmp native_classic.out native_native.out ; then
+                exit 1
+            fi
+        done
+        rm -f native_$speller.zhfst native_again_$speller.zhfst native_classic.out native_native.out
+    done
+    # a truncated automaton is refused, and leaves no output behind
+    ./hfst-ospell-convert $srcdir/tests/acceptor.threads.hfst native_whole.hfst || exit 1
+    for automaton in $srcdir/tests/acceptor.threads.hfst native_whole.hfst ; do
+        size=$(wc -c < $automaton)
+        for length in 3 12 40 100 $((size - 1)) ; do
+            head -c $length $automaton > native_truncated.hfst
+            if ./hfst-ospell-convert native_truncated.hfst native_converted.hfst 2> /dev/null ; then
+                exit 1
+            fi
+            if test -e native_converted.hfst ; then
+                exit 1
+            fi
+        done
+    done
+    rm -f native_whole.hfst native_truncated.hfst
+else
+    echo ./hfst-ospell-convert not built
+    exit 77
+fi
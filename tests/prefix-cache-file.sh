@@ -0,0 +1,21 @@
+#!/bin/bash
+
+if test -x ./hfst-ospell ; then
+    rm -f prefix_cache_edit1.bin
+    cat $srcdir/tests/test.strings | ./hfst-ospell -S $srcdir/tests/speller_edit1.zhfst | sort > cold_edit1.out
+    cat $srcdir/tests/test.strings | ./hfst-ospell -S -W 2 -c prefix_cache_edit1.bin $srcdir/tests/speller_edit1.zhfst | sort > warm_edit1.out
+    if ! test -f prefix_cache_edit1.bin ; then
+        exit 1
+    fi
+    cat $srcdir/tests/test.strings | ./hfst-ospell -S -c prefix_cache_edit1.bin $srcdir/tests/speller_edit1.zhfst | sort > loaded_edit1.out
+    if ! cmp cold_edit1.out warm_edit1.out ; then
+        exit 1
+    fi
+    if ! cmp cold_edit1.out loaded_edit1.out ; then
+        exit 1
+    fi
+    rm -f cold_edit1.out warm_edit1.out loaded_edit1.out prefix_cache_edit1.bin
+else
+    echo ./hfst-ospell not built
+    exit 77
+fi
@@ -0,0 +1,142 @@
+// Copyright 2010 University of Helsinki
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*
+  Checks which entries the prefix cache of a SpellerModel builds, finds
+  and drops for a few corrections, with and without a memory budget, and
+  that the corrections are the ones found with only the first symbols
+  cached.
+
+  Usage: prefix-cache ERRMODEL LEXICON
+
+  The words are written for the lexicon of acceptor.threads.txt.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ospell.h"
+#include "test-support.h"
+
+using hfst_ol::PrefixCache;
+using hfst_ol::Speller;
+using hfst_ol::SpellerModel;
+using hfst_ol::Transducer;
+
+// the prefix of the entry @a entry as a string, for @a speller
+static std::string
+prefix_of(Speller & speller, const PrefixCache::EntryStatistics & entry)
+{
+    std::string prefix;
+    for (hfst_ol::SymbolNumber symbol : entry.prefix) {
+        prefix += speller.mutator->get_key_table()->at(symbol);
+    }
+    return prefix;
+}
+
+// the prefixes of the entries, most recently used first, with their hits
+static std::string
+entries_of(Speller & speller, const PrefixCache::Statistics & statistics)
+{
+    std::string text;
+    for (auto & entry : statistics.entries) {
+        text += prefix_of(speller, entry) + ":" +
+            std::to_string(entry.hits) + " ";
+    }
+    return text;
+}
+
+// the words corrected, where "kq", "ka" and "tq" are used again
+static const char * words[] = {
+    "kqla", "kqlo", "kqla", "kalq", "kalo", "tqlo", "tqla", "kqla"
+};
+static const size_t WORD_COUNT = sizeof(words) / sizeof(words[0]);
+
+int
+main(int argc, char ** argv)
+{
+    if (argc != 3) {
+        std::cerr << "Usage: prefix-cache ERRMODEL LEXICON" << std::endl;
+        return 1;
+    }
+    std::vector<Transducer *> automata;
+    for (int copy = 0; copy < 3; ++copy) {
+        automata.push_back(load(argv[1]));
+        automata.push_back(load(argv[2]));
+        if (automata[2 * copy] == NULL || automata[2 * copy + 1] == NULL) {
+            return 1;
+        }
+    }
+    // the corrections with only the first symbols cached
+    SpellerModel first_model(automata[0], automata[1]);
+    Speller first(&first_model);
+    std::vector<Corrections> expected;
+    for (size_t w = 0; w < WORD_COUNT; ++w) {
+        expected.push_back(corrections(first, words[w], 2));
+    }
+
+    // without a budget, every prefix of up to two symbols is built once
+    // and found after that, "k" also when "ka" is built from it
+    SpellerModel model(automata[2], automata[3]);
+    model.prefix_cache.configure(2, 0);
+    Speller speller(&model);
+    for (size_t w = 0; w < WORD_COUNT; ++w) {
+        expect(corrections(speller, words[w], 2) == expected[w],
+               std::string("same corrections of ") + words[w]);
+    }
+    PrefixCache::Statistics statistics = model.prefix_cache.get_statistics();
+    expect(statistics.misses == 5, "5 entries built");
+    expect(statistics.hits == 6, "6 entries found");
+    expect(statistics.evictions == 0, "nothing dropped without a budget");
+    expect(entries_of(speller, statistics) == "kq:3 tq:1 t:0 ka:1 k:1 ",
+           "entries kq:3 tq:1 t:0 ka:1 k:1, not " +
+           entries_of(speller, statistics));
+    size_t memory = 0;
+    for (auto & entry : statistics.entries) {
+        memory += entry.memory;
+    }
+    expect(memory == statistics.memory, "memory of the entries summed");
+
+    // a shorter length drops the longer entries
+    model.prefix_cache.configure(1, 0);
+    statistics = model.prefix_cache.get_statistics();
+    expect(entries_of(speller, statistics) == "t:0 k:1 ",
+           "entries t:0 k:1 after shortening, not " +
+           entries_of(speller, statistics));
+
+    // with room for about half of them, the least recently used ones go
+    SpellerModel budget_model(automata[4], automata[5]);
+    size_t budget = memory / 2;
+    budget_model.prefix_cache.configure(2, budget);
+    Speller budgeted(&budget_model);
+    for (size_t w = 0; w < WORD_COUNT; ++w) {
+        expect(corrections(budgeted, words[w], 2) == expected[w],
+               std::string("same corrections of ") + words[w] +
+               " within the budget");
+    }
+    statistics = budget_model.prefix_cache.get_statistics();
+    expect(statistics.evictions > 0, "entries dropped for the budget");
+    expect(statistics.memory <= budget, "entries within the budget");
+    expect(!statistics.entries.empty() &&
+           prefix_of(budgeted, statistics.entries[0]) == "kq",
+           "the entry used last kept");
+    expect(statistics.entries.size() + statistics.evictions ==
+           statistics.misses, "every entry built kept or dropped");
+    return failed ? 1 : 0;
+}
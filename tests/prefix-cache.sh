@@ -0,0 +1,17 @@
+#!/bin/bash
+
+if test -x ./hfst-ospell -a -x ./tests/prefix-cache ; then
+    if ! ./tests/prefix-cache $srcdir/tests/errmodel.edit1.hfst $srcdir/tests/acceptor.threads.hfst ; then
+        exit 1
+    fi
+    # kqla, kalq and tqlo build the entries of k, kq, ka, t and tq, the
+    # other misspellings find kq, k and tq, and kalo is not corrected
+    printf '%s\n' kqla kqlo kqla kalq kalo tqlo tqla kqla | ./hfst-ospell -v -S -r 0 -p 2 $srcdir/tests/speller_threads.zhfst > prefix_cache_threads.out
+    if ! grep -q "^Prefix cache: 5 entries in [0-9]* bytes, 5 hits, 5 misses, 0 evictions$" prefix_cache_threads.out ; then
+        exit 1
+    fi
+    rm -f prefix_cache_threads.out
+else
+    echo ./hfst-ospell not built
+    exit 77
+fi
@@ -0,0 +1,121 @@
+// Copyright 2010 University of Helsinki
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*
+  Checks that pruning the search states reached before for less keeps the
+  best correction of every word and only finds corrections the whole
+  search finds, at no less weight, in fewer search nodes, with each search
+  and when the search is split among threads.
+
+  Usage: prune-visited ERRMODEL LEXICON
+
+  The words are written for the lexicons of acceptor.threads.txt and
+  acceptor.flags.txt.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <iostream>
+#include <string>
+
+#include "ospell.h"
+#include "test-support.h"
+
+using hfst_ol::Speller;
+using hfst_ol::Transducer;
+
+// whether every correction in @a part is in @a whole, with the weight
+// there or a worse one
+static bool
+found_in(const Corrections & part, const Corrections & whole)
+{
+    for (auto & correction : part) {
+        bool found = false;
+        for (auto & other : whole) {
+            found = found || (other.first == correction.first &&
+                              other.second <= correction.second);
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the repeated letters reach the same states by several edits
+static const char * words[] = {
+    "kqla", "kolla", "kalatt", "kaxat", "sqli", "qqqq", "kalakin", "vesit",
+    "kalla", ""
+};
+
+// check pruning with the search of @a speller as it is set
+static void
+check_pruning(Speller & speller, const std::string & search)
+{
+    bool fewer = false;
+    for (const char * word : words) {
+        std::string name = std::string("\"") + word + "\" in the " + search;
+        speller.prune_visited = false;
+        Corrections whole = corrections(speller, word);
+        unsigned long expanded = speller.expanded;
+        speller.prune_visited = true;
+        Corrections pruned = corrections(speller, word);
+        expect(found_in(pruned, whole), name + " pruned found in whole");
+        expect(whole.empty() == pruned.empty() &&
+               (whole.empty() || pruned[0].second == whole[0].second),
+               name + " the best weight pruned");
+        expect(speller.expanded <= expanded, name + " no more nodes pruned");
+        fewer = fewer || speller.expanded < expanded;
+
+        // and the limits are applied to what is left
+        for (int nbest = 1; nbest <= 2; ++nbest) {
+            Corrections part = corrections(speller, word, nbest, 2.0);
+            expect(found_in(part, whole) &&
+                   part.size() <= static_cast<size_t>(nbest),
+                   name + " pruned with nbest " + std::to_string(nbest));
+            expect(part.empty() == (whole.empty() || whole[0].second > 2.0) &&
+                   (part.empty() || part[0].second == whole[0].second),
+                   name + " the best weight pruned with nbest " +
+                   std::to_string(nbest));
+        }
+    }
+    expect(fewer, "some word in fewer nodes pruned in the " + search);
+    speller.prune_visited = false;
+}
+
+int
+main(int argc, char ** argv)
+{
+    if (argc != 3) {
+        std::cerr << "Usage: prune-visited ERRMODEL LEXICON" << std::endl;
+        return 1;
+    }
+    Transducer * mutator = load(argv[1]);
+    Transducer * lexicon = load(argv[2]);
+    if (mutator == NULL || lexicon == NULL) {
+        return 1;
+    }
+    Speller speller(mutator, lexicon);
+    speller.search = Speller::DepthFirst;
+    check_pruning(speller, "depth first search");
+    speller.search = Speller::BestFirst;
+    check_pruning(speller, "best first search");
+    speller.search = Speller::DepthFirst;
+    speller.threads = 4;
+    speller.split_after = 1;
+    check_pruning(speller, "split search");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,20 @@
+#!/bin/bash
+
+if test -x ./tests/prune-visited ; then
+    for lexicon in threads flags ; do
+        if ! ./tests/prune-visited $srcdir/tests/errmodel.edit1.hfst $srcdir/tests/acceptor.$lexicon.hfst ; then
+            exit 1
+        fi
+    done
+else
+    echo ./tests/prune-visited not built
+    exit 77
+fi
+if test -x ./hfst-ospell ; then
+    if ! ./hfst-ospell -S -P $srcdir/tests/speller_edit1.zhfst < $srcdir/tests/test.strings > /dev/null ; then
+        exit 1
+    fi
+else
+    echo ./hfst-ospell not built
+    exit 77
+fi
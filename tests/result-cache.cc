@@ -0,0 +1,182 @@
+// Copyright 2010 University of Helsinki
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*
+  Checks the hits, misses and evictions of ResultCache, and which calls of
+  ZHfstOspeller it answers once it is asked to: the same word with the
+  same limits, but not with other limits or after a search was cut short.
+
+  Usage: result-cache ERRMODEL LEXICON
+
+  The words are written for the lexicon of acceptor.threads.txt.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ospell.h"
+#include "test-support.h"
+#include "ZHfstOspeller.h"
+
+using hfst_ol::CorrectionQueue;
+using hfst_ol::ResultCache;
+using hfst_ol::ResultCacheStatistics;
+using hfst_ol::Speller;
+using hfst_ol::Transducer;
+using hfst_ol::ZHfstOspeller;
+
+// whether @a statistics has @a entries, @a hits and @a misses
+static bool
+counted(const ResultCacheStatistics & statistics, size_t entries,
+        unsigned long hits, unsigned long misses)
+{
+    return statistics.entries == entries && statistics.hits == hits &&
+        statistics.misses == misses;
+}
+
+static void
+check_cache(void)
+{
+    ResultCache<int> cache;
+    int value = 0;
+    expect(!cache.find("a", value), "nothing found without capacity");
+    cache.insert("a", 1);
+    expect(counted(cache.get_statistics(), 0, 0, 0),
+           "nothing kept or counted without capacity");
+
+    cache.set_capacity(64);
+    cache.insert("a", 1);
+    cache.insert("a", 2);
+    expect(cache.find("a", value) && value == 1, "the first value kept");
+    expect(!cache.find("b", value), "b not found");
+    expect(counted(cache.get_statistics(), 1, 1, 1), "a found, b missed");
+
+    // with two entries in each shard, one found after every insertion is
+    // never the least recently used one
+    cache.set_capacity(32);
+    bool kept = true;
+    for (int i = 0; i < 1000; ++i) {
+        cache.insert("word" + std::to_string(i), i);
+        kept = kept && cache.find("a", value);
+    }
+    expect(kept, "a kept while used");
+    ResultCacheStatistics statistics = cache.get_statistics();
+    expect(statistics.entries <= 32, "at most 32 entries kept");
+    int found = 0;
+    for (int i = 0; i < 1000; ++i) {
+        if (cache.find("word" + std::to_string(i), value)) {
+            expect(value == i, "the value of word" + std::to_string(i));
+            ++found;
+        }
+    }
+    expect(found + 1 == static_cast<int>(statistics.entries),
+           "the others dropped");
+    cache.set_capacity(16);
+    expect(cache.get_statistics().entries <= 16, "dropped to 16 entries");
+    cache.clear();
+    expect(cache.get_statistics().entries == 0, "cleared");
+}
+
+static void
+check_ospeller(Transducer * mutator, Transducer * lexicon)
+{
+    ZHfstOspeller ospeller;
+    ospeller.inject_speller(new Speller(mutator, lexicon));
+    // nothing is remembered unless asked to
+    expect(ospeller.spell("kala") && ospeller.spell("kala"),
+           "kala spelled uncached");
+    expect(counted(ospeller.get_result_cache_statistics(), 0, 0, 0),
+           "nothing counted by default");
+    ospeller.set_result_cache(64);
+
+    expect(ospeller.spell("kala") && ospeller.spell("kala"), "kala spelled");
+    expect(counted(ospeller.get_result_cache_statistics(), 1, 1, 1),
+           "kala spelled once");
+
+    Corrections first = listed(ospeller.suggest("kqla"));
+    expect(first.size() > 1, "kqla corrected");
+    expect(listed(ospeller.suggest("kqla")) == first, "kqla found");
+    expect(counted(ospeller.get_result_cache_statistics(), 2, 2, 2),
+           "kqla corrected once");
+
+    // other limits are another search
+    ospeller.set_queue_limit(1);
+    expect(listed(ospeller.suggest("kqla")).size() == 1,
+           "kqla corrected with one");
+    ospeller.set_queue_limit(0);
+    expect(listed(ospeller.suggest("kqla")) == first, "kqla found again");
+    expect(counted(ospeller.get_result_cache_statistics(), 3, 3, 3),
+           "kqla corrected with two limits");
+
+    // a search cut short isn't kept
+    bool truncated = false;
+    ospeller.set_search_budget(1);
+    ospeller.suggest("kolla", truncated);
+    expect(truncated, "kolla cut short");
+    ospeller.suggest("kolla", truncated);
+    expect(counted(ospeller.get_result_cache_statistics(), 3, 3, 5),
+           "kolla searched twice");
+    ospeller.set_search_budget(0);
+
+    // a batch finds the ones there are, and keeps the others
+    std::vector<std::string> words = {"kqla", "tqlo", "kqla"};
+    std::vector<CorrectionQueue> batch = ospeller.suggest_batch(words);
+    expect(listed(batch[0]) == first && listed(batch[2]) == first,
+           "kqla found in a batch");
+    expect(counted(ospeller.get_result_cache_statistics(), 4, 5, 6),
+           "tqlo kept from a batch");
+
+    // the threads sharing a search don't change what it finds
+    ospeller.set_search_threads(4, 1);
+    expect(listed(ospeller.suggest("kqla")) == first,
+           "kqla found with threads");
+    ospeller.set_search_threads(1);
+    expect(counted(ospeller.get_result_cache_statistics(), 4, 6, 6),
+           "kqla found with threads once");
+
+    // analyses of symbols are kept like the others
+    size_t analyses = ospeller.analyseSymbols("kala").size();
+    expect(analyses > 0 && ospeller.analyseSymbols("kala").size() == analyses,
+           "kala analysed");
+    expect(counted(ospeller.get_result_cache_statistics(), 5, 7, 7),
+           "kala analysed once");
+
+    // without a cache, nothing is counted
+    ospeller.set_result_cache(0);
+    expect(listed(ospeller.suggest("kqla")) == first, "kqla uncached");
+    expect(counted(ospeller.get_result_cache_statistics(), 0, 7, 7),
+           "nothing counted without a cache");
+}
+
+int
+main(int argc, char ** argv)
+{
+    if (argc != 3) {
+        std::cerr << "Usage: result-cache ERRMODEL LEXICON" << std::endl;
+        return 1;
+    }
+    Transducer * mutator = load(argv[1]);
+    Transducer * lexicon = load(argv[2]);
+    if (mutator == NULL || lexicon == NULL) {
+        return 1;
+    }
+    check_cache();
+    check_ospeller(mutator, lexicon);
+    return failed ? 1 : 0;
+}
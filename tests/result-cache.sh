@@ -0,0 +1,22 @@
+#!/bin/bash
+
+if test -x ./hfst-ospell -a -x ./tests/result-cache ; then
+    if ! ./tests/result-cache $srcdir/tests/errmodel.edit1.hfst $srcdir/tests/acceptor.threads.hfst ; then
+        exit 1
+    fi
+    # the five words are spelled and four of them corrected once, and
+    # found the second time
+    cat $srcdir/tests/test.strings $srcdir/tests/test.strings | ./hfst-ospell -v -S -r 64 $srcdir/tests/speller_edit1.zhfst > result_cache_edit1.out
+    if ! grep -q "^Result cache: 9 entries, 9 hits, 9 misses$" result_cache_edit1.out ; then
+        exit 1
+    fi
+    # and nothing is remembered unless asked to
+    cat $srcdir/tests/test.strings $srcdir/tests/test.strings | ./hfst-ospell -v -S $srcdir/tests/speller_edit1.zhfst > result_cache_edit1.out
+    if ! grep -q "^Result cache: 0 entries, 0 hits, 0 misses$" result_cache_edit1.out ; then
+        exit 1
+    fi
+    rm -f result_cache_edit1.out
+else
+    echo ./hfst-ospell not built
+    exit 77
+fi
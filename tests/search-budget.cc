@@ -0,0 +1,166 @@
+// Copyright 2010 University of Helsinki
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*
+  Checks that the node budget, the frontier budget and the time cutoff of
+  Speller::correct() stop the search where they should and say so, that
+  what they let through was found by the whole search too, and that
+  budgets the search stays within change nothing.
+
+  Usage: search-budget ERRMODEL LEXICON
+
+  The words are written for the lexicon of acceptor.threads.txt.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ospell.h"
+#include "test-support.h"
+
+using hfst_ol::Speller;
+using hfst_ol::Transducer;
+
+// whether every correction in @a part is in @a whole, with the weight
+// there or a worse one
+static bool
+found_in(const Corrections & part, const Corrections & whole)
+{
+    for (auto & correction : part) {
+        bool found = false;
+        for (auto & other : whole) {
+            found = found || (other.first == correction.first &&
+                              other.second <= correction.second);
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char * words[] = {"kqla", "kolla", "kaxat", "sqli", "qqqq"};
+
+// check the budgets with the search of @a speller as it is set
+static void
+check_budgets(Speller & speller, const std::string & search)
+{
+    for (const char * word : words) {
+        std::string name = std::string(word) + " in the " + search;
+        speller.max_expanded = 0;
+        speller.max_frontier = 0;
+        Corrections whole = corrections(speller, word);
+        unsigned long expanded = speller.expanded;
+        expect(!speller.limit_reached, name + " not stopped without limits");
+        expect(expanded > 2, name + " takes some nodes");
+
+        // the node the search stops at is counted but not expanded
+        speller.max_expanded = expanded - 1;
+        Corrections part = corrections(speller, word);
+        expect(speller.limit_reached, name + " stopped a node short");
+        expect(speller.expanded == expanded,
+               name + " stopped at the last node");
+        expect(found_in(part, whole), name + " a node short found in whole");
+        speller.max_expanded = 2;
+        part = corrections(speller, word);
+        expect(speller.limit_reached, name + " stopped after two nodes");
+        expect(speller.expanded == 3, name + " stopped at the third node");
+        expect(found_in(part, whole), name + " in two nodes found in whole");
+        speller.max_expanded = expanded;
+        expect(corrections(speller, word) == whole && !speller.limit_reached,
+               name + " whole within as many nodes as it takes");
+        speller.max_expanded = 0;
+
+        speller.max_frontier = 1;
+        part = corrections(speller, word);
+        expect(speller.limit_reached, name + " stopped by the frontier");
+        expect(speller.expanded < expanded, name + " stopped early by it");
+        expect(found_in(part, whole),
+               name + " in the frontier found in whole");
+        speller.max_frontier = 1000000;
+        expect(corrections(speller, word) == whole && !speller.limit_reached,
+               name + " whole within a big frontier");
+        speller.max_frontier = 0;
+
+        // the first node looks at the clock, which is past a deadline of a
+        // nanosecond by then
+        part = corrections(speller, word, 0, -1.0, -1.0, 1e-9);
+        expect(speller.limit_reached, name + " stopped by the time cutoff");
+        expect(speller.expanded == 1, name + " stopped at the first node");
+        expect(part.empty() || found_in(part, whole),
+               name + " in no time found in whole");
+        expect(corrections(speller, word, 0, -1.0, -1.0, 1000.0) == whole &&
+               !speller.limit_reached, name + " whole within a long time");
+    }
+
+    // each line of a batch has the budget to itself
+    std::vector<std::string> lines(words, words + sizeof(words) /
+                                   sizeof(words[0]));
+    std::vector<bool> truncated;
+    speller.max_expanded = 2;
+    speller.correct_batch(lines, 0, -1.0, -1.0, 0.0, &truncated);
+    bool all_stopped = truncated.size() == lines.size();
+    for (size_t i = 0; i < truncated.size(); ++i) {
+        all_stopped = all_stopped && truncated[i];
+    }
+    expect(all_stopped, "every line of a batch stopped in the " + search);
+    speller.max_expanded = 0;
+    speller.correct_batch(lines, 0, -1.0, -1.0, 0.0, &truncated);
+    bool none_stopped = truncated.size() == lines.size();
+    for (size_t i = 0; i < truncated.size(); ++i) {
+        none_stopped = none_stopped && !truncated[i];
+    }
+    expect(none_stopped, "no line of a batch stopped in the " + search);
+}
+
+int
+main(int argc, char ** argv)
+{
+    if (argc != 3) {
+        std::cerr << "Usage: search-budget ERRMODEL LEXICON" << std::endl;
+        return 1;
+    }
+    Transducer * mutator = load(argv[1]);
+    Transducer * lexicon = load(argv[2]);
+    if (mutator == NULL || lexicon == NULL) {
+        return 1;
+    }
+    Speller speller(mutator, lexicon);
+    speller.search = Speller::DepthFirst;
+    check_budgets(speller, "depth first search");
+    speller.search = Speller::BestFirst;
+    check_budgets(speller, "best first search");
+
+    // a split search is stopped by the budgets too, and only by them
+    speller.search = Speller::DepthFirst;
+    speller.max_expanded = 0;
+    speller.max_frontier = 0;
+    Corrections whole = corrections(speller, "kolla");
+    speller.threads = 4;
+    speller.split_after = 1;
+    speller.max_expanded = 1000000;
+    speller.max_frontier = 1000000;
+    expect(corrections(speller, "kolla") == whole && !speller.limit_reached,
+           "kolla whole in a split search within its budgets");
+    speller.max_frontier = 1;
+    Corrections part = corrections(speller, "kolla");
+    expect(speller.limit_reached, "kolla stopped in a split search");
+    expect(found_in(part, whole), "kolla in a split search found in whole");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+if test -x ./tests/search-budget ; then
+    if ! ./tests/search-budget $srcdir/tests/errmodel.edit1.hfst $srcdir/tests/acceptor.threads.hfst ; then
+        exit 1
+    fi
+else
+    echo ./tests/search-budget not built
+    exit 77
+fi
+if test -x ./hfst-ospell ; then
+    if ./hfst-ospell -v -S $srcdir/tests/speller_edit1.zhfst < $srcdir/tests/test.strings | grep -q "was stopped" ; then
+        exit 1
+    fi
+    for limit in "-N 1" "-F 1" "-t 0.000000001" ; do
+        if ! ./hfst-ospell -v -S $limit $srcdir/tests/speller_edit1.zhfst < $srcdir/tests/test.strings | grep -q "was stopped" ; then
+            exit 1
+        fi
+    done
+else
+    echo ./hfst-ospell not built
+    exit 77
+fi
@@ -0,0 +1,176 @@
+// Copyright 2010 University of Helsinki
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*
+  Checks that Spellers in several threads searching one SpellerModel, and
+  calls of one ZHfstOspeller from several threads, give the same answers
+  as a speller of its own gives one word at a time, and that the model
+  stays as it was loaded.
+
+  Usage: shared-model ERRMODEL LEXICON
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ospell.h"
+#include "test-support.h"
+#include "ZHfstOspeller.h"
+
+using hfst_ol::Speller;
+using hfst_ol::SpellerModel;
+using hfst_ol::Transducer;
+using hfst_ol::ZHfstOspeller;
+
+static const unsigned int THREADS = 4;
+static const unsigned int ROUNDS = 50;
+static const int NBEST = 3;
+
+// words with corrections of the same weight, and ones with characters
+// neither automaton has
+static const char * words[] = {
+    "kqla", "kalq", "qala", "kala", "tqlo", "kaxat", "sqli", "kolla",
+    "käla", "kalä", "€", "ta€o", "", "k", "kalatt", "vala"
+};
+static const size_t WORD_COUNT = sizeof(words) / sizeof(words[0]);
+
+// what each word should give
+struct Answer
+{
+    bool accepted;
+    Corrections corrections;
+};
+
+static std::vector<Answer> answers;
+static std::atomic<unsigned int> failures(0);
+
+static Answer
+answer(Speller & speller, const std::string & word)
+{
+    std::vector<char> line(word.begin(), word.end());
+    line.push_back('\0');
+    Answer found;
+    found.accepted = speller.check(&line[0]);
+    found.corrections = listed(speller.correct(&line[0], NBEST));
+    return found;
+}
+
+// check every word ROUNDS times with a speller of @a model, starting
+// from the word @a first
+static void
+search_model(SpellerModel * model, unsigned int first)
+{
+    Speller speller(model);
+    for (unsigned int round = 0; round < ROUNDS; ++round) {
+        for (size_t w = 0; w < WORD_COUNT; ++w) {
+            size_t word = (first + round + w) % WORD_COUNT;
+            Answer found = answer(speller, words[word]);
+            if (found.accepted != answers[word].accepted ||
+                found.corrections != answers[word].corrections) {
+                std::cerr << "FAIL: " << words[word] << " in thread "
+                          << first << std::endl;
+                ++failures;
+            }
+        }
+    }
+}
+
+// the same with @a ospeller
+static void
+search_ospeller(ZHfstOspeller * ospeller, unsigned int first)
+{
+    for (unsigned int round = 0; round < ROUNDS; ++round) {
+        for (size_t w = 0; w < WORD_COUNT; ++w) {
+            size_t word = (first + round + w) % WORD_COUNT;
+            if (ospeller->spell(words[word]) != answers[word].accepted ||
+                listed(ospeller->suggest(words[word])) !=
+                answers[word].corrections) {
+                std::cerr << "FAIL: " << words[word] << " in ospeller thread "
+                          << first << std::endl;
+                ++failures;
+            }
+        }
+    }
+}
+
+int
+main(int argc, char ** argv)
+{
+    if (argc != 3) {
+        std::cerr << "Usage: shared-model ERRMODEL LEXICON" << std::endl;
+        return 1;
+    }
+    Transducer * mutator = load(argv[1]);
+    Transducer * lexicon = load(argv[2]);
+    Transducer * own_mutator = load(argv[1]);
+    Transducer * own_lexicon = load(argv[2]);
+    Transducer * ospeller_mutator = load(argv[1]);
+    Transducer * ospeller_lexicon = load(argv[2]);
+    if (mutator == NULL || lexicon == NULL ||
+        own_mutator == NULL || own_lexicon == NULL ||
+        ospeller_mutator == NULL || ospeller_lexicon == NULL) {
+        return 1;
+    }
+    // the answers of a speller with a model of its own
+    Speller alone(own_mutator, own_lexicon);
+    for (size_t word = 0; word < WORD_COUNT; ++word) {
+        answers.push_back(answer(alone, words[word]));
+    }
+
+    // the shared model builds and drops its cache entries while it is
+    // searched
+    SpellerModel model(mutator, lexicon);
+    model.prefix_cache.configure(3, 16384);
+    size_t lexicon_symbols = lexicon->get_key_table()->size();
+    size_t mutator_symbols = mutator->get_key_table()->size();
+    size_t translated_symbols = model.alphabet_translator.size();
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < THREADS; ++t) {
+        threads.push_back(std::thread(search_model, &model, t));
+    }
+    for (auto & thread : threads) {
+        thread.join();
+    }
+    if (lexicon->get_key_table()->size() != lexicon_symbols ||
+        mutator->get_key_table()->size() != mutator_symbols ||
+        model.alphabet_translator.size() != translated_symbols) {
+        std::cerr << "FAIL: the alphabets of the model changed" << std::endl;
+        ++failures;
+    }
+    if (model.prefix_cache.get_statistics().hits == 0) {
+        std::cerr << "FAIL: the cache of the model wasn't used" << std::endl;
+        ++failures;
+    }
+
+    ZHfstOspeller ospeller;
+    ospeller.inject_speller(new Speller(ospeller_mutator, ospeller_lexicon));
+    ospeller.set_queue_limit(NBEST);
+    ospeller.set_prefix_cache(3, 16384);
+    ospeller.set_result_cache(8);
+    threads.clear();
+    for (unsigned int t = 0; t < THREADS; ++t) {
+        threads.push_back(std::thread(search_ospeller, &ospeller, t));
+    }
+    for (auto & thread : threads) {
+        thread.join();
+    }
+    return (failures > 0) ? 1 : 0;
+}
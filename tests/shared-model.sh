@@ -0,0 +1,10 @@
+#!/bin/bash
+
+if test -x ./tests/shared-model ; then
+    if ! ./tests/shared-model $srcdir/tests/errmodel.edit1.hfst $srcdir/tests/acceptor.threads.hfst ; then
+        exit 1
+    fi
+else
+    echo ./tests/shared-model not built
+    exit 77
+fi
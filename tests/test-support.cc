@@ -0,0 +1,88 @@
+// Copyright 2010 University of Helsinki
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <cstdio>
+#include <iostream>
+
+#include "test-support.h"
+
+using hfst_ol::CorrectionQueue;
+using hfst_ol::Speller;
+using hfst_ol::Transducer;
+using hfst_ol::Weight;
+
+bool failed = false;
+
+void
+expect(bool ok, const std::string & what)
+{
+    if (!ok) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failed = true;
+    }
+}
+
+Transducer *
+load(const char * filename)
+{
+    FILE * f = fopen(filename, "rb");
+    if (f == NULL) {
+        std::cerr << "cannot open " << filename << std::endl;
+        return NULL;
+    }
+    Transducer * t = new Transducer(f);
+    fclose(f);
+    return t;
+}
+
+Corrections
+listed(CorrectionQueue queue)
+{
+    Corrections found;
+    while (!queue.empty()) {
+        found.push_back(queue.top());
+        queue.pop();
+    }
+    return found;
+}
+
+// @a word as the NUL-terminated line Speller takes
+static std::vector<char>
+line_of(const std::string & word)
+{
+    std::vector<char> line(word.begin(), word.end());
+    line.push_back('\0');
+    return line;
+}
+
+Corrections
+corrections(Speller & speller, const std::string & word, int nbest,
+            Weight maxweight, Weight beam, float time_cutoff)
+{
+    std::vector<char> line = line_of(word);
+    return listed(speller.correct(&line[0], nbest, maxweight, beam,
+                                  time_cutoff));
+}
+
+bool
+check(Speller & speller, const std::string & word)
+{
+    std::vector<char> line = line_of(word);
+    return speller.check(&line[0]);
+}
@@ -0,0 +1,55 @@
+// Copyright 2010 University of Helsinki
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+
+/*
+  What the test programs have in common: reporting failed checks, loading
+  the automata given on the command line and reading out what a Speller
+  answers for a word.
+ */
+
+#ifndef HFST_OSPELL_TESTS_TEST_SUPPORT_H_
+#define HFST_OSPELL_TESTS_TEST_SUPPORT_H_ 1
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ospell.h"
+
+//! corrections as a CorrectionQueue gives them out, best first
+typedef std::vector<std::pair<std::string, hfst_ol::Weight> > Corrections;
+
+//! whether any expect() has failed
+extern bool failed;
+
+//! report @a what unless @a ok
+void expect(bool ok, const std::string & what);
+
+//! the transducer in @a filename, or NULL if it can't be opened
+hfst_ol::Transducer * load(const char * filename);
+
+//! the corrections in @a queue
+Corrections listed(hfst_ol::CorrectionQueue queue);
+
+//! the corrections of @a word by @a speller with the limits given as to
+//! Speller::correct()
+Corrections corrections(hfst_ol::Speller & speller, const std::string & word,
+                        int nbest = 0, hfst_ol::Weight maxweight = -1.0,
+                        hfst_ol::Weight beam = -1.0, float time_cutoff = 0.0);
+
+//! whether @a speller accepts @a word
+bool check(hfst_ol::Speller & speller, const std::string & word);
+
+#endif // HFST_OSPELL_TESTS_TEST_SUPPORT_H_
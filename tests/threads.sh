@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# -A 1 shares every search that takes more than one node among the
+# threads, so that even these small searches are split. The words of
+# threads.strings have several corrections of the same weight, which only
+# come out the same if the split search picks them like the single one.
+if test -x ./hfst-ospell ; then
+    for options in "-n 1" "-n 2" "-n 3" "-n 2 -w 1" "-n 3 -b 0.5" "-w 10" ; do
+        ./hfst-ospell -S -X $options $srcdir/tests/speller_threads.zhfst < $srcdir/tests/threads.strings > threads_single.out
+        for run in 1 2 3 ; do
+            ./hfst-ospell -S -X -T 4 -A 1 $options $srcdir/tests/speller_threads.zhfst < $srcdir/tests/threads.strings > threads_split.out
+            if ! cmp threads_single.out threads_split.out ; then
+                exit 1
+            fi
+        done
+    done
+    ./hfst-ospell -S -X -n 2 -x $srcdir/tests/speller_threads.zhfst < $srcdir/tests/threads.strings > threads_single.out
+    ./hfst-ospell -S -X -n 2 -x -T 4 -A 1 $srcdir/tests/speller_threads.zhfst < $srcdir/tests/threads.strings > threads_split.out
+    if ! cmp threads_single.out threads_split.out ; then
+        exit 1
+    fi
+    rm -f threads_single.out threads_split.out
+else
+    echo ./hfst-ospell not built
+    exit 77
+fi
@@ -0,0 +1,117 @@
+// Copyright 2010 University of Helsinki
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+/*
+  Checks that the characters of an input that the automata don't have are
+  only known to the speller for that input: the identity symbol of the
+  language model matches them, the error model corrects them, and after
+  more different ones than symbols can be numbered, the tables of the
+  model and the speller are as big as they were.
+
+  Usage: unknown-symbols ERRMODEL LEXICON
+
+  The language model has to accept "kala" and "#" followed by any
+  characters it doesn't have.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ospell.h"
+#include "test-support.h"
+
+using hfst_ol::Speller;
+using hfst_ol::SpellerModel;
+using hfst_ol::Transducer;
+
+// the best correction of @a word, or "" if there is none
+static std::string
+best_correction(Speller & speller, const std::string & word)
+{
+    Corrections found = corrections(speller, word, 1);
+    return found.empty() ? "" : found[0].first;
+}
+
+// the UTF-8 of the code point @a c, which is at least 0x10000
+static std::string
+utf8(unsigned long c)
+{
+    std::string bytes;
+    bytes += static_cast<char>(0xf0 | (c >> 18));
+    bytes += static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+    bytes += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+    bytes += static_cast<char>(0x80 | (c & 0x3f));
+    return bytes;
+}
+
+int
+main(int argc, char ** argv)
+{
+    if (argc != 3) {
+        std::cerr << "Usage: unknown-symbols ERRMODEL LEXICON" << std::endl;
+        return 1;
+    }
+    Transducer * mutator = load(argv[1]);
+    Transducer * lexicon = load(argv[2]);
+    if (mutator == NULL || lexicon == NULL) {
+        return 1;
+    }
+    SpellerModel model(mutator, lexicon);
+    Speller speller(&model);
+    size_t lexicon_symbols = lexicon->get_key_table()->size();
+    size_t mutator_symbols = mutator->get_key_table()->size();
+    size_t translated_symbols = model.alphabet_translator.size();
+
+    expect(check(speller, "#ä"), "#ä accepted");
+    expect(check(speller, "#äöä"), "#äöä accepted");
+    expect(speller.output_keys.size() == lexicon_symbols + 2,
+           "the symbols of #äöä known for #äöä");
+    expect(!check(speller, "ä"), "ä rejected");
+    expect(!check(speller, "#k"), "#k rejected");
+    expect(best_correction(speller, "käla") == "kala", "käla corrected");
+    expect(best_correction(speller, "kalaä") == "kala", "kalaä corrected");
+    expect(best_correction(speller, "äälä") == "", "äälä not corrected");
+    expect(check(speller, "kala"), "kala accepted");
+    expect(speller.output_keys.size() == lexicon_symbols &&
+           speller.alphabet_translator.size() == translated_symbols,
+           "the symbols of the speller forgotten after kala");
+
+    // more different characters than there are symbol numbers, one input
+    // at a time
+    bool all_accepted = true;
+    std::string many = "#";
+    for (unsigned long c = 0x10000; c < 0x10000 + 70000; ++c) {
+        all_accepted = all_accepted && check(speller, "#" + utf8(c));
+        if (c % 100 == 0) {
+            many += utf8(c);
+        }
+    }
+    expect(all_accepted, "every unknown character accepted after #");
+    expect(check(speller, many), "700 unknown characters accepted at once");
+    expect(best_correction(speller, utf8(0x10000) + "ala") == "kala",
+           "unknown character corrected after the rest");
+
+    expect(lexicon->get_key_table()->size() == lexicon_symbols,
+           "the symbols of the language model unchanged");
+    expect(mutator->get_key_table()->size() == mutator_symbols,
+           "the symbols of the error model unchanged");
+    expect(model.alphabet_translator.size() == translated_symbols,
+           "the translation of the model unchanged");
+    return failed ? 1 : 0;
+}
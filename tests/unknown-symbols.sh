@@ -0,0 +1,10 @@
+#!/bin/bash
+
+if test -x ./tests/unknown-symbols ; then
+    if ! ./tests/unknown-symbols $srcdir/tests/errmodel.edit1.hfst $srcdir/tests/acceptor.flags.hfst ; then
+        exit 1
+    fi
+else
+    echo ./tests/unknown-symbols not built
+    exit 77
+fi